@@ -0,0 +1,286 @@
+#include "acl.h"
+#include "logger.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define ACL_NONE  (-1)
+#define ACL_DENY  0
+#define ACL_ALLOW 1
+#define ACL_DENY_REPLY 2   /* prefix deny with reply */
+
+/* Node 0 is the IPv4 root, node 1 the IPv6 root; child 0 means none */
+typedef struct {
+    uint32_t child[2];
+    int32_t  action;
+} AclNode;
+
+typedef struct {
+    AclNode *nodes;
+    uint32_t count;
+    uint32_t cap;
+    int      rules;      /* prefixes inserted */
+} AclTrie;
+
+typedef struct {
+    char   prefix[128];
+    size_t len;
+    AclTrie trie;
+} AclPathGroup;
+
+struct AclScope {
+    int  *rule_idx;      /* listener-limited rules that apply, for sharing */
+    int   nrule_idx;
+    AclTrie ip;
+    AclPathGroup *paths; /* longest prefix first */
+    int   npaths;
+};
+
+static const ServerConfig *g_cfg = NULL;
+static AclScope **g_scopes = NULL;   /* [0] is the scope of unlisted listeners */
+static int g_nscopes = 0;
+
+static int trie_init(AclTrie *t) {
+    t->cap = 64;
+    t->nodes = (AclNode *)calloc(t->cap, sizeof(AclNode));
+    if (!t->nodes) return -1;
+    t->count = 2;
+    t->nodes[0].action = ACL_NONE;
+    t->nodes[1].action = ACL_NONE;
+    t->rules = 0;
+    return 0;
+}
+
+static void trie_free(AclTrie *t) {
+    free(t->nodes);
+    t->nodes = NULL;
+}
+
+/* Later inserts of the same prefix replace earlier ones */
+static int trie_insert(AclTrie *t, const AclRule *r) {
+    uint32_t n = (r->family == AF_INET) ? 0 : 1;
+    for (int i = 0; i < r->prefix_len; ++i) {
+        int bit = (r->addr[i >> 3] >> (7 - (i & 7))) & 1;
+        if (t->nodes[n].child[bit] == 0) {
+            if (t->count == t->cap) {
+                uint32_t ncap = t->cap * 2;
+                AclNode *nn = (AclNode *)realloc(t->nodes, ncap * sizeof(AclNode));
+                if (!nn) return -1;
+                t->nodes = nn;
+                t->cap = ncap;
+            }
+            AclNode *c = &t->nodes[t->count];
+            c->child[0] = c->child[1] = 0;
+            c->action = ACL_NONE;
+            t->nodes[n].child[bit] = t->count++;
+        }
+        n = t->nodes[n].child[bit];
+    }
+    t->nodes[n].action = r->allow ? ACL_ALLOW : r->reply ? ACL_DENY_REPLY : ACL_DENY;
+    t->rules++;
+    return 0;
+}
+
+/* Action of the longest matching prefix, or ACL_NONE */
+static int trie_lookup_v4(const AclTrie *t, uint32_t addr) {
+    const AclNode *nodes = t->nodes;
+    int best = nodes[0].action;
+    uint32_t n = 0;
+    for (int i = 31; i >= 0; --i) {
+        n = nodes[n].child[(addr >> i) & 1];
+        if (n == 0) break;
+        if (nodes[n].action != ACL_NONE) best = nodes[n].action;
+    }
+    return best;
+}
+
+/* spec is "ip" (any port) or "ip:port" */
+static int listener_matches(const char *spec, const char *addr, int port) {
+    const char *colon = strrchr(spec, ':');
+    size_t alen = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (strlen(addr) != alen || strncmp(spec, addr, alen) != 0) return 0;
+    return !colon || atoi(colon + 1) == port;
+}
+
+static int by_prefix_len_desc(const void *a, const void *b) {
+    size_t la = ((const AclPathGroup *)a)->len, lb = ((const AclPathGroup *)b)->len;
+    return (la < lb) - (la > lb);
+}
+
+/* Insert the rules of one group: global ones first, so that rules limited
+ * to the listener override them */
+static int scope_insert(AclTrie *t, const int *idx, int nidx, const char *prefix) {
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < g_cfg->num_acl_rules; ++i) {
+            const AclRule *r = &g_cfg->acl_rules[i];
+            if (strcmp(r->path_prefix, prefix) != 0) continue;
+            if (pass == 0 && r->listener[0] != '\0') continue;
+            if (pass == 1) {
+                int listed = 0;
+                for (int k = 0; k < nidx && !listed; ++k) listed = (idx[k] == i);
+                if (!listed) continue;
+            }
+            if (trie_insert(t, r) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static AclScope *scope_build(int *idx, int nidx) {
+    AclScope *sc = (AclScope *)calloc(1, sizeof(AclScope));
+    if (!sc || trie_init(&sc->ip) != 0) {
+        free(sc);
+        return NULL;
+    }
+    sc->rule_idx = idx;
+    sc->nrule_idx = nidx;
+
+    if (g_cfg->acl_default_deny) {
+        AclRule all;
+        memset(&all, 0, sizeof(all));
+        all.family = AF_INET;
+        trie_insert(&sc->ip, &all);
+        all.family = AF_INET6;
+        trie_insert(&sc->ip, &all);
+    }
+    if (scope_insert(&sc->ip, idx, nidx, "") != 0) goto fail;
+
+    /* One group per distinct prefix= among the applicable rules */
+    for (int i = 0; i < g_cfg->num_acl_rules; ++i) {
+        const AclRule *r = &g_cfg->acl_rules[i];
+        if (r->path_prefix[0] == '\0') continue;
+        int applies = (r->listener[0] == '\0');
+        for (int k = 0; k < nidx && !applies; ++k) applies = (idx[k] == i);
+        if (!applies) continue;
+
+        int seen = 0;
+        for (int g = 0; g < sc->npaths && !seen; ++g) {
+            seen = (strcmp(sc->paths[g].prefix, r->path_prefix) == 0);
+        }
+        if (seen) continue;
+
+        AclPathGroup *np = (AclPathGroup *)realloc(sc->paths,
+                                                   (size_t)(sc->npaths + 1) * sizeof(AclPathGroup));
+        if (!np) goto fail;
+        sc->paths = np;
+        AclPathGroup *pg = &sc->paths[sc->npaths];
+        safe_strcpy(pg->prefix, sizeof(pg->prefix), r->path_prefix);
+        pg->len = strlen(pg->prefix);
+        if (trie_init(&pg->trie) != 0) goto fail;
+        sc->npaths++;
+        if (scope_insert(&pg->trie, idx, nidx, pg->prefix) != 0) goto fail;
+    }
+    qsort(sc->paths, (size_t)sc->npaths, sizeof(AclPathGroup), by_prefix_len_desc);
+    return sc;
+
+fail:
+    for (int g = 0; g < sc->npaths; ++g) trie_free(&sc->paths[g].trie);
+    free(sc->paths);
+    trie_free(&sc->ip);
+    free(sc);
+    return NULL;
+}
+
+static void scope_free(AclScope *sc) {
+    if (!sc) return;
+    for (int g = 0; g < sc->npaths; ++g) trie_free(&sc->paths[g].trie);
+    free(sc->paths);
+    trie_free(&sc->ip);
+    free(sc->rule_idx);
+    free(sc);
+}
+
+int acl_init(const ServerConfig *cfg) {
+    g_cfg = cfg;
+    if (cfg->num_acl_rules == 0 && !cfg->acl_default_deny) return 0;
+
+    g_scopes = (AclScope **)calloc(1, sizeof(AclScope *));
+    if (!g_scopes) return -1;
+    g_scopes[0] = scope_build(NULL, 0);
+    if (!g_scopes[0]) {
+        free(g_scopes);
+        g_scopes = NULL;
+        return -1;
+    }
+    g_nscopes = 1;
+    log_msg(LOG_INFO, "acl: %d rules, default %s", cfg->num_acl_rules,
+            cfg->acl_default_deny ? "deny" : "allow");
+    return 0;
+}
+
+void acl_shutdown(void) {
+    for (int i = 0; i < g_nscopes; ++i) scope_free(g_scopes[i]);
+    free(g_scopes);
+    g_scopes = NULL;
+    g_nscopes = 0;
+}
+
+const AclScope *acl_scope_for(const char *bind_addr, int bind_port) {
+    if (!g_scopes) return NULL;
+
+    int *idx = NULL;
+    int nidx = 0;
+    for (int i = 0; i < g_cfg->num_acl_rules; ++i) {
+        const AclRule *r = &g_cfg->acl_rules[i];
+        if (r->listener[0] == '\0' || !listener_matches(r->listener, bind_addr, bind_port)) continue;
+        int *n = (int *)realloc(idx, (size_t)(nidx + 1) * sizeof(int));
+        if (!n) break;
+        idx = n;
+        idx[nidx++] = i;
+    }
+
+    /* Listeners matched by the same rules share one scope */
+    for (int s = 0; s < g_nscopes; ++s) {
+        AclScope *sc = g_scopes[s];
+        if (sc->nrule_idx == nidx &&
+            (nidx == 0 || memcmp(sc->rule_idx, idx, (size_t)nidx * sizeof(int)) == 0)) {
+            free(idx);
+            return (sc->ip.rules == 0 && sc->npaths == 0) ? NULL : sc;
+        }
+    }
+
+    AclScope **ns = (AclScope **)realloc(g_scopes, (size_t)(g_nscopes + 1) * sizeof(AclScope *));
+    AclScope *sc = ns ? scope_build(idx, nidx) : NULL;
+    if (ns) g_scopes = ns;
+    if (!sc) {
+        /* Fail closed: a listener whose rules cannot be built serves nobody */
+        log_msg(LOG_ERROR, "acl: cannot build rules for %s:%d, denying all", bind_addr, bind_port);
+        free(idx);
+        static AclScope deny_all;
+        if (!deny_all.ip.nodes) {
+            static AclNode root[2] = { { { 0, 0 }, ACL_DENY }, { { 0, 0 }, ACL_DENY } };
+            deny_all.ip.nodes = root;
+            deny_all.ip.count = 2;
+            deny_all.ip.rules = 2;
+        }
+        return &deny_all;
+    }
+    g_scopes[g_nscopes++] = sc;
+    return sc;
+}
+
+int acl_allow_addr(const AclScope *sc, const struct in_addr *a) {
+    if (sc->ip.rules == 0) return 1;
+    return trie_lookup_v4(&sc->ip, ntohl(a->s_addr)) != ACL_DENY;
+}
+
+int acl_allow_path(const AclScope *sc, const struct in_addr *a, const char *filename,
+                   int *reply) {
+    *reply = 0;
+    while (*filename == '/') filename++;
+    uint32_t addr = ntohl(a->s_addr);
+    for (int g = 0; g < sc->npaths; ++g) {
+        const AclPathGroup *pg = &sc->paths[g];
+        if (strncmp(filename, pg->prefix, pg->len) != 0) continue;
+        int act = trie_lookup_v4(&pg->trie, addr);
+        if (act != ACL_NONE) {
+            *reply = (act == ACL_DENY_REPLY);
+            return act == ACL_ALLOW;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include "config.h"
+#include <netinet/in.h>
+
+/*
+ * Client access control (acl= rules), compiled at startup into binary
+ * tries keyed on the client address, so a lookup is one longest-prefix
+ * walk. Each listener gets a scope: the global rules plus the rules
+ * limited to that listener, with listener rules winning at equal prefix
+ * length. Within a scope, rules without prefix= decide whether a datagram
+ * is looked at at all. Rules with prefix= then apply to filenames under
+ * that prefix, the longest prefix first.
+ */
+
+typedef struct AclScope AclScope;
+
+int acl_init(const ServerConfig *cfg);
+void acl_shutdown(void);
+
+/* Scope for a listener; NULL if no rule applies to it (all allowed).
+ * Call during startup only. */
+const AclScope *acl_scope_for(const char *bind_addr, int bind_port);
+
+/* 1 if the client may send requests to the listener at all */
+int acl_allow_addr(const AclScope *sc, const struct in_addr *a);
+
+/* 1 if the client may access filename (relative to root_dir). On a deny,
+ * *reply says whether the rule wants an error sent rather than a drop. */
+int acl_allow_path(const AclScope *sc, const struct in_addr *a, const char *filename,
+                   int *reply);
+
+#endif
@@ -0,0 +1,225 @@
+#include "bundle.h"
+#include "logger.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct Bundle {
+    int refs;
+    const unsigned char *base;
+    size_t size;
+    const BundleHeader *hdr;
+    const uint32_t *buckets;
+    const BundleEntry *entries;
+    const char *names;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+};
+
+uint64_t bundle_hash(const char *name, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Check that every table and entry lies inside the mapping */
+static int bundle_valid(const unsigned char *base, size_t size) {
+    if (size < sizeof(BundleHeader)) return 0;
+    const BundleHeader *h = (const BundleHeader *)base;
+    if (h->magic != BUNDLE_MAGIC || h->version != BUNDLE_VERSION) return 0;
+    if (h->total_size != size) return 0;
+    if (h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0) return 0;
+    if (h->bucket_count < h->entry_count) return 0;
+
+    uint64_t bsize = (uint64_t)h->bucket_count * sizeof(uint32_t);
+    uint64_t esize = (uint64_t)h->entry_count * sizeof(BundleEntry);
+    if (h->buckets_offset > size || bsize > size - h->buckets_offset) return 0;
+    if (h->entries_offset > size || esize > size - h->entries_offset) return 0;
+    if (h->entries_offset % sizeof(uint64_t) != 0) return 0;
+    if (h->names_offset > size || h->data_offset > size) return 0;
+
+    const uint32_t *buckets = (const uint32_t *)(base + h->buckets_offset);
+    for (uint32_t i = 0; i < h->bucket_count; ++i) {
+        if (buckets[i] > h->entry_count) return 0;
+    }
+    const BundleEntry *e = (const BundleEntry *)(base + h->entries_offset);
+    uint64_t names_size = size - h->names_offset;
+    for (uint32_t i = 0; i < h->entry_count; ++i) {
+        if ((uint64_t)e[i].name_offset + e[i].name_len > names_size) return 0;
+        if (e[i].offset > size || e[i].size > size - e[i].offset) return 0;
+    }
+    return 1;
+}
+
+Bundle *bundle_load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void *base = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        if (size == 0) errno = EINVAL;
+        return NULL;
+    }
+
+    Bundle *b = (Bundle *)calloc(1, sizeof(*b));
+    if (!b || !bundle_valid((const unsigned char *)base, size)) {
+        free(b);
+        munmap(base, size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    b->refs = 1;
+    b->base = (const unsigned char *)base;
+    b->size = size;
+    b->hdr = (const BundleHeader *)base;
+    b->buckets = (const uint32_t *)(b->base + b->hdr->buckets_offset);
+    b->entries = (const BundleEntry *)(b->base + b->hdr->entries_offset);
+    b->names = (const char *)(b->base + b->hdr->names_offset);
+    b->dev = st.st_dev;
+    b->ino = st.st_ino;
+    b->mtime = st.st_mtim;
+    return b;
+}
+
+int bundle_lookup(const Bundle *b, const char *name, BundleFile *out) {
+    size_t len = strlen(name);
+    uint64_t h = bundle_hash(name, len);
+    uint32_t mask = b->hdr->bucket_count - 1;
+
+    for (uint32_t probe = 0, i = (uint32_t)h & mask; probe <= mask; ++probe, i = (i + 1) & mask) {
+        uint32_t slot = b->buckets[i];
+        if (slot == 0) return -1;
+
+        const BundleEntry *e = &b->entries[slot - 1];
+        if (e->hash == h && e->name_len == len &&
+            memcmp(b->names + e->name_offset, name, len) == 0) {
+            out->data = b->base + e->offset;
+            out->size = (long long)e->size;
+            out->offset = e->offset;
+            out->dev = b->dev;
+            out->ino = b->ino;
+            out->mtime_sec = (int64_t)b->mtime.tv_sec;
+            out->mtime_nsec = b->mtime.tv_nsec;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+unsigned bundle_count(const Bundle *b) {
+    return b->hdr->entry_count;
+}
+
+/* ---- Server side: current bundle and hot swap ---- */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static Bundle *g_current = NULL;
+static char *g_path = NULL;
+
+Bundle *bundle_acquire(void) {
+    pthread_mutex_lock(&g_lock);
+    Bundle *b = g_current;
+    if (b) b->refs++;
+    pthread_mutex_unlock(&g_lock);
+    return b;
+}
+
+void bundle_release(Bundle *b) {
+    if (!b) return;
+    pthread_mutex_lock(&g_lock);
+    int last = (--b->refs == 0);
+    pthread_mutex_unlock(&g_lock);
+    if (last) {
+        munmap((void *)b->base, b->size);
+        free(b);
+    }
+}
+
+static void bundle_install(Bundle *b) {
+    pthread_mutex_lock(&g_lock);
+    Bundle *old = g_current;
+    g_current = b;
+    pthread_mutex_unlock(&g_lock);
+    bundle_release(old);
+}
+
+static int same_file(const struct stat *st, const Bundle *b) {
+    return b && st->st_dev == b->dev && st->st_ino == b->ino &&
+           (size_t)st->st_size == b->size &&
+           st->st_mtim.tv_sec == b->mtime.tv_sec &&
+           st->st_mtim.tv_nsec == b->mtime.tv_nsec;
+}
+
+static void *bundle_watch_main(void *arg) {
+    (void)arg;
+    struct stat last_bad;
+    memset(&last_bad, 0, sizeof(last_bad));
+
+    for (;;) {
+        sleep(1);
+
+        struct stat st;
+        if (stat(g_path, &st) != 0) continue;
+
+        Bundle *cur = bundle_acquire();
+        int unchanged = same_file(&st, cur);
+        bundle_release(cur);
+        if (unchanged) continue;
+        /* Report a broken replacement once, not every second */
+        if (st.st_ino == last_bad.st_ino && st.st_mtim.tv_sec == last_bad.st_mtim.tv_sec &&
+            st.st_mtim.tv_nsec == last_bad.st_mtim.tv_nsec && st.st_size == last_bad.st_size) {
+            continue;
+        }
+
+        Bundle *b = bundle_load(g_path);
+        if (!b) {
+            log_msg(LOG_ERROR, "root_bundle %s changed but is not a valid bundle, keeping current one",
+                    g_path);
+            last_bad = st;
+            continue;
+        }
+        bundle_install(b);
+        log_msg(LOG_INFO, "root_bundle %s reloaded: %u files", g_path, bundle_count(b));
+    }
+    return NULL;
+}
+
+int bundle_serve(const char *path, size_t thread_stack) {
+    g_path = strdup(path);
+    if (!g_path) return -1;
+
+    Bundle *b = bundle_load(path);
+    if (b) {
+        bundle_install(b);
+        log_msg(LOG_INFO, "root_bundle %s: %u files", path, bundle_count(b));
+    } else {
+        log_msg(LOG_ERROR, "root_bundle %s: %s, serving from root_dir until it appears",
+                path, errno == EINVAL ? "not a valid bundle" : strerror(errno));
+    }
+
+    pthread_t th;
+    if (thread_spawn(&th, bundle_watch_main, NULL, thread_stack, 1) != 0) {
+        log_msg(LOG_ERROR, "root_bundle: cannot start reload thread");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Packed root_dir bundle, built by ctftp-pack and served via root_bundle=.
+ *
+ * One file holds a header, an open-addressing hash table, the entry table
+ * (sorted by name), the names and the file contents (each aligned to
+ * BUNDLE_ALIGN). The server maps it read-only, so a lookup is one hash
+ * probe and serving reads straight from the page cache, with no path
+ * walks or open() calls. Integers are in host byte order: a bundle is
+ * built for the machine (architecture) that serves it.
+ *
+ *   BundleHeader
+ *   uint32_t buckets[bucket_count]   entry index + 1, 0 = empty
+ *   BundleEntry entries[entry_count]
+ *   names (not NUL-terminated)
+ *   file contents
+ */
+
+#define BUNDLE_MAGIC   0x42465443u  /* "CTFB" little-endian */
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN   64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t bucket_count;     /* power of two, at least 2 * entry_count */
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+    uint64_t data_offset;
+    uint64_t total_size;       /* size of the whole bundle file */
+    uint64_t reserved;
+} BundleHeader;
+
+typedef struct {
+    uint64_t hash;             /* bundle_hash() of the name */
+    uint64_t offset;           /* contents, from the start of the bundle */
+    uint64_t size;
+    int64_t  mtime;            /* source file mtime (seconds) */
+    uint32_t name_offset;      /* from names_offset */
+    uint32_t name_len;
+} BundleEntry;
+
+/* FNV-1a, 64-bit */
+uint64_t bundle_hash(const char *name, size_t len);
+
+/* A mapped bundle; shared by sessions and reference counted */
+typedef struct Bundle Bundle;
+
+/* One file found in a bundle; valid while the Bundle reference is held */
+typedef struct {
+    const unsigned char *data;
+    long long size;
+    uint64_t  offset;
+    dev_t     dev;             /* identity of the bundle file, for caching */
+    ino_t     ino;
+    int64_t   mtime_sec;
+    long      mtime_nsec;
+} BundleFile;
+
+/* Map and validate a bundle; returns NULL (errno set) on failure */
+Bundle *bundle_load(const char *path);
+
+/* Returns 0 and fills *out if name is in the bundle, -1 otherwise */
+int bundle_lookup(const Bundle *b, const char *name, BundleFile *out);
+
+unsigned bundle_count(const Bundle *b);
+
+/*
+ * Server side: serve path as the current bundle and poll it once a second,
+ * swapping in a replacement atomically (ctftp-pack renames the new bundle
+ * into place). Sessions pin the bundle they started with, so an old
+ * mapping stays valid until its last transfer ends.
+ */
+int bundle_serve(const char *path, size_t thread_stack);
+Bundle *bundle_acquire(void);
+void bundle_release(Bundle *b);
+
+#endif
@@ -3,37 +3,88 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
+
+/* Replace a heap string setting */
+static void set_str(char **dst, const char *val) {
+    char *copy = strdup(val);
+    if (!copy) return;
+    free(*dst);
+    *dst = copy;
+}
 
 static void set_defaults(ServerConfig *cfg) {
     memset(cfg, 0, sizeof(*cfg));
-    safe_strcpy(cfg->root_dir, sizeof(cfg->root_dir), "/var/tftp");
-    safe_strcpy(cfg->log_dir, sizeof(cfg->log_dir), "/var/tftp/logs");
+    set_str(&cfg->root_dir, "/var/tftp");
+    set_str(&cfg->log_dir, "/var/tftp/logs");
+
+    cfg->listeners = (ListenerConfig *)calloc(1, sizeof(ListenerConfig));
+    if (cfg->listeners) {
+        cfg->num_listeners = 1;
+        safe_strcpy(cfg->listeners[0].addr, sizeof(cfg->listeners[0].addr), "0.0.0.0");
+        cfg->listeners[0].port = 69;
+    }
 
-    cfg->num_listeners = 1;
-    safe_strcpy(cfg->listeners[0].addr, sizeof(cfg->listeners[0].addr), "0.0.0.0");
-    cfg->listeners[0].port = 69;
+    cfg->num_sinks = 0;
+    cfg->event_format = 0; /* json */
+    cfg->event_rollup_sec = 0;
+    cfg->event_rollup_keys = 1024;
 
-    cfg->event_udp_host[0] = '\0';
-    cfg->event_udp_port = 0;
+    cfg->allow_upload = 0;
+    cfg->upload_max_bytes = 0;
+    cfg->num_upload_quotas = 0;
+    cfg->upload_buffer = 256 * 1024;
 
-    cfg->event_http_host[0] = '\0';
-    cfg->event_http_port = 0;
-    cfg->event_http_path[0] = '\0';
+    cfg->max_blksize = 65464;
+    cfg->io_backend = 0;
+    cfg->content_cache_mb = 64;
+    cfg->content_spill_mb = 1024;
+    cfg->warm_auto = 256;
+    cfg->warm_mlock_mb = 0;
+    cfg->stats_entries = 1024;
+    cfg->upgrade_drain_sec = 300;
+    cfg->xdp.frames = 4096;
+    cfg->xdp.port_lo = 61000;
+    cfg->xdp.port_hi = 62023;
 
     cfg->timeout_sec = 3;
     cfg->max_retries = 5;
     cfg->log_level = 1; /* info */
+    cfg->thread_stack_kb = 128;
+    cfg->flight_recorder = 256;
+    set_str(&cfg->origin_cache_dir, "/var/cache/ctftp");
+    set_str(&cfg->content_spill_dir, "/var/tmp");
+    cfg->origin_ttl_sec = 300;
+    cfg->origin_timeout_sec = 10;
 }
 
-static void parse_listeners(ServerConfig *cfg, const char *val) {
-    /* Format: ip:port,ip:port,... */
-    char buf[512];
-    safe_strcpy(buf, sizeof(buf), val);
+static void add_listener(ServerConfig *cfg, int *cap, const char *ip, int port) {
+    if (cfg->num_listeners == *cap) {
+        int ncap = *cap ? *cap * 2 : 8;
+        ListenerConfig *n = (ListenerConfig *)realloc(cfg->listeners,
+                                                      (size_t)ncap * sizeof(ListenerConfig));
+        if (!n) return;
+        cfg->listeners = n;
+        *cap = ncap;
+    }
+    ListenerConfig *l = &cfg->listeners[cfg->num_listeners++];
+    safe_strcpy(l->addr, sizeof(l->addr), ip);
+    l->port = port;
+}
+
+/*
+ * Format: ip:port,ip:port,... The first listeners= line replaces the
+ * default listener; further lines append, so large listener sets can be
+ * split over several lines.
+ */
+static void parse_listeners(ServerConfig *cfg, const char *val, int *explicit_set, int *cap) {
+    char *buf = strdup(val);
+    if (!buf) return;
+
     char *saveptr = NULL;
     char *token = strtok_r(buf, ",", &saveptr);
-    int count = 0;
 
-    while (token && count < MAX_LISTENERS) {
+    while (token) {
         trim(token);
         char *colon = strchr(token, ':');
         if (!colon) {
@@ -48,38 +99,54 @@ static void parse_listeners(ServerConfig *cfg, const char *val) {
             token = strtok_r(NULL, ",", &saveptr);
             continue;
         }
-        safe_strcpy(cfg->listeners[count].addr, sizeof(cfg->listeners[count].addr), ip);
-        cfg->listeners[count].port = port;
-        count++;
+        if (!*explicit_set) {
+            /* drop the default listener */
+            cfg->num_listeners = 0;
+            *explicit_set = 1;
+        }
+        add_listener(cfg, cap, ip, port);
         token = strtok_r(NULL, ",", &saveptr);
     }
-    if (count > 0) cfg->num_listeners = count;
+    free(buf);
 }
 
-static void parse_udp(ServerConfig *cfg, const char *val) {
+static void sink_defaults(SinkConfig *sk, int type) {
+    memset(sk, 0, sizeof(*sk));
+    sk->type = type;
+    sk->format = -1;
+    sk->queue_cap = 256;
+    /* HTTP keeps one event per POST unless batching is asked for */
+    sk->batch = (type == SINK_HTTP) ? 1 : 32;
+    sk->drop_newest = 0;
+    sk->slots = 4096;
+}
+
+static int parse_udp_target(SinkConfig *sk, const char *val) {
     /* Format: host:port */
     char buf[256];
     safe_strcpy(buf, sizeof(buf), val);
     trim(buf);
-    if (buf[0] == '\0') return;
-    char *colon = strchr(buf, ':');
-    if (!colon) return;
+    if (buf[0] == '\0') return -1;
+    char *colon = strrchr(buf, ':');
+    if (!colon) return -1;
     *colon = '\0';
     const char *host = buf;
     const char *port_str = colon + 1;
     int port = 0;
-    if (parse_int(port_str, &port) != 0) return;
-    safe_strcpy(cfg->event_udp_host, sizeof(cfg->event_udp_host), host);
-    cfg->event_udp_port = port;
+    if (parse_int(port_str, &port) != 0 || port <= 0) return -1;
+    safe_strcpy(sk->host, sizeof(sk->host), host);
+    sk->port = port;
+    return 0;
 }
 
-static void parse_http_url(ServerConfig *cfg, const char *val) {
-    /* Only http://host[:port]/path */
+/* Split http://host[:port]/path; path comes back with a leading '/' */
+static int split_http_url(const char *val, char *host_out, size_t host_size, int *port_out,
+                          char *path_out, size_t path_size) {
     char buf[512];
     safe_strcpy(buf, sizeof(buf), val);
     trim(buf);
-    if (buf[0] == '\0') return;
-    if (!starts_with(buf, "http://")) return;
+    if (buf[0] == '\0') return -1;
+    if (!starts_with(buf, "http://")) return -1;
 
     char *p = buf + strlen("http://");
     char *slash = strchr(p, '/');
@@ -106,20 +173,284 @@ static void parse_http_url(ServerConfig *cfg, const char *val) {
     } else {
         safe_strcpy(host, sizeof(host), hostport);
     }
+    if (host[0] == '\0') return -1;
+
+    safe_strcpy(host_out, host_size, host);
+    *port_out = port;
+    snprintf(path_out, path_size, "/%s", path);
+    return 0;
+}
+
+static int parse_http_target(SinkConfig *sk, const char *val) {
+    /* Only http://host[:port]/path */
+    return split_http_url(val, sk->host, sizeof(sk->host), &sk->port,
+                          sk->path, sizeof(sk->path));
+}
+
+/* origin_url=http://host[:port]/base/ ; files are fetched as base + name */
+static void parse_origin_url(ServerConfig *cfg, const char *val) {
+    if (split_http_url(val, cfg->origin_host, sizeof(cfg->origin_host), &cfg->origin_port,
+                       cfg->origin_path, sizeof(cfg->origin_path) - 1) != 0) {
+        cfg->origin_enabled = 0;
+        return;
+    }
+    size_t len = strlen(cfg->origin_path);
+    if (cfg->origin_path[len - 1] != '/') {
+        cfg->origin_path[len] = '/';
+        cfg->origin_path[len + 1] = '\0';
+    }
+    cfg->origin_enabled = 1;
+}
+
+static void add_sink(ServerConfig *cfg, const SinkConfig *sk) {
+    if (cfg->num_sinks >= MAX_SINKS) return;
+    cfg->sinks[cfg->num_sinks++] = *sk;
+}
+
+/* Legacy single-target keys map onto the sink list */
+static void parse_udp(ServerConfig *cfg, const char *val) {
+    SinkConfig sk;
+    sink_defaults(&sk, SINK_UDP);
+    if (parse_udp_target(&sk, val) == 0) add_sink(cfg, &sk);
+}
+
+static void parse_http_url(ServerConfig *cfg, const char *val) {
+    SinkConfig sk;
+    sink_defaults(&sk, SINK_HTTP);
+    if (parse_http_target(&sk, val) == 0) add_sink(cfg, &sk);
+}
+
+static void parse_sink(ServerConfig *cfg, const char *val) {
+    /* Format: scheme://target [format=json|binary] [queue=N] [batch=N]
+     *         [drop=oldest|newest] [slots=N] */
+    char buf[512];
+    safe_strcpy(buf, sizeof(buf), val);
+    char *saveptr = NULL;
+    char *target = strtok_r(buf, " \t", &saveptr);
+    if (!target) return;
+
+    SinkConfig sk;
+    int rc = -1;
+    if (starts_with(target, "udp://")) {
+        sink_defaults(&sk, SINK_UDP);
+        rc = parse_udp_target(&sk, target + strlen("udp://"));
+    } else if (starts_with(target, "http://")) {
+        sink_defaults(&sk, SINK_HTTP);
+        rc = parse_http_target(&sk, target);
+    } else if (starts_with(target, "unix://")) {
+        sink_defaults(&sk, SINK_UNIX);
+        safe_strcpy(sk.path, sizeof(sk.path), target + strlen("unix://"));
+        rc = (sk.path[0] == '/') ? 0 : -1;
+    } else if (starts_with(target, "file://")) {
+        sink_defaults(&sk, SINK_FILE);
+        safe_strcpy(sk.path, sizeof(sk.path), target + strlen("file://"));
+        rc = (sk.path[0] == '/') ? 0 : -1;
+    } else if (starts_with(target, "shm://")) {
+        sink_defaults(&sk, SINK_SHM);
+        safe_strcpy(sk.path, sizeof(sk.path), target + strlen("shm://"));
+        rc = (sk.path[0] == '/') ? 0 : -1;
+    }
+    if (rc != 0) return;
+
+    char *opt;
+    while ((opt = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+        char *key = NULL;
+        char *v = NULL;
+        int n;
+        if (split_kv(opt, &key, &v) != 0) continue;
+        if (strcmp(key, "format") == 0) {
+            if (strcmp(v, "json") == 0) sk.format = 0;
+            else if (strcmp(v, "binary") == 0) sk.format = 1;
+        } else if (strcmp(key, "queue") == 0) {
+            if (parse_int(v, &n) == 0 && n > 1) sk.queue_cap = n;
+        } else if (strcmp(key, "batch") == 0) {
+            if (parse_int(v, &n) == 0 && n > 0) {
+                sk.batch = n < MAX_SINK_BATCH ? n : MAX_SINK_BATCH;
+            }
+        } else if (strcmp(key, "drop") == 0) {
+            if (strcmp(v, "oldest") == 0) sk.drop_newest = 0;
+            else if (strcmp(v, "newest") == 0) sk.drop_newest = 1;
+        } else if (strcmp(key, "slots") == 0) {
+            /* must be a power of two */
+            if (parse_int(v, &n) == 0 && n >= 2 && (n & (n - 1)) == 0) sk.slots = n;
+        }
+    }
+    add_sink(cfg, &sk);
+}
+
+static int parse_ll(const char *s, long long *out) {
+    char *end = NULL;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || v < 0) return -1;
+    *out = v;
+    return 0;
+}
+
+static void parse_upload_quotas(ServerConfig *cfg, const char *val) {
+    /* Format: prefix:bytes,prefix:bytes,... */
+    char buf[1024];
+    safe_strcpy(buf, sizeof(buf), val);
+    char *saveptr = NULL;
+    char *token = strtok_r(buf, ",", &saveptr);
+    int count = 0;
 
-    safe_strcpy(cfg->event_http_host, sizeof(cfg->event_http_host), host);
-    cfg->event_http_port = port;
-    char path_with_slash[256];
-    if (path[0] == '\0') {
-        safe_strcpy(path_with_slash, sizeof(path_with_slash), "/");
+    while (token && count < MAX_UPLOAD_QUOTAS) {
+        trim(token);
+        char *colon = strrchr(token, ':');
+        long long bytes = 0;
+        if (colon) {
+            *colon = '\0';
+            if (parse_ll(colon + 1, &bytes) == 0) {
+                char *prefix = token;
+                while (*prefix == '/') prefix++;
+                UploadQuota *q = &cfg->upload_quotas[count++];
+                safe_strcpy(q->prefix, sizeof(q->prefix), prefix);
+                q->max_bytes = bytes;
+            }
+        }
+        token = strtok_r(NULL, ",", &saveptr);
+    }
+    cfg->num_upload_quotas = count;
+}
+
+/* "10.0.0.0/8", "2001:db8::/32" or a bare address (host route) */
+static int parse_cidr(const char *s, AclRule *r) {
+    char buf[64];
+    safe_strcpy(buf, sizeof(buf), s);
+    char *slash = strchr(buf, '/');
+    if (slash) *slash = '\0';
+
+    memset(r->addr, 0, sizeof(r->addr));
+    int max;
+    if (inet_pton(AF_INET, buf, r->addr) == 1) {
+        r->family = AF_INET;
+        max = 32;
+    } else if (inet_pton(AF_INET6, buf, r->addr) == 1) {
+        r->family = AF_INET6;
+        max = 128;
     } else {
-        snprintf(path_with_slash, sizeof(path_with_slash), "/%s", path);
+        return -1;
+    }
+
+    r->prefix_len = max;
+    if (slash && (parse_int(slash + 1, &r->prefix_len) != 0 ||
+                  r->prefix_len < 0 || r->prefix_len > max)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Format: allow|deny cidr[,cidr...] [listener=ip[:port]] [prefix=path/] [reply]
+ * One rule is added per CIDR block. Returns -1 if the line is malformed.
+ */
+static int parse_acl(ServerConfig *cfg, const char *val, int *cap) {
+    char buf[1024];
+    safe_strcpy(buf, sizeof(buf), val);
+
+    AclRule base;
+    memset(&base, 0, sizeof(base));
+    char *saveptr = NULL;
+    char *action = strtok_r(buf, " \t", &saveptr);
+    char *cidrs = strtok_r(NULL, " \t", &saveptr);
+    if (!action || !cidrs) return -1;
+    if (strcmp(action, "allow") == 0) base.allow = 1;
+    else if (strcmp(action, "deny") != 0) return -1;
+
+    char *tok;
+    while ((tok = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+        if (starts_with(tok, "listener=")) {
+            safe_strcpy(base.listener, sizeof(base.listener), tok + 9);
+        } else if (starts_with(tok, "prefix=")) {
+            const char *prefix = tok + 7;
+            while (*prefix == '/') prefix++;
+            safe_strcpy(base.path_prefix, sizeof(base.path_prefix), prefix);
+        } else if (strcmp(tok, "reply") == 0) {
+            base.reply = 1;
+        } else {
+            return -1;
+        }
+    }
+    /* Only a prefix deny is decided after parsing, where a reply is possible */
+    if (base.reply && (base.allow || base.path_prefix[0] == '\0')) return -1;
+
+    char *saveptr2 = NULL;
+    for (char *c = strtok_r(cidrs, ",", &saveptr2); c; c = strtok_r(NULL, ",", &saveptr2)) {
+        AclRule r = base;
+        if (parse_cidr(c, &r) != 0) return -1;
+
+        if (cfg->num_acl_rules == *cap) {
+            int ncap = *cap ? *cap * 2 : 16;
+            AclRule *n = (AclRule *)realloc(cfg->acl_rules, (size_t)ncap * sizeof(AclRule));
+            if (!n) return -1;
+            cfg->acl_rules = n;
+            *cap = ncap;
+        }
+        cfg->acl_rules[cfg->num_acl_rules++] = r;
+    }
+    return 0;
+}
+
+/*
+ * Format: ip:port dev=ifname [queue=N] [mode=generic|native] [zerocopy=0|1]
+ *         [frames=N] [ports=lo-hi]. Returns -1 if the line is malformed.
+ */
+static int parse_xdp(ServerConfig *cfg, const char *val) {
+    char buf[512];
+    safe_strcpy(buf, sizeof(buf), val);
+    XdpListenerConfig x = cfg->xdp;
+
+    char *saveptr = NULL;
+    char *target = strtok_r(buf, " \t", &saveptr);
+    char *colon = target ? strrchr(target, ':') : NULL;
+    if (!colon) return -1;
+    *colon = '\0';
+    struct in_addr a;
+    if (inet_pton(AF_INET, target, &a) != 1 || a.s_addr == INADDR_ANY ||
+        parse_int(colon + 1, &x.port) != 0 || x.port <= 0 || x.port > 65535) {
+        return -1;
+    }
+    safe_strcpy(x.addr, sizeof(x.addr), target);
+    x.ifname[0] = '\0';
+
+    char *opt;
+    while ((opt = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+        char *key = NULL;
+        char *v = NULL;
+        if (split_kv(opt, &key, &v) != 0) return -1;
+        if (strcmp(key, "dev") == 0) {
+            safe_strcpy(x.ifname, sizeof(x.ifname), v);
+        } else if (strcmp(key, "queue") == 0) {
+            if (parse_int(v, &x.queue) != 0 || x.queue < 0) return -1;
+        } else if (strcmp(key, "mode") == 0) {
+            if (strcmp(v, "generic") == 0) x.native = 0;
+            else if (strcmp(v, "native") == 0) x.native = 1;
+            else return -1;
+        } else if (strcmp(key, "zerocopy") == 0) {
+            if (parse_int(v, &x.zerocopy) != 0) return -1;
+        } else if (strcmp(key, "frames") == 0) {
+            if (parse_int(v, &x.frames) != 0 || x.frames < 64 ||
+                (x.frames & (x.frames - 1)) != 0) {
+                return -1;
+            }
+        } else if (strcmp(key, "ports") == 0) {
+            if (sscanf(v, "%d-%d", &x.port_lo, &x.port_hi) != 2 || x.port_lo < 1024 ||
+                x.port_hi > 65535 || x.port_lo > x.port_hi) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
     }
-    safe_strcpy(cfg->event_http_path, sizeof(cfg->event_http_path), path_with_slash);
+    if (x.ifname[0] == '\0') return -1;
+    x.enabled = 1;
+    cfg->xdp = x;
+    return 0;
 }
 
 int load_config(const char *path, ServerConfig *cfg) {
     set_defaults(cfg);
+    if (!cfg->root_dir || !cfg->log_dir || !cfg->listeners) return -1;
 
     FILE *f = fopen(path, "r");
     if (!f) {
@@ -127,8 +458,13 @@ int load_config(const char *path, ServerConfig *cfg) {
         return 0;
     }
 
-    char line[1024];
-    while (fgets(line, sizeof(line), f)) {
+    int listeners_set = 0;
+    int listeners_cap = cfg->num_listeners;
+    int acl_cap = 0;
+    int bad = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, f) != -1) {
         trim(line);
         if (line[0] == '#' || line[0] == ';' || line[0] == '\0')
             continue;
@@ -138,15 +474,96 @@ int load_config(const char *path, ServerConfig *cfg) {
         if (split_kv(line, &key, &val) != 0) continue;
 
         if (strcmp(key, "root_dir") == 0) {
-            safe_strcpy(cfg->root_dir, sizeof(cfg->root_dir), val);
+            set_str(&cfg->root_dir, val);
         } else if (strcmp(key, "log_dir") == 0) {
-            safe_strcpy(cfg->log_dir, sizeof(cfg->log_dir), val);
+            set_str(&cfg->log_dir, val);
+        } else if (strcmp(key, "root_bundle") == 0) {
+            if (val[0] != '\0') set_str(&cfg->root_bundle, val);
+        } else if (strcmp(key, "origin_url") == 0) {
+            parse_origin_url(cfg, val);
+        } else if (strcmp(key, "origin_cache_dir") == 0) {
+            if (val[0] != '\0') set_str(&cfg->origin_cache_dir, val);
+        } else if (strcmp(key, "origin_ttl_sec") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->origin_ttl_sec = v;
+        } else if (strcmp(key, "origin_timeout_sec") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v > 0) cfg->origin_timeout_sec = v;
+        } else if (strcmp(key, "acl") == 0) {
+            /* A rule that is silently dropped could open access: refuse to start */
+            if (parse_acl(cfg, val, &acl_cap) != 0) {
+                fprintf(stderr, "Invalid acl rule: %s\n", val);
+                bad = 1;
+            }
+        } else if (strcmp(key, "acl_default") == 0) {
+            if (strcmp(val, "allow") == 0) cfg->acl_default_deny = 0;
+            else if (strcmp(val, "deny") == 0) cfg->acl_default_deny = 1;
+        } else if (strcmp(key, "stats_listen") == 0) {
+            if (val[0] != '\0') set_str(&cfg->stats_listen, val);
+        } else if (strcmp(key, "stats_entries") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v > 0) cfg->stats_entries = v;
+        } else if (strcmp(key, "xdp") == 0) {
+            /* The socket path keeps serving, so a bad line only disables XDP */
+            if (parse_xdp(cfg, val) != 0) fprintf(stderr, "Invalid xdp line: %s\n", val);
+        } else if (strcmp(key, "upgrade_socket") == 0) {
+            if (val[0] != '\0') set_str(&cfg->upgrade_socket, val);
+        } else if (strcmp(key, "upgrade_drain_sec") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->upgrade_drain_sec = v;
         } else if (strcmp(key, "listeners") == 0) {
-            parse_listeners(cfg, val);
+            parse_listeners(cfg, val, &listeners_set, &listeners_cap);
         } else if (strcmp(key, "event_udp") == 0) {
             parse_udp(cfg, val);
         } else if (strcmp(key, "event_http_url") == 0) {
             parse_http_url(cfg, val);
+        } else if (strcmp(key, "event_sink") == 0) {
+            parse_sink(cfg, val);
+        } else if (strcmp(key, "event_format") == 0) {
+            if (strcmp(val, "json") == 0) cfg->event_format = 0;
+            else if (strcmp(val, "binary") == 0) cfg->event_format = 1;
+        } else if (strcmp(key, "event_rollup_sec") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->event_rollup_sec = v;
+        } else if (strcmp(key, "event_rollup_keys") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v > 0) cfg->event_rollup_keys = v;
+        } else if (strcmp(key, "allow_upload") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0) cfg->allow_upload = (v != 0);
+        } else if (strcmp(key, "upload_max_bytes") == 0) {
+            long long v;
+            if (parse_ll(val, &v) == 0) cfg->upload_max_bytes = v;
+        } else if (strcmp(key, "upload_quota") == 0) {
+            parse_upload_quotas(cfg, val);
+        } else if (strcmp(key, "upload_buffer") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 4096) cfg->upload_buffer = v;
+        } else if (strcmp(key, "max_blksize") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 512 && v <= 65464) cfg->max_blksize = v;
+        } else if (strcmp(key, "io_backend") == 0) {
+            if (strcmp(val, "posix") == 0) cfg->io_backend = 0;
+            else if (strcmp(val, "uring") == 0 || strcmp(val, "io_uring") == 0) cfg->io_backend = 1;
+        } else if (strcmp(key, "content_cache_mb") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->content_cache_mb = v;
+        } else if (strcmp(key, "content_spill_dir") == 0) {
+            if (val[0] != '\0') set_str(&cfg->content_spill_dir, val);
+        } else if (strcmp(key, "content_spill_mb") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->content_spill_mb = v;
+        } else if (strcmp(key, "compressed_storage") == 0) {
+            if (strcmp(val, "gzip") == 0) cfg->compressed_storage = 1;
+            else if (strcmp(val, "off") == 0) cfg->compressed_storage = 0;
+        } else if (strcmp(key, "warm_manifest") == 0) {
+            if (val[0] != '\0') set_str(&cfg->warm_manifest, val);
+        } else if (strcmp(key, "warm_auto") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->warm_auto = v;
+        } else if (strcmp(key, "warm_mlock_mb") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->warm_mlock_mb = v;
         } else if (strcmp(key, "timeout_sec") == 0) {
             int v;
             if (parse_int(val, &v) == 0 && v > 0) cfg->timeout_sec = v;
@@ -157,9 +574,41 @@ int load_config(const char *path, ServerConfig *cfg) {
             if (strcmp(val, "error") == 0) cfg->log_level = 0;
             else if (strcmp(val, "info") == 0) cfg->log_level = 1;
             else if (strcmp(val, "debug") == 0) cfg->log_level = 2;
+        } else if (strcmp(key, "thread_stack_kb") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 64) cfg->thread_stack_kb = v;
+        } else if (strcmp(key, "flight_recorder") == 0) {
+            int v;
+            if (parse_int(val, &v) == 0 && v >= 0) cfg->flight_recorder = v;
         }
     }
 
+    free(line);
     fclose(f);
-    return 0;
+    return bad ? -1 : 0;
+}
+
+void free_config(ServerConfig *cfg) {
+    free(cfg->root_dir);
+    free(cfg->log_dir);
+    free(cfg->root_bundle);
+    free(cfg->origin_cache_dir);
+    free(cfg->content_spill_dir);
+    free(cfg->warm_manifest);
+    free(cfg->listeners);
+    free(cfg->acl_rules);
+    free(cfg->stats_listen);
+    free(cfg->upgrade_socket);
+    cfg->root_dir = NULL;
+    cfg->log_dir = NULL;
+    cfg->root_bundle = NULL;
+    cfg->origin_cache_dir = NULL;
+    cfg->content_spill_dir = NULL;
+    cfg->warm_manifest = NULL;
+    cfg->listeners = NULL;
+    cfg->num_listeners = 0;
+    cfg->acl_rules = NULL;
+    cfg->num_acl_rules = 0;
+    cfg->stats_listen = NULL;
+    cfg->upgrade_socket = NULL;
 }
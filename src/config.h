@@ -1,34 +1,125 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#include <limits.h>
-
-#define MAX_LISTENERS 8
+#define MAX_SINKS         8
+#define MAX_SINK_BATCH    1024   /* UIO_MAXIOV: one sendmmsg per batch */
+#define MAX_UPLOAD_QUOTAS 16
 
 typedef struct {
     char addr[64];
     int  port;
 } ListenerConfig;
 
+typedef enum {
+    SINK_UDP  = 0,
+    SINK_HTTP = 1,
+    SINK_UNIX = 2,
+    SINK_FILE = 3,
+    SINK_SHM  = 4
+} SinkType;
+
+typedef struct {
+    int  type;         /* SinkType */
+    char host[128];    /* udp/http */
+    int  port;
+    char path[256];    /* http path, unix socket, file or shm ring path */
+    int  format;       /* -1=use event_format, 0=json, 1=binary */
+    int  queue_cap;
+    int  batch;
+    int  drop_newest;  /* 0=drop oldest when full, 1=drop incoming */
+    int  slots;        /* shm ring size (power of two) */
+} SinkConfig;
+
 typedef struct {
-    char root_dir[PATH_MAX];
-    char log_dir[PATH_MAX];
+    char prefix[128];       /* path prefix relative to root_dir ("" = any) */
+    long long max_bytes;
+} UploadQuota;
+
+/* AF_XDP fast path for one listener (xdp=) */
+typedef struct {
+    int  enabled;
+    char addr[64];             /* listener address and port, also in listeners= */
+    int  port;
+    char ifname[16];           /* interface the listener address is on */
+    int  queue;                /* RX queue bound by the XDP socket */
+    int  native;               /* driver mode instead of generic (SKB) mode */
+    int  zerocopy;
+    int  frames;               /* UMEM frames (power of two) */
+    int  port_lo, port_hi;     /* session ports served by the XDP socket */
+} XdpListenerConfig;
+
+/* One acl= rule for one CIDR block */
+typedef struct {
+    int  allow;                /* 1=allow, 0=deny */
+    int  family;               /* AF_INET or AF_INET6 */
+    unsigned char addr[16];    /* network byte order; IPv4 uses the first 4 */
+    int  prefix_len;
+    char listener[72];         /* "ip" or "ip:port" the rule is limited to ("" = all) */
+    char path_prefix[128];     /* filename prefix relative to root_dir ("" = any) */
+    int  reply;                /* prefix deny answers "Access violation" instead of dropping */
+} AclRule;
+
+typedef struct {
+    char *root_dir;
+    char *log_dir;
+    char *root_bundle;           /* packed bundle served ahead of root_dir, or NULL */
+
+    int  origin_enabled;         /* fetch local misses from origin_url */
+    char origin_host[128];
+    int  origin_port;
+    char origin_path[256];       /* base path, ends with '/' */
+    char *origin_cache_dir;
+    int  origin_ttl_sec;         /* serve cached copy without revalidation */
+    int  origin_timeout_sec;
 
     int  num_listeners;
-    ListenerConfig listeners[MAX_LISTENERS];
+    ListenerConfig *listeners;   /* heap array, any number of entries */
+
+    int  num_acl_rules;
+    AclRule *acl_rules;          /* heap array, in file order */
+    int  acl_default_deny;       /* clients matching no rule are denied */
+
+    char *stats_listen;          /* "ip:port" or "unix:/path" for the stats API, or NULL */
+    int  stats_entries;          /* entries per stats table (files, clients) */
+
+    XdpListenerConfig xdp;
 
-    char event_udp_host[64];
-    int  event_udp_port;
+    char *upgrade_socket;        /* Unix socket for listener handoff, or NULL */
+    int  upgrade_drain_sec;      /* how long a replaced process waits for its sessions */
 
-    char event_http_host[128];
-    int  event_http_port;
-    char event_http_path[128];
+    int  num_sinks;
+    SinkConfig sinks[MAX_SINKS];
+
+    int  event_format;  /* 0=json,1=binary */
+    int  event_rollup_sec;   /* aggregate non-error events per window, 0=off */
+    int  event_rollup_keys;  /* (filename, status) pairs tracked per window */
+
+    int  allow_upload;          /* accept WRQ */
+    long long upload_max_bytes;  /* default per-upload limit, 0=unlimited */
+    int  num_upload_quotas;
+    UploadQuota upload_quotas[MAX_UPLOAD_QUOTAS];
+    int  upload_buffer;         /* write-behind buffer size in bytes */
+
+    int  max_blksize;           /* upper bound for negotiated blksize */
+    int  io_backend;            /* 0=posix, 1=io_uring (falls back to posix) */
+    int  content_cache_mb;      /* budget for converted content (netascii, gunzip) */
+    char *content_spill_dir;    /* where content over that budget is built */
+    int  content_spill_mb;      /* disk budget for such content, 0=off */
+    int  compressed_storage;    /* serve name from name.gz when only that exists */
+
+    char *warm_manifest;        /* files to prefetch at startup, or NULL */
+    int  warm_auto;             /* most-requested names kept for the next start */
+    int  warm_mlock_mb;         /* budget for pinning warmed files, 0=off */
 
     int  timeout_sec;
     int  max_retries;
     int  log_level;  /* 0=error,1=info,2=debug */
+
+    int  thread_stack_kb;       /* stack size for worker/session threads */
+    int  flight_recorder;       /* session traces kept for SIGUSR1 dumps */
 } ServerConfig;
 
 int load_config(const char *path, ServerConfig *cfg);
+void free_config(ServerConfig *cfg);
 
 #endif
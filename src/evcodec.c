@@ -0,0 +1,214 @@
+#include "evcodec.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/* Append a JSON string literal (with quotes), escaping as needed */
+size_t json_put_str(char *out, size_t size, size_t pos, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    if (pos < size) out[pos] = '"';
+    pos++;
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        char esc[6];
+        size_t n = 0;
+        if (c == '"' || c == '\\') {
+            esc[n++] = '\\';
+            esc[n++] = (char)c;
+        } else if (c < 0x20) {
+            esc[n++] = '\\';
+            esc[n++] = 'u';
+            esc[n++] = '0';
+            esc[n++] = '0';
+            esc[n++] = hex[c >> 4];
+            esc[n++] = hex[c & 0xf];
+        } else {
+            esc[n++] = (char)c;
+        }
+        for (size_t i = 0; i < n; ++i, ++pos) {
+            if (pos < size) out[pos] = esc[i];
+        }
+    }
+    if (pos < size) out[pos] = '"';
+    return pos + 1;
+}
+
+static size_t json_put_raw(char *out, size_t size, size_t pos, const char *s) {
+    for (; *s; ++s, ++pos) {
+        if (pos < size) out[pos] = *s;
+    }
+    return pos;
+}
+
+/* Encode as JSON; returns length written (excluding NUL) or 0 if it does not fit */
+size_t evcodec_encode_json(const Event *ev, char *out, size_t size) {
+    char num[64];
+    size_t pos = 0;
+
+    snprintf(num, sizeof(num), "{\"type\":%d,\"client_ip\":", (int)ev->type);
+    pos = json_put_raw(out, size, pos, num);
+    pos = json_put_str(out, size, pos, ev->client_ip);
+    snprintf(num, sizeof(num), ",\"client_port\":%d,\"filename\":", ev->client_port);
+    pos = json_put_raw(out, size, pos, num);
+    pos = json_put_str(out, size, pos, ev->filename);
+    snprintf(num, sizeof(num), ",\"bytes\":%zu,\"status\":", ev->bytes);
+    pos = json_put_raw(out, size, pos, num);
+    pos = json_put_str(out, size, pos, ev->status);
+    pos = json_put_raw(out, size, pos, ",\"message\":");
+    pos = json_put_str(out, size, pos, ev->message);
+    pos = json_put_raw(out, size, pos, ",\"start\":");
+    pos = json_put_str(out, size, pos, ev->start_ts);
+    pos = json_put_raw(out, size, pos, ",\"end\":");
+    pos = json_put_str(out, size, pos, ev->end_ts);
+
+    const EventTiming *t = &ev->timing;
+    char timing[256];
+    snprintf(timing, sizeof(timing),
+             ",\"timing\":{\"open_us\":%u,\"first_data_us\":%u,\"total_us\":%u,"
+             "\"retransmits\":%u,\"rtt_min_us\":%u,\"rtt_avg_us\":%u,\"rtt_max_us\":%u}",
+             t->open_us, t->first_data_us, t->total_us, t->retransmits,
+             t->rtt_min_us, t->rtt_avg_us, t->rtt_max_us);
+    pos = json_put_raw(out, size, pos, timing);
+
+    if (ev->type == EVT_REQ_SUMMARY) {
+        const EventSummary *sm = &ev->summary;
+        char summary[192];
+        snprintf(summary, sizeof(summary),
+                 ",\"summary\":{\"count\":%u,\"lat_p50_us\":%u,\"lat_p90_us\":%u,"
+                 "\"lat_p99_us\":%u,\"lat_max_us\":%u}",
+                 sm->count, sm->lat_p50_us, sm->lat_p90_us, sm->lat_p99_us, sm->lat_max_us);
+        pos = json_put_raw(out, size, pos, summary);
+    }
+    pos = json_put_raw(out, size, pos, "}");
+
+    if (pos >= size) {
+        if (size > 0) out[0] = '\0';
+        return 0;
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+static void bin_put_u32(unsigned char *out, uint32_t v) {
+    out[0] = (unsigned char)(v >> 24);
+    out[1] = (unsigned char)(v >> 16);
+    out[2] = (unsigned char)(v >> 8);
+    out[3] = (unsigned char)v;
+}
+
+static uint32_t bin_get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+           ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+static size_t bin_put_str(unsigned char *out, size_t pos, const char *s, size_t cap) {
+    size_t len = strnlen(s, cap);
+    if (len > 255) len = 255;
+    out[pos++] = (unsigned char)len;
+    memcpy(out + pos, s, len);
+    return pos + len;
+}
+
+/* Encode as binary; returns length or 0 if the buffer is too small */
+size_t evcodec_encode_bin(const Event *ev, unsigned char *out, size_t size) {
+    if (size < EVBIN_MAX_SIZE) return 0;
+
+    uint64_t bytes = (uint64_t)ev->bytes;
+    out[0] = EVBIN_MAGIC0;
+    out[1] = EVBIN_MAGIC1;
+    out[2] = EVBIN_VERSION;
+    out[3] = (unsigned char)ev->type;
+    for (int i = 0; i < 8; ++i) {
+        out[4 + i] = (unsigned char)(bytes >> (56 - 8 * i));
+    }
+    out[12] = (unsigned char)((ev->client_port >> 8) & 0xff);
+    out[13] = (unsigned char)(ev->client_port & 0xff);
+
+    const EventTiming *t = &ev->timing;
+    const uint32_t timing[7] = {
+        t->open_us, t->first_data_us, t->total_us, t->retransmits,
+        t->rtt_min_us, t->rtt_avg_us, t->rtt_max_us
+    };
+    for (int i = 0; i < 7; ++i) {
+        bin_put_u32(out + EVBIN_HDR_SIZE + 4 * i, timing[i]);
+    }
+
+    size_t pos = EVBIN_HDR_SIZE + EVBIN_TIMING_SIZE;
+    if (ev->type == EVT_REQ_SUMMARY) {
+        const EventSummary *sm = &ev->summary;
+        const uint32_t summary[5] = {
+            sm->count, sm->lat_p50_us, sm->lat_p90_us, sm->lat_p99_us, sm->lat_max_us
+        };
+        for (int i = 0; i < 5; ++i) {
+            bin_put_u32(out + pos + 4 * i, summary[i]);
+        }
+        pos += EVBIN_SUMMARY_SIZE;
+    }
+    pos = bin_put_str(out, pos, ev->client_ip, sizeof(ev->client_ip));
+    pos = bin_put_str(out, pos, ev->filename, sizeof(ev->filename));
+    pos = bin_put_str(out, pos, ev->status, sizeof(ev->status));
+    pos = bin_put_str(out, pos, ev->message, sizeof(ev->message));
+    pos = bin_put_str(out, pos, ev->start_ts, sizeof(ev->start_ts));
+    pos = bin_put_str(out, pos, ev->end_ts, sizeof(ev->end_ts));
+    return pos;
+}
+
+static int bin_get_str(const unsigned char *buf, size_t len, size_t *pos,
+                       char *dst, size_t dst_size) {
+    if (*pos >= len) return -1;
+    size_t n = buf[(*pos)++];
+    if (*pos + n > len) return -1;
+    size_t copy = n < dst_size - 1 ? n : dst_size - 1;
+    memcpy(dst, buf + *pos, copy);
+    dst[copy] = '\0';
+    *pos += n;
+    return 0;
+}
+
+/* Decode one binary event; returns bytes consumed, or -1 if malformed/short */
+int evcodec_decode_bin(const unsigned char *buf, size_t len, Event *ev) {
+    if (len < EVBIN_HDR_SIZE) return -1;
+    if (buf[0] != EVBIN_MAGIC0 || buf[1] != EVBIN_MAGIC1) return -1;
+    if (buf[2] < 1 || buf[2] > EVBIN_VERSION) return -1;
+    if (buf[2] >= 2 && len < EVBIN_HDR_SIZE + EVBIN_TIMING_SIZE) return -1;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->type = (EventType)buf[3];
+    uint64_t bytes = 0;
+    for (int i = 0; i < 8; ++i) {
+        bytes = (bytes << 8) | buf[4 + i];
+    }
+    ev->bytes = (size_t)bytes;
+    ev->client_port = (buf[12] << 8) | buf[13];
+
+    size_t pos = EVBIN_HDR_SIZE;
+    if (buf[2] >= 2) {
+        const unsigned char *t = buf + EVBIN_HDR_SIZE;
+        ev->timing.open_us       = bin_get_u32(t);
+        ev->timing.first_data_us = bin_get_u32(t + 4);
+        ev->timing.total_us      = bin_get_u32(t + 8);
+        ev->timing.retransmits   = bin_get_u32(t + 12);
+        ev->timing.rtt_min_us    = bin_get_u32(t + 16);
+        ev->timing.rtt_avg_us    = bin_get_u32(t + 20);
+        ev->timing.rtt_max_us    = bin_get_u32(t + 24);
+        pos += EVBIN_TIMING_SIZE;
+    }
+    if (buf[2] >= 3 && ev->type == EVT_REQ_SUMMARY) {
+        if (len < pos + EVBIN_SUMMARY_SIZE) return -1;
+        const unsigned char *sm = buf + pos;
+        ev->summary.count      = bin_get_u32(sm);
+        ev->summary.lat_p50_us = bin_get_u32(sm + 4);
+        ev->summary.lat_p90_us = bin_get_u32(sm + 8);
+        ev->summary.lat_p99_us = bin_get_u32(sm + 12);
+        ev->summary.lat_max_us = bin_get_u32(sm + 16);
+        pos += EVBIN_SUMMARY_SIZE;
+    }
+    if (bin_get_str(buf, len, &pos, ev->client_ip, sizeof(ev->client_ip)) != 0) return -1;
+    if (bin_get_str(buf, len, &pos, ev->filename, sizeof(ev->filename)) != 0) return -1;
+    if (bin_get_str(buf, len, &pos, ev->status, sizeof(ev->status)) != 0) return -1;
+    if (bin_get_str(buf, len, &pos, ev->message, sizeof(ev->message)) != 0) return -1;
+    if (bin_get_str(buf, len, &pos, ev->start_ts, sizeof(ev->start_ts)) != 0) return -1;
+    if (bin_get_str(buf, len, &pos, ev->end_ts, sizeof(ev->end_ts)) != 0) return -1;
+    return (int)pos;
+}
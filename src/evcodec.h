@@ -0,0 +1,53 @@
+#ifndef EVCODEC_H
+#define EVCODEC_H
+
+#include "events.h"
+#include <stddef.h>
+
+/*
+ * Event wire encodings shared by the server and the decoder tool.
+ *
+ * Binary layout (version 3, all integers big-endian):
+ *
+ *   off  size  field
+ *   0    2     magic "CE" (0x43 0x45)
+ *   2    1     version (3)
+ *   3    1     event type
+ *   4    8     bytes transferred
+ *   12   2     client port
+ *   14   28    timing, seven u32: open, first DATA, total, retransmits,
+ *              RTT min, avg, max (see EventTiming)
+ *   42   20    summary, five u32, only if the type is EVT_REQ_SUMMARY:
+ *              count, latency p50, p90, p99, max (see EventSummary)
+ *   42/62 ...  six strings, each u8 length + raw bytes (no NUL):
+ *              client_ip, filename, status, message, start, end
+ *
+ * Version 1 (no timing block) and version 2 (no summaries) records are
+ * still accepted by the decoder.
+ */
+
+#define EVBIN_MAGIC0   0x43
+#define EVBIN_MAGIC1   0x45
+#define EVBIN_VERSION  3
+#define EVBIN_HDR_SIZE 14
+#define EVBIN_TIMING_SIZE 28
+#define EVBIN_SUMMARY_SIZE 20
+
+/* Upper bounds for one encoded Event (JSON assumes every byte escaped) */
+#define EVBIN_MAX_SIZE  (EVBIN_HDR_SIZE + EVBIN_TIMING_SIZE + EVBIN_SUMMARY_SIZE + 6 * 256)
+#define EVJSON_MAX_SIZE 4096
+
+typedef enum {
+    EVFMT_JSON   = 0,
+    EVFMT_BINARY = 1
+} EventFormat;
+
+size_t evcodec_encode_json(const Event *ev, char *out, size_t size);
+size_t evcodec_encode_bin(const Event *ev, unsigned char *out, size_t size);
+int evcodec_decode_bin(const unsigned char *buf, size_t len, Event *ev);
+
+/* Append a JSON string literal at pos; returns the new position, which may
+ * exceed size (nothing is written past it) */
+size_t json_put_str(char *out, size_t size, size_t pos, const char *s);
+
+#endif
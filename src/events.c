@@ -1,214 +1,338 @@
 #include "events.h"
+#include "sinks.h"
 #include "logger.h"
 #include "util.h"
 
+#include <errno.h>
 #include <pthread.h>
-#include <string.h>
 #include <stdlib.h>
-#include <stdio.h>
-#include <unistd.h>
-#include <errno.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <sys/socket.h>
-
-#define EVENT_QUEUE_CAP 256
-
-static ServerConfig g_cfg;
-static int g_udp_sock = -1;
-
-static Event g_queue[EVENT_QUEUE_CAP];
-static int g_q_head = 0;
-static int g_q_tail = 0;
-static int g_stop = 0;
-static pthread_mutex_t g_q_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t g_q_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t g_http_thread;
-static int g_http_thread_started = 0;
-
-/* Simple ring buffer push */
-static void queue_push(const Event *ev) {
-    pthread_mutex_lock(&g_q_mutex);
-    int next_tail = (g_q_tail + 1) % EVENT_QUEUE_CAP;
-    if (next_tail == g_q_head) {
-        /* queue full, drop oldest */
-        g_q_head = (g_q_head + 1) % EVENT_QUEUE_CAP;
-    }
-    g_queue[g_q_tail] = *ev;
-    g_q_tail = next_tail;
-    pthread_cond_signal(&g_q_cond);
-    pthread_mutex_unlock(&g_q_mutex);
-}
-
-/* Pop from queue, return 0 if got one, -1 on stop */
-static int queue_pop(Event *out) {
-    pthread_mutex_lock(&g_q_mutex);
-    while (!g_stop && g_q_head == g_q_tail) {
-        pthread_cond_wait(&g_q_cond, &g_q_mutex);
-    }
-    if (g_stop) {
-        pthread_mutex_unlock(&g_q_mutex);
-        return -1;
+#include <string.h>
+#include <time.h>
+
+/*
+ * Rollup (event_rollup_sec). Starts and successful completions are
+ * counted per (filename, status) and published as one EVT_REQ_SUMMARY per
+ * pair and window, so a boot storm costs events in proportion to the
+ * number of distinct files, not to the request rate. Errors bypass the
+ * rollup. Once a window has event_rollup_keys pairs, further files are
+ * counted under filename "*"; only if that is full too do events go out
+ * individually.
+ *
+ * Two tables alternate: sessions add to the active one while the rollup
+ * thread publishes the other, so a flush never holds up a session.
+ */
+
+#define ROLLUP_LAT_BUCKETS 124   /* 4 per power of two of microseconds */
+#define ROLLUP_RESERVE     8     /* slots kept for the "*" overflow pairs */
+
+typedef struct {
+    char     filename[256];
+    char     status[32];
+    uint64_t hash;
+    uint64_t bytes;
+    uint32_t count;
+    uint32_t lat_n;       /* completions with a latency sample */
+    uint32_t lat_max_us;
+    uint32_t lat[ROLLUP_LAT_BUCKETS];
+} RollupEntry;
+
+typedef struct {
+    RollupEntry *entries;
+    int32_t *slots;       /* open addressing, -1 = free */
+    int count;
+    char start_ts[32];
+} RollupTable;
+
+static struct {
+    int enabled;
+    int window_sec;
+    int keys;             /* entries per table, excluding the reserve */
+    int nslots;           /* power of two */
+    RollupTable tables[2];
+    RollupTable *active;
+    pthread_mutex_t lock; /* enabled, active table and stop */
+    pthread_cond_t cond;
+    int stop;
+    int cut;              /* events_flush(): end the window now */
+    pthread_t thread;
+    int thread_started;
+} g_rollup = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* Log and fan out to every configured sink (never blocks) */
+static void event_publish(const Event *ev) {
+    if (ev->type == EVT_REQ_SUMMARY) {
+        log_msg(LOG_INFO,
+                "EVENT type=%d file=\"%s\" status=%s count=%u bytes=%zu "
+                "p50=%uus p90=%uus p99=%uus max=%uus window=%s..%s",
+                ev->type, ev->filename, ev->status, ev->summary.count, ev->bytes,
+                ev->summary.lat_p50_us, ev->summary.lat_p90_us,
+                ev->summary.lat_p99_us, ev->summary.lat_max_us,
+                ev->start_ts, ev->end_ts);
+    } else {
+        log_msg(LOG_INFO,
+                "EVENT type=%d client=%s:%d file=\"%s\" bytes=%zu status=%s msg=%s",
+                ev->type, ev->client_ip, ev->client_port,
+                ev->filename, ev->bytes, ev->status, ev->message);
     }
-    *out = g_queue[g_q_head];
-    g_q_head = (g_q_head + 1) % EVENT_QUEUE_CAP;
-    pthread_mutex_unlock(&g_q_mutex);
-    return 0;
+    sinks_publish(ev);
 }
 
-/* Send UDP JSON event */
-static void send_udp_event(const Event *ev) {
-    if (g_udp_sock < 0 || g_cfg.event_udp_port == 0 || g_cfg.event_udp_host[0] == '\0')
-        return;
-
-    char json[512];
-    snprintf(json, sizeof(json),
-             "{\"type\":%d,\"client_ip\":\"%s\",\"client_port\":%d,"
-             "\"filename\":\"%s\",\"bytes\":%zu,"
-             "\"status\":\"%s\",\"message\":\"%s\","
-             "\"start\":\"%s\",\"end\":\"%s\"}",
-             ev->type, ev->client_ip, ev->client_port,
-             ev->filename, ev->bytes,
-             ev->status, ev->message,
-             ev->start_ts, ev->end_ts);
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(g_cfg.event_udp_port);
-    if (inet_pton(AF_INET, g_cfg.event_udp_host, &addr.sin_addr) != 1) {
-        return;
+static uint64_t rollup_hash(const char *filename, const char *status) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *s = filename; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    h ^= 0xff;
+    h *= 1099511628211ULL;
+    for (const char *s = status; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
     }
+    return h;
+}
 
-    sendto(g_udp_sock, json, strlen(json), 0,
-           (struct sockaddr *)&addr, sizeof(addr));
+static int lat_bucket(uint32_t us) {
+    if (us < 4) return (int)us;
+    int msb = 31 - __builtin_clz(us);
+    return (msb - 1) * 4 + (int)((us >> (msb - 2)) & 3);
 }
 
-/* Simple blocking HTTP POST sender */
-static void send_http_event(const Event *ev) {
-    if (g_cfg.event_http_host[0] == '\0' || g_cfg.event_http_port == 0)
-        return;
+static uint32_t lat_bucket_top(int b) {
+    if (b < 4) return (uint32_t)b;
+    int msb = b / 4 + 1;
+    uint64_t lo = (uint64_t)(4 + b % 4) << (msb - 2);
+    return (uint32_t)(lo + (1ULL << (msb - 2)) - 1);
+}
 
-    char body[512];
-    snprintf(body, sizeof(body),
-             "{\"type\":%d,\"client_ip\":\"%s\",\"client_port\":%d,"
-             "\"filename\":\"%s\",\"bytes\":%zu,"
-             "\"status\":\"%s\",\"message\":\"%s\","
-             "\"start\":\"%s\",\"end\":\"%s\"}",
-             ev->type, ev->client_ip, ev->client_port,
-             ev->filename, ev->bytes,
-             ev->status, ev->message,
-             ev->start_ts, ev->end_ts);
-
-    char request[1024];
-    int body_len = (int)strlen(body);
-    snprintf(request, sizeof(request),
-             "POST %s HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "Content-Type: application/json\r\n"
-             "Content-Length: %d\r\n"
-             "Connection: close\r\n"
-             "\r\n"
-             "%s",
-             g_cfg.event_http_path[0] ? g_cfg.event_http_path : "/",
-             g_cfg.event_http_host,
-             body_len,
-             body);
-
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) return;
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(g_cfg.event_http_port);
-    if (inet_pton(AF_INET, g_cfg.event_http_host, &addr.sin_addr) != 1) {
-        close(sock);
-        return;
+/* Upper bound of the bucket holding the q-th quantile, capped at the max */
+static uint32_t lat_quantile(const RollupEntry *e, double q) {
+    if (e->lat_n == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)e->lat_n + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < ROLLUP_LAT_BUCKETS; ++b) {
+        seen += e->lat[b];
+        if (seen >= rank) {
+            uint32_t top = lat_bucket_top(b);
+            return top < e->lat_max_us ? top : e->lat_max_us;
+        }
     }
+    return e->lat_max_us;
+}
 
-    struct timeval tv;
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+static void table_reset(RollupTable *t) {
+    for (int i = 0; i < g_rollup.nslots; ++i) t->slots[i] = -1;
+    t->count = 0;
+    now_iso8601(t->start_ts, sizeof(t->start_ts));
+}
 
-    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
-        close(sock);
-        return;
+/* Find or add (filename, status) in a locked table; NULL when it is full */
+static RollupEntry *table_slot(RollupTable *t, const char *filename, const char *status,
+                               int limit) {
+    uint64_t h = rollup_hash(filename, status);
+    uint32_t mask = (uint32_t)g_rollup.nslots - 1;
+    for (uint32_t i = (uint32_t)h & mask;; i = (i + 1) & mask) {
+        int32_t idx = t->slots[i];
+        if (idx < 0) {
+            if (t->count >= limit) return NULL;
+            idx = t->count++;
+            RollupEntry *e = &t->entries[idx];
+            memset(e, 0, sizeof(*e));
+            safe_strcpy(e->filename, sizeof(e->filename), filename);
+            safe_strcpy(e->status, sizeof(e->status), status);
+            e->hash = h;
+            t->slots[i] = idx;
+            return e;
+        }
+        RollupEntry *e = &t->entries[idx];
+        if (e->hash == h && strcmp(e->filename, filename) == 0 &&
+            strcmp(e->status, status) == 0) {
+            return e;
+        }
     }
+}
 
-    ssize_t sent = send(sock, request, strlen(request), 0);
-    if (sent <= 0) {
-        close(sock);
-        return;
+/* Returns 0 if ev was folded into the current window */
+static int rollup_add(const Event *ev) {
+    pthread_mutex_lock(&g_rollup.lock);
+    RollupEntry *e = NULL;
+    if (g_rollup.enabled) {
+        RollupTable *t = g_rollup.active;
+        e = table_slot(t, ev->filename, ev->status, g_rollup.keys);
+        if (!e) e = table_slot(t, "*", ev->status, g_rollup.keys + ROLLUP_RESERVE);
     }
+    if (e) {
+        e->count++;
+        e->bytes += ev->bytes;
+        if (ev->type == EVT_REQ_DONE) {
+            uint32_t us = ev->timing.total_us;
+            e->lat[lat_bucket(us)]++;
+            e->lat_n++;
+            if (us > e->lat_max_us) e->lat_max_us = us;
+        }
+    }
+    pthread_mutex_unlock(&g_rollup.lock);
+    return e ? 0 : -1;
+}
 
-    char buf[256];
-    while (recv(sock, buf, sizeof(buf), 0) > 0) {
-        /* ignore response */
+/* Publish one summary per entry of a table that is no longer active */
+static void table_flush(const RollupTable *t, const char *end_ts) {
+    for (int i = 0; i < t->count; ++i) {
+        const RollupEntry *e = &t->entries[i];
+        Event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EVT_REQ_SUMMARY;
+        safe_strcpy(ev.filename, sizeof(ev.filename), e->filename);
+        safe_strcpy(ev.status, sizeof(ev.status), e->status);
+        safe_strcpy(ev.message, sizeof(ev.message), "rollup");
+        safe_strcpy(ev.start_ts, sizeof(ev.start_ts), t->start_ts);
+        safe_strcpy(ev.end_ts, sizeof(ev.end_ts), end_ts);
+        ev.bytes = (size_t)e->bytes;
+        ev.summary.count = e->count;
+        ev.summary.lat_p50_us = lat_quantile(e, 0.50);
+        ev.summary.lat_p90_us = lat_quantile(e, 0.90);
+        ev.summary.lat_p99_us = lat_quantile(e, 0.99);
+        ev.summary.lat_max_us = e->lat_max_us;
+        event_publish(&ev);
     }
-    close(sock);
 }
 
-static void *http_thread_main(void *arg) {
+static void *rollup_thread_main(void *arg) {
     (void)arg;
-    Event ev;
-    while (queue_pop(&ev) == 0) {
-        send_http_event(&ev);
+    pthread_mutex_lock(&g_rollup.lock);
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += g_rollup.window_sec;
+        int rc = 0;
+        while (!g_rollup.stop && !g_rollup.cut && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&g_rollup.cond, &g_rollup.lock, &deadline);
+        }
+        int stop = g_rollup.stop;
+        int cut = g_rollup.cut;
+
+        /* Swap tables, then publish the finished window unlocked */
+        RollupTable *done = g_rollup.active;
+        RollupTable *next = (done == &g_rollup.tables[0]) ? &g_rollup.tables[1]
+                                                          : &g_rollup.tables[0];
+        table_reset(next);
+        g_rollup.active = next;
+        pthread_mutex_unlock(&g_rollup.lock);
+
+        char end_ts[32];
+        now_iso8601(end_ts, sizeof(end_ts));
+        table_flush(done, end_ts);
+        if (stop) return NULL;
+        pthread_mutex_lock(&g_rollup.lock);
+        if (cut) {
+            g_rollup.cut = 0;
+            pthread_cond_broadcast(&g_rollup.cond);
+        }
     }
-    return NULL;
 }
 
-int events_init(const ServerConfig *cfg) {
-    g_cfg = *cfg;
+static size_t rollup_table_bytes(const ServerConfig *cfg, int *nslots) {
+    int n = 1;
+    while (n < 2 * (cfg->event_rollup_keys + ROLLUP_RESERVE)) n <<= 1;
+    if (nslots) *nslots = n;
+    return (size_t)(cfg->event_rollup_keys + ROLLUP_RESERVE) * sizeof(RollupEntry) +
+           (size_t)n * sizeof(int32_t);
+}
 
-    if (cfg->event_udp_port > 0 && cfg->event_udp_host[0] != '\0') {
-        g_udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (g_udp_sock < 0) {
-            log_msg(LOG_ERROR, "Failed to create UDP event socket: %s", strerror(errno));
-        }
+static int rollup_init(const ServerConfig *cfg) {
+    g_rollup.window_sec = cfg->event_rollup_sec;
+    g_rollup.keys = cfg->event_rollup_keys;
+    rollup_table_bytes(cfg, &g_rollup.nslots);
+    for (int i = 0; i < 2; ++i) {
+        RollupTable *t = &g_rollup.tables[i];
+        t->entries = (RollupEntry *)calloc((size_t)(g_rollup.keys + ROLLUP_RESERVE),
+                                           sizeof(RollupEntry));
+        t->slots = (int32_t *)malloc((size_t)g_rollup.nslots * sizeof(int32_t));
+        if (!t->entries || !t->slots) return -1;
     }
+    g_rollup.active = &g_rollup.tables[0];
+    table_reset(g_rollup.active);
+    g_rollup.stop = 0;
+    if (thread_spawn(&g_rollup.thread, rollup_thread_main, NULL,
+                     (size_t)cfg->thread_stack_kb * 1024, 0) != 0) {
+        return -1;
+    }
+    g_rollup.thread_started = 1;
+    pthread_mutex_lock(&g_rollup.lock);
+    g_rollup.enabled = 1;
+    pthread_mutex_unlock(&g_rollup.lock);
+    log_msg(LOG_INFO, "Event rollup: %d s windows, %d files", g_rollup.window_sec,
+            g_rollup.keys);
+    return 0;
+}
 
-    if (cfg->event_http_host[0] != '\0' && cfg->event_http_port > 0) {
-        if (pthread_create(&g_http_thread, NULL, http_thread_main, NULL) == 0) {
-            g_http_thread_started = 1;
-        } else {
-            log_msg(LOG_ERROR, "Failed to start HTTP event thread");
-        }
+static void rollup_free_tables(void) {
+    for (int i = 0; i < 2; ++i) {
+        free(g_rollup.tables[i].entries);
+        free(g_rollup.tables[i].slots);
+        g_rollup.tables[i].entries = NULL;
+        g_rollup.tables[i].slots = NULL;
     }
+}
 
-    return 0;
+int events_init(const ServerConfig *cfg) {
+    int rc = sinks_init(cfg);
+    if (cfg->event_rollup_sec > 0 && rollup_init(cfg) != 0) {
+        log_msg(LOG_ERROR, "Failed to start event rollup, publishing every event");
+        rollup_free_tables();
+    }
+    return rc;
 }
 
 void events_shutdown(void) {
-    pthread_mutex_lock(&g_q_mutex);
-    g_stop = 1;
-    pthread_cond_broadcast(&g_q_cond);
-    pthread_mutex_unlock(&g_q_mutex);
-
-    if (g_http_thread_started) {
-        pthread_join(g_http_thread, NULL);
+    if (g_rollup.thread_started) {
+        /* Late events go out individually; the last, partial window is
+         * published before the sinks stop */
+        pthread_mutex_lock(&g_rollup.lock);
+        g_rollup.enabled = 0;
+        g_rollup.stop = 1;
+        pthread_cond_signal(&g_rollup.cond);
+        pthread_mutex_unlock(&g_rollup.lock);
+        pthread_join(g_rollup.thread, NULL);
+        g_rollup.thread_started = 0;
+        rollup_free_tables();
     }
+    sinks_shutdown();
+}
 
-    if (g_udp_sock >= 0) {
-        close(g_udp_sock);
-        g_udp_sock = -1;
+void events_flush(int timeout_ms) {
+    if (g_rollup.thread_started) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&g_rollup.lock);
+        g_rollup.cut = 1;
+        pthread_cond_broadcast(&g_rollup.cond);
+        int rc = 0;
+        while (g_rollup.cut && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&g_rollup.cond, &g_rollup.lock, &deadline);
+        }
+        pthread_mutex_unlock(&g_rollup.lock);
     }
+    sinks_flush(timeout_ms);
 }
 
 void event_emit(const Event *ev) {
-    /* always log to main logger */
-    log_msg(LOG_INFO,
-            "EVENT type=%d client=%s:%d file=\"%s\" bytes=%zu status=%s msg=%s",
-            ev->type, ev->client_ip, ev->client_port,
-            ev->filename, ev->bytes, ev->status, ev->message);
-
-    /* UDP event */
-    send_udp_event(ev);
-
-    /* HTTP event */
-    if (g_cfg.event_http_host[0] != '\0' && g_cfg.event_http_port > 0) {
-        queue_push(ev);
+    if (__atomic_load_n(&g_rollup.enabled, __ATOMIC_RELAXED) &&
+        ev->type != EVT_REQ_ERROR && rollup_add(ev) == 0) {
+        return;
     }
+    event_publish(ev);
+}
+
+void events_print_footprint(const ServerConfig *cfg, FILE *out) {
+    if (cfg->event_rollup_sec <= 0) return;
+    fprintf(out, "  event rollup:     2 x %zu KiB (%d files per window)\n",
+            rollup_table_bytes(cfg, NULL) / 1024, cfg->event_rollup_keys);
 }
@@ -3,13 +3,45 @@
 
 #include "config.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef enum {
     EVT_REQ_START = 0,
     EVT_REQ_DONE  = 1,
-    EVT_REQ_ERROR = 2
+    EVT_REQ_ERROR = 2,
+    EVT_REQ_SUMMARY = 3   /* event_rollup_sec: many events folded into one */
 } EventType;
 
+/*
+ * Stage timing, in microseconds of monotonic time since the request was
+ * received (0 = stage not reached). RTT is sampled only for blocks that
+ * were not retransmitted.
+ */
+typedef struct {
+    uint32_t open_us;        /* file (or upload temp file) opened */
+    uint32_t first_data_us;  /* first DATA sent (RRQ) or received (WRQ) */
+    uint32_t total_us;       /* session finished */
+    uint32_t retransmits;
+    uint32_t rtt_min_us;
+    uint32_t rtt_avg_us;
+    uint32_t rtt_max_us;
+} EventTiming;
+
+/*
+ * Set on EVT_REQ_SUMMARY events only. A summary stands for count events
+ * with the same filename and status between start_ts and end_ts; bytes is
+ * their total. Latency percentiles are over timing.total_us, bucketed to
+ * within 25%.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t lat_p50_us;
+    uint32_t lat_p90_us;
+    uint32_t lat_p99_us;
+    uint32_t lat_max_us;
+} EventSummary;
+
 typedef struct {
     EventType type;
     char client_ip[64];
@@ -20,10 +52,25 @@ typedef struct {
     char message[128];
     char start_ts[32];
     char end_ts[32];
+    EventTiming timing;
+    EventSummary summary;
 } Event;
 
 int events_init(const ServerConfig *cfg);
 void events_shutdown(void);
+
+/*
+ * Publish the current rollup window and wait up to timeout_ms for the sinks
+ * to deliver their queues, leaving everything running. For a process that
+ * exits while detached sessions may still emit events.
+ */
+void events_flush(int timeout_ms);
+
+/* Publish to the log and every sink, or fold into the current rollup
+ * window (event_rollup_sec); errors always go out individually */
 void event_emit(const Event *ev);
 
+/* Memory of the rollup tables (event_rollup_sec) */
+void events_print_footprint(const ServerConfig *cfg, FILE *out);
+
 #endif
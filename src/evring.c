@@ -0,0 +1,188 @@
+#include "evring.h"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Yields before a publisher stops waiting for the previous lap's writer */
+#define EVRING_CLAIM_SPINS 100000
+
+static size_t ring_map_size(uint32_t slot_count) {
+    return sizeof(EvRingHeader) + (size_t)slot_count * sizeof(EvRingSlot);
+}
+
+/* Every sequence below write_seq finished writing its slot. Not the case
+ * after a writer died mid-publish, and publishers would then wait forever
+ * on that slot. */
+static int ring_consistent(const EvRingHeader *hdr, const EvRingSlot *slots) {
+    uint64_t w = hdr->write_seq;
+    uint64_t mask = (uint64_t)hdr->slot_count - 1;
+    for (uint64_t i = 0; i <= mask; ++i) {
+        uint64_t want = 0;
+        if (w > i) want = 2 * ((w - 1) - ((w - 1 - i) & mask)) + 2;
+        if (slots[i].seq != want) return 0;
+    }
+    return 1;
+}
+
+static void ring_attach(EvRing *r, void *base, size_t map_size) {
+    r->base = base;
+    r->map_size = map_size;
+    r->hdr = (EvRingHeader *)base;
+    r->slots = (EvRingSlot *)((char *)base + r->hdr->data_offset);
+    r->mask = (uint64_t)r->hdr->slot_count - 1;
+}
+
+int evring_create(EvRing *r, const char *path, uint32_t slot_count) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    if (slot_count < 2 || (slot_count & (slot_count - 1)) != 0) return -1;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    size_t map_size = ring_map_size(slot_count);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ftruncate(fd, (off_t)map_size) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    EvRingHeader *hdr = (EvRingHeader *)base;
+    int reuse = ((size_t)st.st_size == map_size &&
+                 hdr->magic == EVRING_MAGIC &&
+                 hdr->version == EVRING_VERSION &&
+                 hdr->slot_count == slot_count &&
+                 hdr->slot_size == sizeof(EvRingSlot) &&
+                 hdr->data_offset == sizeof(EvRingHeader) &&
+                 ring_consistent(hdr, (const EvRingSlot *)((char *)base + hdr->data_offset)));
+    if (!reuse) {
+        /* Fresh ring; an existing one with matching geometry keeps its
+         * sequence so attached readers survive a server restart */
+        memset(base, 0, map_size);
+        hdr->version = EVRING_VERSION;
+        hdr->slot_count = slot_count;
+        hdr->slot_size = sizeof(EvRingSlot);
+        hdr->data_offset = sizeof(EvRingHeader);
+        __atomic_store_n(&hdr->magic, EVRING_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    r->fd = fd;
+    ring_attach(r, base, map_size);
+    return 0;
+}
+
+void evring_publish(EvRing *r, const Event *ev) {
+    uint64_t n = __atomic_fetch_add(&r->hdr->write_seq, 1, __ATOMIC_RELAXED);
+    EvRingSlot *slot = &r->slots[n & r->mask];
+
+    /* Session threads publish concurrently: the writer one lap behind must
+     * be done with this slot first. Only contended when a whole ring's
+     * worth of events is published while that writer is stalled. */
+    uint64_t prev = (n > r->mask) ? 2 * (n - r->mask - 1) + 2 : 0;
+    uint64_t mine = 2 * n + 1;
+    for (int spins = 0;; ++spins) {
+        uint64_t cur = prev;
+        if (__atomic_compare_exchange_n(&slot->seq, &cur, mine, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (spins >= EVRING_CLAIM_SPINS) {
+            /* That writer died, or the ring was recreated under it */
+            __atomic_store_n(&slot->seq, mine, __ATOMIC_RELAXED);
+            break;
+        }
+        sched_yield();
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->ev, ev, sizeof(*ev));
+    /* Publish only if no later writer took the slot over meanwhile */
+    __atomic_compare_exchange_n(&slot->seq, &mine, mine + 1, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+int evring_open_reader(EvRing *r, const char *path, int from_oldest) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EvRingHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    EvRingHeader *hdr = (EvRingHeader *)base;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != EVRING_MAGIC ||
+        hdr->version != EVRING_VERSION ||
+        hdr->slot_size != sizeof(EvRingSlot) ||
+        ring_map_size(hdr->slot_count) > (size_t)st.st_size) {
+        munmap(base, (size_t)st.st_size);
+        close(fd);
+        return -1;
+    }
+
+    r->fd = fd;
+    ring_attach(r, base, (size_t)st.st_size);
+
+    uint64_t end = __atomic_load_n(&hdr->write_seq, __ATOMIC_ACQUIRE);
+    if (from_oldest) {
+        r->cursor = (end > hdr->slot_count) ? end - hdr->slot_count : 0;
+    } else {
+        r->cursor = end;
+    }
+    return 0;
+}
+
+int evring_read(EvRing *r, Event *ev, uint64_t *lost) {
+    for (;;) {
+        uint64_t n = r->cursor;
+        const EvRingSlot *slot = &r->slots[n & r->mask];
+        uint64_t want = 2 * n + 2;
+
+        uint64_t s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (s1 < want) {
+            /* Not written yet (or still being written) */
+            return 0;
+        }
+        if (s1 == want) {
+            memcpy(ev, &slot->ev, sizeof(*ev));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            uint64_t s2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+            if (s2 == want) {
+                r->cursor = n + 1;
+                return 1;
+            }
+        }
+
+        /* Lapped by the writer: skip to the oldest slot still in the ring */
+        uint64_t end = __atomic_load_n(&r->hdr->write_seq, __ATOMIC_ACQUIRE);
+        uint64_t oldest = (end > r->hdr->slot_count) ? end - r->hdr->slot_count : 0;
+        if (oldest <= n) oldest = n + 1;
+        if (lost) *lost += oldest - n;
+        r->cursor = oldest;
+    }
+}
+
+void evring_close(EvRing *r) {
+    if (r->base) munmap(r->base, r->map_size);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
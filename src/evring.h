@@ -0,0 +1,74 @@
+#ifndef EVRING_H
+#define EVRING_H
+
+#include "events.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Shared-memory event ring for local consumers.
+ *
+ * The server maps a file (typically under /dev/shm) holding a header and
+ * a power-of-two array of slots, each carrying one Event. Publishing is a
+ * memcpy plus a few atomic stores, with no syscalls. Any number of readers
+ * map the same file read-only and keep their own cursor.
+ *
+ * Each slot is protected by a seqlock: a writer claims sequence number n,
+ * waits until the slot holds 2(n-slots)+2 (the previous lap is complete),
+ * stores 2n+1, copies the Event and then stores 2n+2. Any number of
+ * threads may publish, and a slot only ever moves forward. A writer that
+ * waits too long (its predecessor died) takes the slot over. A reader
+ * expecting sequence n accepts the slot only if it reads 2n+2 both before
+ * and after copying it. A larger value means the reader was lapped and
+ * events were lost.
+ *
+ * Event is stored in its native in-memory layout, so readers must be
+ * built from the same events.h as the server.
+ */
+
+#define EVRING_MAGIC   0x52465443u  /* "CTFR" little-endian */
+#define EVRING_VERSION 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;   /* power of two */
+    uint32_t slot_size;
+    uint64_t data_offset;  /* offset of slot 0 from start of mapping */
+    char     pad0[40];
+    uint64_t write_seq;    /* next sequence number to claim */
+    char     pad1[56];
+} EvRingHeader;
+
+typedef struct {
+    uint64_t seq;
+    Event    ev;
+} __attribute__((aligned(64))) EvRingSlot;
+
+typedef struct {
+    int            fd;
+    void          *base;
+    size_t         map_size;
+    EvRingHeader  *hdr;
+    EvRingSlot    *slots;
+    uint64_t       mask;
+    uint64_t       cursor;  /* reader only: next sequence to read */
+} EvRing;
+
+/* Writer side (server) */
+int evring_create(EvRing *r, const char *path, uint32_t slot_count);
+void evring_publish(EvRing *r, const Event *ev);
+
+/* Reader side; from_oldest=0 starts at the current end of the ring */
+int evring_open_reader(EvRing *r, const char *path, int from_oldest);
+
+/*
+ * Returns 1 and fills *ev if an event was read, 0 if none is available yet.
+ * *lost is incremented by the number of events overwritten before they
+ * could be read.
+ */
+int evring_read(EvRing *r, Event *ev, uint64_t *lost);
+
+void evring_close(EvRing *r);
+
+#endif
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "fcache.h"
+#include "logger.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct FcacheEntry {
+    FcacheKey key;
+    int variant;
+
+    int fd;
+    long long size;
+    int disk;                          /* lives in the spill directory */
+
+    struct FcacheEntry *prev, *next;   /* LRU list, most recent first */
+} FcacheEntry;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static FcacheEntry *g_head = NULL;
+static FcacheEntry *g_tail = NULL;
+static long long g_max_bytes = 0;
+static long long g_bytes = 0;
+static int g_count = 0;
+
+static char g_spill_dir[PATH_MAX];
+static dev_t g_spill_dev;
+static long long g_max_disk_bytes = 0;
+static long long g_disk_bytes = 0;
+
+void fcache_key_from_stat(FcacheKey *key, const struct stat *st) {
+    key->dev = (uint64_t)st->st_dev;
+    key->ino = (uint64_t)st->st_ino;
+    key->offset = 0;
+    key->size = (uint64_t)st->st_size;
+    key->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+static int entry_matches(const FcacheEntry *e, const FcacheKey *key, int variant) {
+    return e->variant == variant &&
+           e->key.dev == key->dev &&
+           e->key.ino == key->ino &&
+           e->key.offset == key->offset &&
+           e->key.size == key->size &&
+           e->key.mtime_sec == key->mtime_sec &&
+           e->key.mtime_nsec == key->mtime_nsec;
+}
+
+static void lru_unlink(FcacheEntry *e) {
+    if (e->prev) e->prev->next = e->next; else g_head = e->next;
+    if (e->next) e->next->prev = e->prev; else g_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(FcacheEntry *e) {
+    e->prev = NULL;
+    e->next = g_head;
+    if (g_head) g_head->prev = e;
+    g_head = e;
+    if (!g_tail) g_tail = e;
+}
+
+static void entry_drop(FcacheEntry *e) {
+    lru_unlink(e);
+    if (e->disk) g_disk_bytes -= e->size;
+    else g_bytes -= e->size;
+    g_count--;
+    close(e->fd);
+    free(e);
+}
+
+/* Make room for need bytes in one tier, least recently used first */
+static void tier_evict(int disk, long long need) {
+    long long *bytes = disk ? &g_disk_bytes : &g_bytes;
+    long long max = disk ? g_max_disk_bytes : g_max_bytes;
+    FcacheEntry *e = g_tail;
+    while (e && *bytes + need > max) {
+        FcacheEntry *prev = e->prev;
+        if (e->disk == disk) entry_drop(e);
+        e = prev;
+    }
+}
+
+void fcache_init(long long max_bytes, const char *spill_dir, long long spill_bytes) {
+    struct stat st;
+    pthread_mutex_lock(&g_lock);
+    g_max_bytes = max_bytes;
+    g_spill_dir[0] = '\0';
+    g_max_disk_bytes = 0;
+    if (spill_dir && spill_bytes > 0) {
+        if (stat(spill_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+            safe_strcpy(g_spill_dir, sizeof(g_spill_dir), spill_dir);
+            g_spill_dev = st.st_dev;
+            g_max_disk_bytes = spill_bytes;
+        } else {
+            log_msg(LOG_ERROR, "content_spill_dir %s is not a directory, "
+                    "content over content_cache_mb will not be cached", spill_dir);
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void fcache_shutdown(void) {
+    pthread_mutex_lock(&g_lock);
+    while (g_head) entry_drop(g_head);
+    pthread_mutex_unlock(&g_lock);
+}
+
+int fcache_get(const FcacheKey *key, int variant, long long *size) {
+    int fd = -1;
+
+    pthread_mutex_lock(&g_lock);
+    for (FcacheEntry *e = g_head; e; e = e->next) {
+        if (entry_matches(e, key, variant)) {
+            fd = fcntl(e->fd, F_DUPFD_CLOEXEC, 0);
+            if (fd >= 0) {
+                *size = e->size;
+                lru_unlink(e);
+                lru_push_front(e);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return fd;
+}
+
+int fcache_create(int variant, const char *name, long long expected) {
+    if (expected <= g_max_bytes) {
+        return memfd_create(variant == FCACHE_GUNZIP ? "ctftp-gunzip" : "ctftp-netascii",
+                            MFD_CLOEXEC);
+    }
+    if (g_spill_dir[0] && expected <= g_max_disk_bytes) {
+        int fd = open(g_spill_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            log_msg(LOG_INFO, "fcache: %s (up to %lld bytes) exceeds content_cache_mb, "
+                    "building it in %s", name, expected, g_spill_dir);
+            return fd;
+        }
+        log_msg(LOG_ERROR, "fcache: %s: %s", g_spill_dir, strerror(errno));
+    } else {
+        log_msg(LOG_INFO, "fcache: %s (up to %lld bytes) fits neither content_cache_mb "
+                "nor content_spill_mb, not cached", name, expected);
+    }
+    errno = EFBIG;
+    return -1;
+}
+
+/* Built in the spill directory, so kept against the disk budget */
+static int spilled(int fd) {
+    struct stat st;
+    return g_spill_dir[0] && fstat(fd, &st) == 0 && st.st_dev == g_spill_dev;
+}
+
+void fcache_put(const FcacheKey *key, int variant, int content_fd, long long size) {
+    int disk = spilled(content_fd);
+    if (size > (disk ? g_max_disk_bytes : g_max_bytes)) {
+        log_msg(LOG_INFO, "fcache: %lld bytes of content exceed %s, not cached",
+                size, disk ? "content_spill_mb" : "content_cache_mb");
+        return;
+    }
+
+    FcacheEntry *e = (FcacheEntry *)calloc(1, sizeof(*e));
+    if (!e) return;
+    e->fd = fcntl(content_fd, F_DUPFD_CLOEXEC, 0);
+    if (e->fd < 0) {
+        free(e);
+        return;
+    }
+    e->key = *key;
+    e->variant = variant;
+    e->size = size;
+    e->disk = disk;
+
+    pthread_mutex_lock(&g_lock);
+    /* Two sessions may have converted the same version concurrently;
+     * keep whichever got here first */
+    for (FcacheEntry *it = g_head; it; it = it->next) {
+        if (entry_matches(it, key, variant)) {
+            pthread_mutex_unlock(&g_lock);
+            close(e->fd);
+            free(e);
+            return;
+        }
+    }
+    tier_evict(disk, size);
+    lru_push_front(e);
+    if (disk) g_disk_bytes += size;
+    else g_bytes += size;
+    g_count++;
+    pthread_mutex_unlock(&g_lock);
+}
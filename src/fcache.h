@@ -0,0 +1,61 @@
+#ifndef FCACHE_H
+#define FCACHE_H
+
+#include <sys/stat.h>
+#include <stdint.h>
+
+/*
+ * Cache of derived file content (e.g. the netascii rendering of a file, or
+ * a decompressed copy).
+ * Entries are in-memory files keyed by the source file version (device,
+ * inode, size and mtime; plus the offset for files inside a bundle) and a
+ * variant tag, so a modified file simply misses and its stale entry ages
+ * out. Lookups hand out a dup()ed fd, so
+ * evicting an entry never disturbs a transfer that is still reading it.
+ * Total size is bounded; least recently used entries are evicted first.
+ *
+ * Content larger than the memory budget is built in an unlinked file under
+ * a spill directory instead (see fcache_create) and kept against a separate
+ * disk budget, so a big file is still converted only once per version.
+ */
+
+typedef enum {
+    FCACHE_NETASCII = 1,
+    FCACHE_GUNZIP   = 2     /* decompressed .gz (compressed_storage=) */
+} FcacheVariant;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t offset;      /* position inside a bundle, 0 for plain files */
+    uint64_t size;
+    int64_t  mtime_sec;
+    long     mtime_nsec;
+} FcacheKey;
+
+void fcache_key_from_stat(FcacheKey *key, const struct stat *st);
+
+/* spill_dir may be NULL or spill_bytes 0 to keep only what fits in memory */
+void fcache_init(long long max_bytes, const char *spill_dir, long long spill_bytes);
+void fcache_shutdown(void);
+
+/* Returns a new fd for the cached content and its size, or -1 on miss */
+int fcache_get(const FcacheKey *key, int variant, long long *size);
+
+/*
+ * A new, empty file to build at most expected bytes of variant content for
+ * name (used in log messages) in: an in-memory file when that fits the
+ * memory budget, else an unlinked file in the spill directory. Returns the
+ * fd, or -1 with errno set; EFBIG if the content fits neither budget.
+ */
+int fcache_create(int variant, const char *name, long long expected);
+
+/*
+ * Offer content_fd for caching. The cache keeps its own dup(), so the
+ * caller still owns content_fd either way. Content in the spill directory
+ * counts against the disk budget, anything else against the memory budget;
+ * content over its budget is not kept.
+ */
+void fcache_put(const FcacheKey *key, int variant, int content_fd, long long size);
+
+#endif
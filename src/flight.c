@@ -0,0 +1,114 @@
+#include "flight.h"
+#include "logger.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static FlightTrace *g_ring = NULL;
+static int g_cap = 0;
+static unsigned long long g_next = 0;   /* total traces recorded */
+static char g_dump_path[PATH_MAX];
+
+void flight_record(const FlightTrace *tr) {
+    if (g_cap == 0) return;
+    pthread_mutex_lock(&g_lock);
+    memcpy(&g_ring[g_next % (unsigned long long)g_cap], tr, sizeof(*tr));
+    g_next++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void dump_trace(FILE *out, const FlightTrace *tr) {
+    const Event *ev = &tr->ev;
+    const EventTiming *t = &ev->timing;
+
+    fprintf(out, "%s %s %s:%d \"%s\" status=%s bytes=%zu open=%uus first_data=%uus "
+            "total=%uus rtt_min/avg/max=%u/%u/%uus retransmits=%u",
+            ev->start_ts, tr->op, ev->client_ip, ev->client_port, ev->filename,
+            ev->status, ev->bytes, t->open_us, t->first_data_us, t->total_us,
+            t->rtt_min_us, t->rtt_avg_us, t->rtt_max_us, t->retransmits);
+
+    uint32_t shown = t->retransmits < FLIGHT_MAX_RETX ? t->retransmits : FLIGHT_MAX_RETX;
+    for (uint32_t i = 0; i < shown; ++i) {
+        fprintf(out, "%sblk%u@%uus", i == 0 ? " [" : " ",
+                tr->retx_block[i], tr->retx_us[i]);
+    }
+    if (shown > 0) fprintf(out, "%s]", t->retransmits > shown ? " ..." : "");
+    fputc('\n', out);
+}
+
+int flight_dump(FILE *out) {
+    /* Snapshot under the lock, format without it */
+    pthread_mutex_lock(&g_lock);
+    unsigned long long end = g_next;
+    unsigned long long n = end < (unsigned long long)g_cap ? end : (unsigned long long)g_cap;
+    FlightTrace *snap = n ? (FlightTrace *)malloc((size_t)n * sizeof(FlightTrace)) : NULL;
+    if (snap) {
+        for (unsigned long long i = 0; i < n; ++i) {
+            snap[i] = g_ring[(end - n + i) % (unsigned long long)g_cap];
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (n && !snap) return -1;
+
+    char ts[32];
+    now_iso8601(ts, sizeof(ts));
+    fprintf(out, "# flight recorder dump at %s: %llu of %llu sessions, oldest first\n",
+            ts, n, end);
+    for (unsigned long long i = 0; i < n; ++i) dump_trace(out, &snap[i]);
+    fflush(out);
+    free(snap);
+    return (int)n;
+}
+
+static void *flight_signal_thread(void *arg) {
+    sigset_t *set = (sigset_t *)arg;
+    for (;;) {
+        int sig;
+        if (sigwait(set, &sig) != 0 || sig != SIGUSR1) continue;
+
+        if (g_cap == 0) {
+            log_msg(LOG_INFO, "SIGUSR1: flight recorder disabled (flight_recorder=0)");
+            continue;
+        }
+        FILE *f = fopen(g_dump_path, "a");
+        if (!f) {
+            log_msg(LOG_ERROR, "SIGUSR1: cannot open %s", g_dump_path);
+            continue;
+        }
+        int n = flight_dump(f);
+        fclose(f);
+        log_msg(LOG_INFO, "SIGUSR1: dumped %d session traces to %s", n, g_dump_path);
+    }
+    return NULL;
+}
+
+int flight_init(const ServerConfig *cfg) {
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) return -1;
+
+    snprintf(g_dump_path, sizeof(g_dump_path), "%s/ctftp-flight.log", cfg->log_dir);
+    if (cfg->flight_recorder > 0) {
+        g_ring = (FlightTrace *)calloc((size_t)cfg->flight_recorder, sizeof(FlightTrace));
+        if (!g_ring) {
+            log_msg(LOG_ERROR, "Flight recorder: cannot allocate %d traces", cfg->flight_recorder);
+        } else {
+            g_cap = cfg->flight_recorder;
+        }
+    }
+
+    pthread_t th;
+    if (thread_spawn(&th, flight_signal_thread, &set,
+                     (size_t)cfg->thread_stack_kb * 1024, 1) != 0) {
+        log_msg(LOG_ERROR, "Flight recorder: cannot start SIGUSR1 thread");
+        return -1;
+    }
+    return 0;
+}
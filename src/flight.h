@@ -0,0 +1,38 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include "config.h"
+#include "events.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Flight recorder: a bounded ring holding the traces of the last N
+ * sessions (the final Event with its stage timing, plus when each
+ * retransmission happened). Recording is a memcpy under a mutex. SIGUSR1
+ * dumps the ring to <log_dir>/ctftp-flight.log, so tail latency can be
+ * inspected on a production server without enabling debug logging.
+ */
+
+#define FLIGHT_MAX_RETX 16
+
+typedef struct {
+    Event    ev;
+    char     op[4];                           /* "RRQ" or "WRQ" */
+    uint32_t retx_us[FLIGHT_MAX_RETX];        /* offset from request receipt */
+    uint16_t retx_block[FLIGHT_MAX_RETX];     /* block that was resent */
+} FlightTrace;
+
+/*
+ * Allocate the ring and start the SIGUSR1 dump thread. Must run in the
+ * main thread before any other thread is created, so that every thread
+ * inherits SIGUSR1 blocked.
+ */
+int flight_init(const ServerConfig *cfg);
+
+void flight_record(const FlightTrace *tr);
+
+/* Write every held trace, oldest first; returns the number written */
+int flight_dump(FILE *out);
+
+#endif
@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include "gunzip.h"
+#include "fcache.h"
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define GUNZIP_IN_CHUNK  (64 * 1024)
+#define GUNZIP_OUT_CHUNK (256 * 1024)
+
+#define FILL_RUNNING 0
+#define FILL_DONE    1
+#define FILL_FAILED  2
+
+struct GunzipFill {
+    pthread_mutex_t mu;             /* serializes inflating and the state below */
+    int state;                      /* FILL_* */
+    int src_fd;                     /* the .gz file */
+    off_t src_size;
+    off_t src_off;                  /* compressed bytes fed to zlib */
+    int out_fd;                     /* memfd or spill file being filled */
+    long long size;                 /* expected uncompressed size (ISIZE) */
+    long long done;                 /* bytes written to out_fd */
+    z_stream zs;
+    unsigned char *in;
+    unsigned char *out;
+    FcacheKey key;                  /* version of the .gz file */
+    char name[PATH_MAX];
+
+    int refs;                       /* g_lock */
+    int listed;                     /* g_lock */
+    struct GunzipFill *next;        /* g_lock */
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static GunzipFill *g_fills = NULL;  /* decompressions in progress (single-flight) */
+
+static int same_key(const FcacheKey *a, const FcacheKey *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec;
+}
+
+/* Caller holds g_lock */
+static void fill_unlist(GunzipFill *f) {
+    if (!f->listed) return;
+    for (GunzipFill **pp = &g_fills; *pp; pp = &(*pp)->next) {
+        if (*pp == f) {
+            *pp = f->next;
+            break;
+        }
+    }
+    f->listed = 0;
+}
+
+/* Inflating stopped (f->mu held): drop the input and leave the registry */
+static void fill_end(GunzipFill *f, int state) {
+    f->state = state;
+    inflateEnd(&f->zs);
+    close(f->src_fd);
+    f->src_fd = -1;
+    free(f->in);
+    free(f->out);
+    f->in = f->out = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    fill_unlist(f);
+    pthread_mutex_unlock(&g_lock);
+
+    if (state == FILL_DONE) {
+        log_msg(LOG_INFO, "gunzip: %s inflated (%lld -> %lld bytes)",
+                f->name, (long long)f->src_size, f->size);
+        fcache_put(&f->key, FCACHE_GUNZIP, f->out_fd, f->size);
+    }
+}
+
+static int write_all_at(int fd, const unsigned char *buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t w = pwrite(fd, buf, len, off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+        off += w;
+    }
+    return 0;
+}
+
+/* One inflate() call's worth of output (f->mu held); -1 once failed */
+static int fill_step(GunzipFill *f) {
+    if (f->zs.avail_in == 0) {
+        ssize_t r = pread(f->src_fd, f->in, GUNZIP_IN_CHUNK, f->src_off);
+        if (r < 0 && errno == EINTR) return 0;
+        if (r <= 0) {
+            log_msg(LOG_ERROR, "gunzip: %s: %s", f->name, r < 0 ? strerror(errno) : "truncated");
+            fill_end(f, FILL_FAILED);
+            return -1;
+        }
+        f->src_off += r;
+        f->zs.next_in = f->in;
+        f->zs.avail_in = (uInt)r;
+    }
+
+    f->zs.next_out = f->out;
+    f->zs.avail_out = GUNZIP_OUT_CHUNK;
+    int rc = inflate(&f->zs, Z_NO_FLUSH);
+    size_t n = GUNZIP_OUT_CHUNK - f->zs.avail_out;
+    if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+        log_msg(LOG_ERROR, "gunzip: %s: %s", f->name, f->zs.msg ? f->zs.msg : "inflate failed");
+        fill_end(f, FILL_FAILED);
+        return -1;
+    }
+    if (f->done + (long long)n > f->size ||
+        write_all_at(f->out_fd, f->out, n, (off_t)f->done) != 0) {
+        log_msg(LOG_ERROR, "gunzip: %s: %s", f->name,
+                f->done + (long long)n > f->size ? "larger than its stored size"
+                                                 : strerror(errno));
+        fill_end(f, FILL_FAILED);
+        return -1;
+    }
+    f->done += (long long)n;
+
+    if (rc == Z_STREAM_END) {
+        /* tsize was announced from ISIZE, so the member must be the whole file */
+        if (f->done != f->size || f->zs.avail_in != 0 || f->src_off != f->src_size) {
+            log_msg(LOG_ERROR, "gunzip: %s: size mismatch or multiple gzip members", f->name);
+            fill_end(f, FILL_FAILED);
+            return -1;
+        }
+        fill_end(f, FILL_DONE);
+    }
+    return 0;
+}
+
+/* Set up inflating gz_fd (taken over) for the version in key */
+static GunzipFill *fill_create(const char *name, int gz_fd, const struct stat *st,
+                               const FcacheKey *key) {
+    unsigned char head[3], trailer[4];
+    if (st->st_size < 18 || pread(gz_fd, head, 3, 0) != 3 ||
+        head[0] != 0x1f || head[1] != 0x8b || head[2] != 8 ||
+        pread(gz_fd, trailer, 4, st->st_size - 4) != 4) {
+        log_msg(LOG_ERROR, "gunzip: %s.gz is not a gzip file", name);
+        close(gz_fd);
+        errno = EIO;
+        return NULL;
+    }
+
+    long long size = (long long)((uint32_t)trailer[0] | (uint32_t)trailer[1] << 8 |
+                                 (uint32_t)trailer[2] << 16 | (uint32_t)trailer[3] << 24);
+    GunzipFill *f = (GunzipFill *)calloc(1, sizeof(GunzipFill));
+    if (f) {
+        f->in = (unsigned char *)malloc(GUNZIP_IN_CHUNK);
+        f->out = (unsigned char *)malloc(GUNZIP_OUT_CHUNK);
+        f->out_fd = fcache_create(FCACHE_GUNZIP, name, size);
+    }
+    if (!f || !f->in || !f->out || f->out_fd < 0 ||
+        inflateInit2(&f->zs, 16 + MAX_WBITS) != Z_OK) {
+        if (f) {
+            free(f->in);
+            free(f->out);
+            if (f->out_fd >= 0) close(f->out_fd);
+            free(f);
+        }
+        close(gz_fd);
+        errno = EIO;
+        return NULL;
+    }
+
+    pthread_mutex_init(&f->mu, NULL);
+    f->state = FILL_RUNNING;
+    f->src_fd = gz_fd;
+    f->src_size = st->st_size;
+    f->size = size;
+    f->key = *key;
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->refs = 1;
+    return f;
+}
+
+int gunzip_open(const char *path, GunzipFile *out) {
+    char gz_path[PATH_MAX];
+    if (snprintf(gz_path, sizeof(gz_path), "%s.gz", path) >= (int)sizeof(gz_path)) {
+        errno = ENOENT;
+        return -1;
+    }
+    int gz_fd = open(gz_path, O_RDONLY | O_CLOEXEC);
+    if (gz_fd < 0) {
+        if (errno != ENOENT) log_msg(LOG_ERROR, "gunzip: %s: %s", gz_path, strerror(errno));
+        errno = ENOENT;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(gz_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(gz_fd);
+        errno = ENOENT;
+        return -1;
+    }
+    FcacheKey key;
+    fcache_key_from_stat(&key, &st);
+
+    /* Hot file: inflated before and still cached */
+    long long size;
+    int fd = fcache_get(&key, FCACHE_GUNZIP, &size);
+    if (fd >= 0) {
+        close(gz_fd);
+        out->fd = fd;
+        out->size = size;
+        out->fill = NULL;
+        return 0;
+    }
+
+    /* Under g_lock, so concurrent first requests create a single fill */
+    pthread_mutex_lock(&g_lock);
+    GunzipFill *f = NULL;
+    for (GunzipFill *it = g_fills; it; it = it->next) {
+        if (same_key(&it->key, &key)) {
+            f = it;
+            f->refs++;
+            break;
+        }
+    }
+    if (f) {
+        close(gz_fd);
+    } else if ((f = fill_create(path, gz_fd, &st, &key)) != NULL) {
+        f->listed = 1;
+        f->next = g_fills;
+        g_fills = f;
+    }
+    pthread_mutex_unlock(&g_lock);
+    if (!f) return -1;
+
+    out->fd = dup(f->out_fd);
+    out->size = f->size;
+    out->fill = f;
+    if (out->fd < 0) {
+        gunzip_release(f);
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t gunzip_wait_bytes(GunzipFill *f, off_t off, size_t len) {
+    long long want = (long long)off + (long long)len;
+    if (want > f->size) want = f->size;
+
+    /* Reading up to the end also consumes the trailer, so the last block
+     * is only handed out once the CRC and size are verified */
+    pthread_mutex_lock(&f->mu);
+    while (f->state == FILL_RUNNING && (f->done < want || want == f->size)) {
+        if (fill_step(f) != 0) break;
+    }
+    ssize_t avail = -1;
+    if (f->state != FILL_FAILED) {
+        long long have = f->done - (long long)off;
+        avail = have <= 0 ? 0 : (ssize_t)(have < (long long)len ? have : (long long)len);
+    }
+    pthread_mutex_unlock(&f->mu);
+    return avail;
+}
+
+int gunzip_wait_done(GunzipFill *f) {
+    return gunzip_wait_bytes(f, 0, (size_t)f->size) == (ssize_t)f->size ? 0 : -1;
+}
+
+void gunzip_release(GunzipFill *f) {
+    if (!f) return;
+    pthread_mutex_lock(&g_lock);
+    int last = (--f->refs == 0);
+    if (last) fill_unlist(f);
+    pthread_mutex_unlock(&g_lock);
+    if (!last) return;
+
+    /* Nobody reads it any more: an unfinished decompression is dropped */
+    if (f->state == FILL_RUNNING) {
+        inflateEnd(&f->zs);
+        close(f->src_fd);
+        free(f->in);
+        free(f->out);
+    }
+    close(f->out_fd);
+    pthread_mutex_destroy(&f->mu);
+    free(f);
+}
@@ -0,0 +1,46 @@
+#ifndef GUNZIP_H
+#define GUNZIP_H
+
+#include <sys/types.h>
+
+/*
+ * Compressed storage (compressed_storage=gzip).
+ *
+ * A file missing from root_dir is served from "<name>.gz" next to it. The
+ * uncompressed size comes from the gzip trailer (ISIZE), so tsize is known
+ * before anything is inflated. The first request inflates into a file
+ * from fcache_create (in memory, or spilled to disk when larger than the
+ * memory budget) on demand, only as far as its reader has got, so blocks
+ * go out while the rest is still compressed; concurrent requests for the
+ * same file share that one decompression. A finished copy is checked
+ * (CRC-32 and size) and offered to the content cache (fcache), so hot
+ * files are inflated once per version.
+ */
+
+typedef struct GunzipFill GunzipFill;
+
+typedef struct {
+    int fd;                 /* decompressed content, growing while fill is set */
+    long long size;         /* uncompressed size */
+    GunzipFill *fill;       /* non-NULL while still inflating; release when done */
+} GunzipFile;
+
+/*
+ * Open path through path.gz. Returns 0 on success, or -1 with errno ENOENT
+ * (no compressed version) or EIO (not a usable gzip file).
+ */
+int gunzip_open(const char *path, GunzipFile *out);
+
+/*
+ * Inflate until the bytes [off, off+len) exist. Returns the number of
+ * bytes that can now be read at off (short only at the end of the file),
+ * or -1 if the compressed file turned out to be corrupt.
+ */
+ssize_t gunzip_wait_bytes(GunzipFill *f, off_t off, size_t len);
+
+/* Inflate the rest; 0 on success */
+int gunzip_wait_done(GunzipFill *f);
+
+void gunzip_release(GunzipFill *f);
+
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include "handoff.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define HANDOFF_BATCH    128      /* fds per message (kernel limit is 253) */
+#define HANDOFF_MSG_MAX  (HANDOFF_BATCH * 80 + 64)
+#define HANDOFF_WAIT_MS  10000    /* how long either side waits for the other */
+
+static int handoff_addr(const char *path, struct sockaddr_un *un) {
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(un->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    safe_strcpy(un->sun_path, sizeof(un->sun_path), path);
+    return 0;
+}
+
+/* Receive one message (and any fds) with a timeout; returns its length */
+static ssize_t recv_msg(int conn, char *buf, size_t size, int *fds, int max_fds, int *nfds) {
+    struct pollfd p = { conn, POLLIN, 0 };
+    int pr;
+    do {
+        pr = poll(&p, 1, HANDOFF_WAIT_MS);
+    } while (pr < 0 && errno == EINTR);
+    if (pr <= 0) {
+        if (pr == 0) errno = ETIMEDOUT;
+        return -1;
+    }
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+    } ctl;
+    struct iovec iov = { buf, size - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t r;
+    do {
+        r = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) {
+        if (r == 0) errno = ECONNRESET;
+        return -1;
+    }
+    buf[r] = '\0';
+
+    if (nfds) *nfds = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int n = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *in = (int *)CMSG_DATA(c);
+        for (int i = 0; i < n; ++i) {
+            if (fds && *nfds < max_fds) fds[(*nfds)++] = in[i];
+            else close(in[i]);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return r;
+}
+
+static int send_msg(int conn, const char *text, const int *fds, int nfds) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+    } ctl;
+    struct iovec iov = { (void *)text, strlen(text) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * (size_t)nfds);
+    }
+    ssize_t r;
+    do {
+        r = sendmsg(conn, &msg, MSG_NOSIGNAL);
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -1 : 0;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un un;
+    if (handoff_addr(path, &un) != 0) return -1;
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    /* A new process replaces the path of the one it took over from */
+    unlink(path);
+    if (bind(s, (struct sockaddr *)&un, sizeof(un)) != 0 || listen(s, 1) != 0) {
+        int e = errno;
+        close(s);
+        errno = e;
+        return -1;
+    }
+    return s;
+}
+
+int handoff_give(int conn, const HandoffListener *ls, int n) {
+    char buf[HANDOFF_MSG_MAX];
+    if (recv_msg(conn, buf, sizeof(buf), NULL, 0, NULL) < 0 || strcmp(buf, "TAKE") != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < n; ) {
+        int fds[HANDOFF_BATCH];
+        int nfds = 0;
+        size_t pos = (size_t)snprintf(buf, sizeof(buf), "LISTENERS");
+        for (; i < n && nfds < HANDOFF_BATCH; ++i) {
+            if (ls[i].fd < 0) continue;
+            pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, " %s:%d", ls[i].addr, ls[i].port);
+            fds[nfds++] = ls[i].fd;
+        }
+        if (nfds > 0 && send_msg(conn, buf, fds, nfds) != 0) return -1;
+    }
+    if (send_msg(conn, "END", NULL, 0) != 0) return -1;
+
+    if (recv_msg(conn, buf, sizeof(buf), NULL, 0, NULL) < 0 || strcmp(buf, "READY") != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un un;
+    if (handoff_addr(path, &un) != 0) return -1;
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&un, sizeof(un)) != 0 ||
+        send_msg(s, "TAKE", NULL, 0) != 0) {
+        int e = errno;
+        close(s);
+        errno = e;
+        return -1;
+    }
+    return s;
+}
+
+int handoff_take(int conn, HandoffListener **out, int *n) {
+    HandoffListener *ls = NULL;
+    int count = 0;
+    char buf[HANDOFF_MSG_MAX];
+
+    for (;;) {
+        int fds[HANDOFF_BATCH];
+        int nfds = 0;
+        if (recv_msg(conn, buf, sizeof(buf), fds, HANDOFF_BATCH, &nfds) < 0) goto fail;
+        if (strcmp(buf, "END") == 0) break;
+        if (!starts_with(buf, "LISTENERS")) goto fail_fds;
+
+        HandoffListener *nl = (HandoffListener *)realloc(ls, (size_t)(count + nfds) * sizeof(*ls));
+        if (!nl) goto fail_fds;
+        ls = nl;
+
+        char *save = NULL;
+        char *tok = strtok_r(buf + 9, " ", &save);
+        for (int i = 0; i < nfds; ++i) {
+            HandoffListener *l = &ls[count++];
+            l->fd = fds[i];
+            l->addr[0] = '\0';
+            l->port = 0;
+            if (!tok) continue;
+            char *colon = strrchr(tok, ':');
+            if (colon) {
+                *colon = '\0';
+                safe_strcpy(l->addr, sizeof(l->addr), tok);
+                l->port = atoi(colon + 1);
+            }
+            tok = strtok_r(NULL, " ", &save);
+        }
+        continue;
+
+    fail_fds:
+        for (int i = 0; i < nfds; ++i) close(fds[i]);
+        goto fail;
+    }
+    *out = ls;
+    *n = count;
+    return 0;
+
+fail:
+    for (int i = 0; i < count; ++i) close(ls[i].fd);
+    free(ls);
+    return -1;
+}
+
+int handoff_ready(int conn) {
+    return send_msg(conn, "READY", NULL, 0);
+}
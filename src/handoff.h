@@ -0,0 +1,35 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/*
+ * Listener socket handoff for zero-downtime upgrades. A running server
+ * listens on a Unix socket (upgrade_socket=). A new process started with
+ * --upgrade connects, receives the bound listener sockets over SCM_RIGHTS,
+ * starts reading from them and then reports ready. Only then does the old
+ * process stop its intake, let its sessions finish, and exit.
+ *
+ *   new -> old   "TAKE"
+ *   old -> new   "LISTENERS n addr:port ..." + n fds, repeated, then "END"
+ *   new -> old   "READY"
+ */
+
+typedef struct {
+    char addr[64];
+    int  port;
+    int  fd;
+} HandoffListener;
+
+/* Old side */
+int handoff_listen(const char *path);
+/* Serve one takeover request on an accepted connection. Returns 0 once the
+ * new process is ready (the caller then stops its intake), -1 if the
+ * takeover failed and this process should keep serving. */
+int handoff_give(int conn, const HandoffListener *ls, int n);
+
+/* New side: returns the connection, or -1 if no server is running there */
+int handoff_connect(const char *path);
+/* Receive the listeners into a heap array (*out, *n); 0 on success */
+int handoff_take(int conn, HandoffListener **out, int *n);
+int handoff_ready(int conn);
+
+#endif
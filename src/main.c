@@ -2,19 +2,48 @@
 #include "config.h"
 #include "logger.h"
 #include "events.h"
+#include "sinks.h"
 #include "tftp.h"
+#include "flight.h"
+#include "stats.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Print the memory budget implied by the configuration, plus current RSS
+static void print_footprint(const ServerConfig *cfg, const char *cfg_path) {
+    printf("ctftp memory footprint (config: %s)\n", cfg_path);
+    printf("  config:           %zu B + %zu B listener table\n",
+           sizeof(*cfg), (size_t)cfg->num_listeners * sizeof(ListenerConfig));
+    tftp_print_footprint(cfg, stdout);
+    sinks_print_footprint(cfg, stdout);
+    events_print_footprint(cfg, stdout);
+    printf("  flight recorder:  %d traces x %zu B\n",
+           cfg->flight_recorder, sizeof(FlightTrace));
+    stats_print_footprint(cfg, stdout);
+    printf("  process now:      VmRSS %ld KiB, VmHWM %ld KiB\n",
+           proc_status_kb("VmRSS"), proc_status_kb("VmHWM"));
+}
 
 int main(int argc, char **argv) {
     // Default config path
     const char *cfg_path = "ctftp.conf";
-    if (argc > 1) {
-        cfg_path = argv[1];
+    int footprint_only = 0;
+    int upgrade = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--print-footprint") == 0) {
+            footprint_only = 1;
+        } else if (strcmp(argv[i], "--upgrade") == 0) {
+            upgrade = 1;
+        } else {
+            cfg_path = argv[i];
+        }
     }
 
-    ServerConfig cfg;
+    // Loaded once; every module shares this copy read-only
+    static ServerConfig cfg;
 
     // Load configuration (use defaults if file is missing)
     if (load_config(cfg_path, &cfg) != 0) {
@@ -22,6 +51,12 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (footprint_only) {
+        print_footprint(&cfg, cfg_path);
+        free_config(&cfg);
+        return 0;
+    }
+
     // Initialize logger
     if (logger_init(&cfg) != 0) {
         fprintf(stderr, "Failed to init logger, using stderr only\n");
@@ -29,15 +64,22 @@ int main(int argc, char **argv) {
 
     log_msg(LOG_INFO, "ctftp starting with config: %s", cfg_path);
 
+    // Flight recorder first: it blocks SIGUSR1 before other threads exist
+    flight_init(&cfg);
+
     // Initialize event subsystem (UDP/HTTP)
     events_init(&cfg);
 
-    // Start TFTP listeners (blocks until process is killed)
-    int rc = tftp_start(&cfg);
+    log_msg(LOG_INFO, "Startup footprint: VmRSS %ld KiB, %d listeners",
+            proc_status_kb("VmRSS"), cfg.num_listeners);
+
+    // Start TFTP listeners (blocks until killed, or until replaced by --upgrade)
+    int rc = tftp_start(&cfg, upgrade);
 
     // Shutdown events and logger
     events_shutdown();
     logger_close();
+    free_config(&cfg);
 
     return (rc == 0) ? 0 : 1;
 }
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "netascii.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CONVERT_CHUNK (64 * 1024)
+
+size_t netascii_encode(const unsigned char *in, size_t n, unsigned char *out) {
+    unsigned char *o = out;
+    const unsigned char *end = in + n;
+
+    while (in < end) {
+        /* Copy runs without CR/LF in bulk; text files are mostly such runs */
+        const unsigned char *lf = memchr(in, '\n', (size_t)(end - in));
+        const unsigned char *cr = memchr(in, '\r', (size_t)((lf ? lf : end) - in));
+        const unsigned char *stop = cr ? cr : (lf ? lf : end);
+
+        size_t run = (size_t)(stop - in);
+        memcpy(o, in, run);
+        o += run;
+        in = stop;
+        if (in == end) break;
+
+        *o++ = '\r';
+        *o++ = (*in == '\n') ? '\n' : '\0';
+        in++;
+    }
+    return (size_t)(o - out);
+}
+
+size_t netascii_decode(NetasciiDecoder *d, const unsigned char *in, size_t n,
+                       unsigned char *out) {
+    unsigned char *o = out;
+
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = in[i];
+        if (d->pending_cr) {
+            d->pending_cr = 0;
+            if (c == '\n') { *o++ = '\n'; continue; }
+            *o++ = '\r';
+            if (c == '\0') continue;
+        }
+        if (c == '\r') {
+            d->pending_cr = 1;
+            continue;
+        }
+        *o++ = c;
+    }
+    return (size_t)(o - out);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+int netascii_convert_fd(int src_fd, int out_fd, long long *out_size) {
+    unsigned char *in = (unsigned char *)malloc(CONVERT_CHUNK);
+    unsigned char *out = (unsigned char *)malloc(2 * CONVERT_CHUNK);
+    long long total = 0;
+    off_t off = 0;
+
+    if (!in || !out) goto fail;
+
+    for (;;) {
+        ssize_t r = pread(src_fd, in, CONVERT_CHUNK, off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            goto fail;
+        }
+        if (r == 0) break;
+        off += r;
+
+        size_t olen = netascii_encode(in, (size_t)r, out);
+        if (write_all(out_fd, out, olen) != 0) goto fail;
+        total += (long long)olen;
+    }
+
+    free(in);
+    free(out);
+    *out_size = total;
+    return 0;
+
+fail:
+    free(in);
+    free(out);
+    return -1;
+}
+
+int netascii_convert_mem(const unsigned char *data, size_t len, int out_fd,
+                         long long *out_size) {
+    unsigned char *out = (unsigned char *)malloc(2 * CONVERT_CHUNK);
+    long long total = 0;
+
+    if (!out) return -1;
+
+    for (size_t off = 0; off < len; off += CONVERT_CHUNK) {
+        size_t n = len - off < CONVERT_CHUNK ? len - off : CONVERT_CHUNK;
+        size_t olen = netascii_encode(data + off, n, out);
+        if (write_all(out_fd, out, olen) != 0) {
+            free(out);
+            return -1;
+        }
+        total += (long long)olen;
+    }
+
+    free(out);
+    *out_size = total;
+    return 0;
+}
+
+static long long count_pairs(const unsigned char *data, size_t len) {
+    long long n = 0;
+    for (size_t i = 0; i < len; ++i) n += (data[i] == '\n' || data[i] == '\r');
+    return n;
+}
+
+long long netascii_size_fd(int src_fd) {
+    unsigned char *in = (unsigned char *)malloc(CONVERT_CHUNK);
+    long long total = 0;
+    off_t off = 0;
+
+    if (!in) return -1;
+    for (;;) {
+        ssize_t r = pread(src_fd, in, CONVERT_CHUNK, off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            free(in);
+            return -1;
+        }
+        if (r == 0) break;
+        off += r;
+        total += (long long)r + count_pairs(in, (size_t)r);
+    }
+    free(in);
+    return total;
+}
+
+long long netascii_size_mem(const unsigned char *data, size_t len) {
+    return (long long)len + count_pairs(data, len);
+}
+
+size_t netascii_stream_encode(NetasciiStream *st, const unsigned char *in, size_t n,
+                              unsigned char *out, size_t room) {
+    size_t o = 0, i = 0;
+    if (st->held >= 0 && room > 0) {
+        out[o++] = (unsigned char)st->held;
+        st->held = -1;
+    }
+    while (i < n && o < room) {
+        unsigned char c = in[i++];
+        if (c == '\n' || c == '\r') {
+            unsigned char second = (c == '\n') ? '\n' : '\0';
+            out[o++] = '\r';
+            if (o < room) out[o++] = second;
+            else st->held = second;
+        } else {
+            out[o++] = c;
+        }
+    }
+    st->in_off += (long long)i;
+    return o;
+}
@@ -0,0 +1,52 @@
+#ifndef NETASCII_H
+#define NETASCII_H
+
+#include <stddef.h>
+
+/*
+ * RFC 1350 netascii translation: LF is sent as CR LF and a bare CR as
+ * CR NUL. Encoding is stateless; decoding carries a pending CR across
+ * DATA blocks.
+ */
+
+/* out must hold 2*n bytes; returns bytes written */
+size_t netascii_encode(const unsigned char *in, size_t n, unsigned char *out);
+
+typedef struct {
+    int pending_cr;
+} NetasciiDecoder;
+
+/* out must hold n+1 bytes; returns bytes written */
+size_t netascii_decode(NetasciiDecoder *d, const unsigned char *in, size_t n,
+                       unsigned char *out);
+
+/*
+ * Convert the whole of src_fd, appending to the empty file out_fd.
+ * Returns 0 and the converted size in *out_size, or -1.
+ */
+int netascii_convert_fd(int src_fd, int out_fd, long long *out_size);
+
+/* Same, from a memory region (e.g. a file inside a mapped bundle) */
+int netascii_convert_mem(const unsigned char *data, size_t len, int out_fd,
+                         long long *out_size);
+
+/* Size of the rendering, without building it; -1 on read error */
+long long netascii_size_fd(int src_fd);
+long long netascii_size_mem(const unsigned char *data, size_t len);
+
+/*
+ * Encoding front to back in pieces, for renderings too large to keep. A
+ * CR LF or CR NUL pair cut by the end of out is finished by the next call.
+ */
+typedef struct {
+    long long in_size;  /* source length */
+    long long in_off;   /* source bytes consumed */
+    int held;           /* second byte of a cut pair, -1 if none */
+} NetasciiStream;
+
+/* Encode from in (n bytes at in_off) into up to room bytes of out; returns
+ * bytes written and advances in_off by the bytes consumed */
+size_t netascii_stream_encode(NetasciiStream *st, const unsigned char *in, size_t n,
+                              unsigned char *out, size_t room);
+
+#endif
@@ -0,0 +1,506 @@
+#include "origin.h"
+#include "logger.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define ORIGIN_HDR_MAX  16384
+#define ORIGIN_CHUNK    (64 * 1024)
+#define META_SUFFIX     ".ctftp-meta"
+
+typedef enum {
+    FETCH_PENDING = 0,      /* waiting for response headers */
+    FETCH_STREAMING,        /* 200: body is arriving in the temp file */
+    FETCH_DONE,             /* complete, renamed into the cache */
+    FETCH_NOT_MODIFIED,     /* 304: cached copy is current */
+    FETCH_NOT_FOUND,        /* 404/410 */
+    FETCH_FAILED
+} FetchState;
+
+struct OriginFetch {
+    char name[256];
+    char cache_path[PATH_MAX];
+    char etag[128];             /* ETag of the cached copy, "" if none */
+    int  has_cached;
+
+    pthread_mutex_t mu;
+    pthread_cond_t  cond;
+    FetchState state;
+    int  fd;                    /* temp file, then the cached file */
+    long long length;           /* Content-Length or -1 */
+    long long written;
+    int  refs;
+
+    struct OriginFetch *next;
+};
+
+static const ServerConfig *g_cfg = NULL;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static OriginFetch *g_flights = NULL;
+static unsigned long g_landed = 0;   /* flights that left g_flights */
+
+/* mkdir -p for the parent directories of path */
+static int make_parents(const char *path) {
+    char tmp[PATH_MAX];
+    safe_strcpy(tmp, sizeof(tmp), path);
+    for (char *p = tmp + 1; *p; ++p) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return 0;
+}
+
+static int read_meta(const char *cache_path, char *etag, size_t etag_size, time_t *fetched_at) {
+    char meta[PATH_MAX + 16];
+    snprintf(meta, sizeof(meta), "%s%s", cache_path, META_SUFFIX);
+    FILE *f = fopen(meta, "r");
+    if (!f) return -1;
+
+    char line[256];
+    long long t = 0;
+    int ok = 0;
+    if (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        safe_strcpy(etag, etag_size, line);
+        if (fgets(line, sizeof(line), f) && sscanf(line, "%lld", &t) == 1) ok = 1;
+    }
+    fclose(f);
+    *fetched_at = (time_t)t;
+    return ok ? 0 : -1;
+}
+
+static void write_meta(const char *cache_path, const char *etag) {
+    char meta[PATH_MAX + 16], tmp[PATH_MAX + 32];
+    snprintf(meta, sizeof(meta), "%s%s", cache_path, META_SUFFIX);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", meta);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fprintf(f, "%s\n%lld\n", etag, (long long)time(NULL));
+    if (fclose(f) != 0 || rename(tmp, meta) != 0) unlink(tmp);
+}
+
+static void drop_cached(const char *cache_path) {
+    char meta[PATH_MAX + 16];
+    snprintf(meta, sizeof(meta), "%s%s", cache_path, META_SUFFIX);
+    unlink(cache_path);
+    unlink(meta);
+}
+
+static int open_cached(const char *cache_path, OriginFile *out) {
+    out->fetch = NULL;
+    out->fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (out->fd < 0) return -1;
+    struct stat st;
+    out->size = (fstat(out->fd, &st) == 0) ? (long long)st.st_size : -1;
+    return 0;
+}
+
+/* Percent-encode everything but unreserved characters and '/' */
+static void url_encode(char *out, size_t size, const char *in) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t o = 0;
+    for (; *in && o + 4 < size; ++in) {
+        unsigned char c = (unsigned char)*in;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+            out[o++] = (char)c;
+        } else {
+            out[o++] = '%';
+            out[o++] = hex[c >> 4];
+            out[o++] = hex[c & 0xf];
+        }
+    }
+    out[o] = '\0';
+}
+
+static int origin_connect(void) {
+    struct addrinfo hints, *res = NULL;
+    char port_str[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_str, sizeof(port_str), "%d", g_cfg->origin_port);
+
+    int rc = getaddrinfo(g_cfg->origin_host, port_str, &hints, &res);
+    if (rc != 0 || !res) {
+        log_msg(LOG_ERROR, "origin: cannot resolve %s: %s", g_cfg->origin_host, gai_strerror(rc));
+        return -1;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (sock >= 0) {
+        struct timeval tv;
+        tv.tv_sec = g_cfg->origin_timeout_sec;
+        tv.tv_usec = 0;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+/* Value of header `name` in a NUL-terminated header block, copied to out */
+static int header_value(const char *hdrs, const char *name, char *out, size_t size) {
+    size_t nlen = strlen(name);
+    for (const char *line = strstr(hdrs, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':') {
+            const char *v = line + nlen + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t len = strcspn(v, "\r\n");
+            if (len >= size) len = size - 1;
+            memcpy(out, v, len);
+            out[len] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void fetch_set_state(OriginFetch *f, FetchState st) {
+    pthread_mutex_lock(&f->mu);
+    f->state = st;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mu);
+}
+
+static void fetch_unlist(OriginFetch *f) {
+    pthread_mutex_lock(&g_lock);
+    for (OriginFetch **pp = &g_flights; *pp; pp = &(*pp)->next) {
+        if (*pp == f) {
+            *pp = f->next;
+            __atomic_add_fetch(&g_landed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* Stream the response body into a temp file next to the cache entry */
+static FetchState fetch_body(OriginFetch *f, int sock, const unsigned char *extra, size_t extra_len,
+                             const char *etag) {
+    char tmp_path[PATH_MAX + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.ctftp-fetch-XXXXXX", f->cache_path);
+    int fd = (make_parents(f->cache_path) == 0) ? mkstemp(tmp_path) : -1;
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "origin: cannot create cache file for %s: %s", f->name, strerror(errno));
+        return FETCH_FAILED;
+    }
+
+    pthread_mutex_lock(&f->mu);
+    f->fd = fd;
+    f->state = FETCH_STREAMING;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mu);
+
+    unsigned char *buf = (unsigned char *)malloc(ORIGIN_CHUNK);
+    long long total = 0;
+    int ok = (buf != NULL);
+    const unsigned char *chunk = extra;
+    ssize_t n = (ssize_t)extra_len;
+
+    while (ok) {
+        if (n > 0) {
+            for (ssize_t off = 0; off < n; ) {
+                ssize_t w = pwrite(fd, chunk + off, (size_t)(n - off), (off_t)(total + off));
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0) { ok = 0; break; }
+                off += w;
+            }
+            if (!ok) break;
+            total += n;
+            pthread_mutex_lock(&f->mu);
+            f->written = total;
+            pthread_cond_broadcast(&f->cond);
+            pthread_mutex_unlock(&f->mu);
+        }
+        if (f->length >= 0 && total >= f->length) break;
+        n = recv(sock, buf, ORIGIN_CHUNK, 0);
+        if (n < 0 && errno == EINTR) { n = 0; continue; }
+        if (n < 0) ok = 0;
+        if (n == 0) break;
+        chunk = buf;
+    }
+    free(buf);
+
+    if (ok && f->length >= 0 && total != f->length) ok = 0;
+    if (!ok || fchmod(fd, 0644) != 0 || rename(tmp_path, f->cache_path) != 0) {
+        log_msg(LOG_ERROR, "origin: fetch of %s failed after %lld bytes", f->name, total);
+        unlink(tmp_path);
+        return FETCH_FAILED;
+    }
+    write_meta(f->cache_path, etag);
+    return FETCH_DONE;
+}
+
+static void *fetch_thread_main(void *arg) {
+    OriginFetch *f = (OriginFetch *)arg;
+    uint64_t t0 = mono_us();
+    FetchState result = FETCH_FAILED;
+
+    char path[1024];
+    url_encode(path, sizeof(path), f->name);
+
+    int sock = origin_connect();
+    if (sock < 0) {
+        log_msg(LOG_ERROR, "origin: cannot connect to %s:%d", g_cfg->origin_host, g_cfg->origin_port);
+        goto finish;
+    }
+
+    char req[2048];
+    int req_len = snprintf(req, sizeof(req),
+                           "GET %s%s HTTP/1.0\r\nHost: %s:%d\r\nUser-Agent: ctftp\r\n",
+                           g_cfg->origin_path, path, g_cfg->origin_host, g_cfg->origin_port);
+    if (f->has_cached && f->etag[0] && req_len < (int)sizeof(req)) {
+        req_len += snprintf(req + req_len, sizeof(req) - (size_t)req_len,
+                            "If-None-Match: %s\r\n", f->etag);
+    }
+    if (req_len < (int)sizeof(req)) {
+        req_len += snprintf(req + req_len, sizeof(req) - (size_t)req_len, "\r\n");
+    }
+    if (req_len >= (int)sizeof(req) || send(sock, req, (size_t)req_len, MSG_NOSIGNAL) != req_len) {
+        goto finish;
+    }
+
+    /* Read until the end of the headers */
+    char *hdr = (char *)malloc(ORIGIN_HDR_MAX + 1);
+    size_t have = 0;
+    char *body = NULL;
+    while (hdr && have < ORIGIN_HDR_MAX) {
+        ssize_t n = recv(sock, hdr + have, ORIGIN_HDR_MAX - have, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += (size_t)n;
+        hdr[have] = '\0';
+        if ((body = strstr(hdr, "\r\n\r\n")) != NULL) break;
+    }
+
+    int status = 0;
+    if (body && sscanf(hdr, "HTTP/%*d.%*d %d", &status) == 1) {
+        body[2] = '\0';   /* terminate the header block after the last CRLF */
+        body += 4;
+        size_t extra = have - (size_t)(body - hdr);
+
+        char etag[128] = "";
+        char clen[32];
+        header_value(hdr, "ETag", etag, sizeof(etag));
+        f->length = (header_value(hdr, "Content-Length", clen, sizeof(clen)) == 0)
+                    ? strtoll(clen, NULL, 10) : -1;
+
+        if (status == 200) {
+            result = fetch_body(f, sock, (const unsigned char *)body, extra, etag);
+        } else if (status == 304 && f->has_cached) {
+            write_meta(f->cache_path, etag[0] ? etag : f->etag);
+            result = FETCH_NOT_MODIFIED;
+        } else if (status == 404 || status == 410) {
+            if (f->has_cached) drop_cached(f->cache_path);
+            result = FETCH_NOT_FOUND;
+        } else {
+            log_msg(LOG_ERROR, "origin: HTTP %d for %s", status, f->name);
+        }
+    } else {
+        log_msg(LOG_ERROR, "origin: bad or missing response for %s", f->name);
+    }
+    free(hdr);
+
+finish:
+    if (sock >= 0) close(sock);
+    log_msg(LOG_INFO, "origin: %s -> %s, %lld bytes in %llu ms", f->name,
+            result == FETCH_DONE ? "fetched" : result == FETCH_NOT_MODIFIED ? "not modified" :
+            result == FETCH_NOT_FOUND ? "not found" : "failed",
+            result == FETCH_DONE ? f->written : 0LL,
+            (unsigned long long)((mono_us() - t0) / 1000));
+
+    /* Leave the table first so later misses see the updated cache */
+    fetch_unlist(f);
+    fetch_set_state(f, result);
+    origin_release(f);
+    return NULL;
+}
+
+void origin_release(OriginFetch *f) {
+    if (!f) return;
+    pthread_mutex_lock(&f->mu);
+    int last = (--f->refs == 0);
+    pthread_mutex_unlock(&f->mu);
+    if (last) {
+        if (f->fd >= 0) close(f->fd);
+        pthread_cond_destroy(&f->cond);
+        pthread_mutex_destroy(&f->mu);
+        free(f);
+    }
+}
+
+/* Wait for the response to a fetch and turn it into an OriginFile */
+static int fetch_join(OriginFetch *f, OriginFile *out) {
+    pthread_mutex_lock(&f->mu);
+    while (f->state == FETCH_PENDING) pthread_cond_wait(&f->cond, &f->mu);
+    FetchState st = f->state;
+    if (st == FETCH_STREAMING || st == FETCH_DONE) {
+        out->fd = fcntl(f->fd, F_DUPFD_CLOEXEC, 0);
+        out->size = (st == FETCH_DONE) ? f->written : f->length;
+    }
+    pthread_mutex_unlock(&f->mu);
+
+    /* The fetch thread may already have dropped its reference, so anything
+     * needed after origin_release() is copied first */
+    int has_cached = f->has_cached;
+    char cache_path[PATH_MAX];
+    safe_strcpy(cache_path, sizeof(cache_path), f->cache_path);
+
+    switch (st) {
+    case FETCH_STREAMING:
+        if (out->fd < 0) break;
+        out->fetch = f;     /* keeps the reference */
+        return 0;
+    case FETCH_DONE:
+        origin_release(f);
+        out->fetch = NULL;
+        return out->fd >= 0 ? 0 : -1;
+    case FETCH_NOT_MODIFIED:
+        origin_release(f);
+        return open_cached(cache_path, out);
+    case FETCH_NOT_FOUND:
+        origin_release(f);
+        errno = ENOENT;
+        return -1;
+    default:
+        break;
+    }
+
+    /* Origin unreachable or broken: a stale copy beats no copy */
+    origin_release(f);
+    if (has_cached && open_cached(cache_path, out) == 0) {
+        log_msg(LOG_INFO, "origin: serving stale cached copy of %s", cache_path);
+        return 0;
+    }
+    errno = EIO;
+    return -1;
+}
+
+int origin_open(const char *name, OriginFile *out) {
+    out->fd = -1;
+    out->size = -1;
+    out->fetch = NULL;
+
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, sizeof(cache_path), "%s/%s", g_cfg->origin_cache_dir, name);
+
+    /* The cache entry is read unlocked. A flight that lands meanwhile may
+     * have replaced it, so it is read again if one did. */
+    char etag[128];
+    int has_cached;
+    for (;;) {
+        unsigned long landed = __atomic_load_n(&g_landed, __ATOMIC_ACQUIRE);
+        etag[0] = '\0';
+        time_t fetched_at = 0;
+        struct stat st;
+        has_cached = (stat(cache_path, &st) == 0 &&
+                      read_meta(cache_path, etag, sizeof(etag), &fetched_at) == 0);
+        if (has_cached && time(NULL) - fetched_at < g_cfg->origin_ttl_sec) {
+            return open_cached(cache_path, out);
+        }
+
+        pthread_mutex_lock(&g_lock);
+        if (__atomic_load_n(&g_landed, __ATOMIC_ACQUIRE) == landed) break;
+        pthread_mutex_unlock(&g_lock);
+    }
+
+    for (OriginFetch *f = g_flights; f; f = f->next) {
+        if (strcmp(f->name, name) == 0) {
+            pthread_mutex_lock(&f->mu);
+            f->refs++;
+            pthread_mutex_unlock(&f->mu);
+            pthread_mutex_unlock(&g_lock);
+            return fetch_join(f, out);
+        }
+    }
+
+    OriginFetch *f = (OriginFetch *)calloc(1, sizeof(*f));
+    if (!f) {
+        pthread_mutex_unlock(&g_lock);
+        return has_cached ? open_cached(cache_path, out) : -1;
+    }
+    safe_strcpy(f->name, sizeof(f->name), name);
+    safe_strcpy(f->cache_path, sizeof(f->cache_path), cache_path);
+    safe_strcpy(f->etag, sizeof(f->etag), etag);
+    f->has_cached = has_cached;
+    f->fd = -1;
+    f->length = -1;
+    f->refs = 2;            /* this session + the fetch thread */
+    pthread_mutex_init(&f->mu, NULL);
+    pthread_cond_init(&f->cond, NULL);
+
+    pthread_t th;
+    if (thread_spawn(&th, fetch_thread_main, f,
+                     (size_t)g_cfg->thread_stack_kb * 1024, 1) != 0) {
+        pthread_mutex_unlock(&g_lock);
+        pthread_cond_destroy(&f->cond);
+        pthread_mutex_destroy(&f->mu);
+        free(f);
+        log_msg(LOG_ERROR, "origin: cannot start fetch thread");
+        return has_cached ? open_cached(cache_path, out) : -1;
+    }
+    f->next = g_flights;
+    g_flights = f;
+    pthread_mutex_unlock(&g_lock);
+
+    return fetch_join(f, out);
+}
+
+ssize_t origin_wait_bytes(OriginFetch *f, off_t off, size_t len) {
+    pthread_mutex_lock(&f->mu);
+    while (f->state == FETCH_STREAMING && f->written < (long long)off + (long long)len) {
+        pthread_cond_wait(&f->cond, &f->mu);
+    }
+    ssize_t avail = -1;
+    if (f->state != FETCH_FAILED) {
+        long long left = f->written - (long long)off;
+        if (left < 0) left = 0;
+        avail = (ssize_t)(left < (long long)len ? left : (long long)len);
+    }
+    pthread_mutex_unlock(&f->mu);
+    return avail;
+}
+
+int origin_wait_done(OriginFetch *f, long long *size) {
+    pthread_mutex_lock(&f->mu);
+    while (f->state == FETCH_STREAMING) pthread_cond_wait(&f->cond, &f->mu);
+    int ok = (f->state == FETCH_DONE);
+    *size = f->written;
+    pthread_mutex_unlock(&f->mu);
+    return ok ? 0 : -1;
+}
+
+int origin_init(const ServerConfig *cfg) {
+    g_cfg = cfg;
+    char probe[PATH_MAX];
+    snprintf(probe, sizeof(probe), "%s/", cfg->origin_cache_dir);
+    if (make_parents(probe) != 0) {
+        log_msg(LOG_ERROR, "origin: cannot create cache dir %s: %s",
+                cfg->origin_cache_dir, strerror(errno));
+        return -1;
+    }
+    log_msg(LOG_INFO, "origin: misses fetched from http://%s:%d%s, cache %s (ttl %ds)",
+            cfg->origin_host, cfg->origin_port, cfg->origin_path,
+            cfg->origin_cache_dir, cfg->origin_ttl_sec);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef ORIGIN_H
+#define ORIGIN_H
+
+#include "config.h"
+#include <sys/types.h>
+
+/*
+ * Read-through origin cache (origin_url=).
+ *
+ * Files missing from the local tree are fetched over HTTP into
+ * origin_cache_dir. A cached copy is served as-is for origin_ttl_sec, then
+ * revalidated with If-None-Match against its ETag. Concurrent misses for
+ * one name share a single upstream fetch (single-flight). Readers stream
+ * from the temp file while the fetch thread is still filling it, so the
+ * first client does not wait for the whole download.
+ */
+
+typedef struct OriginFetch OriginFetch;
+
+typedef struct {
+    int fd;                 /* readable fd: cached file or the growing temp file */
+    long long size;         /* -1 if unknown (streaming without Content-Length) */
+    OriginFetch *fetch;     /* non-NULL while still streaming; release when done */
+} OriginFile;
+
+int origin_init(const ServerConfig *cfg);
+
+/*
+ * Resolve name through the cache/origin. Returns 0 on success, or -1 with
+ * errno ENOENT (origin has no such file) or EIO (origin unreachable and
+ * nothing cached).
+ */
+int origin_open(const char *name, OriginFile *out);
+
+/*
+ * Wait until the bytes [off, off+len) exist or the fetch ends. Returns
+ * the number of bytes that can now be read at off (short only at the end
+ * of the file), or -1 if the fetch failed.
+ */
+ssize_t origin_wait_bytes(OriginFetch *f, off_t off, size_t len);
+
+/* Wait for the fetch to finish; returns 0 and the final size, or -1 */
+int origin_wait_done(OriginFetch *f, long long *size);
+
+void origin_release(OriginFetch *f);
+
+#endif
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include "sinks.h"
+#include "evcodec.h"
+#include "evring.h"
+#include "logger.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define SINK_DRAIN_MS 1000    /* bound on delivering the queues at shutdown */
+
+typedef struct Sink Sink;
+
+struct Sink {
+    SinkConfig cfg;
+    int format;            /* resolved EVFMT_* */
+    char name[512];        /* for log messages */
+
+    /* Shared-memory ring: published inline, no queue or worker */
+    EvRing ring;
+    int is_ring;
+
+    /* Bounded queue (ring of cap entries, head + count) */
+    Event *queue;
+    int head;
+    int count;
+    int stop;
+    uint64_t stop_deadline_us; /* on stop, the queue is drained until then */
+    int busy;              /* worker is delivering a popped batch */
+    unsigned long dropped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+
+    /* Transport state, owned by the worker */
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    unsigned char *buf;    /* batch * EVJSON_MAX_SIZE bytes of encode space */
+    struct mmsghdr *msgs;  /* datagram sinks: batch entries each */
+    struct iovec *iov;
+
+    void (*deliver)(Sink *sk, const Event *evs, int n);
+};
+
+static Sink *g_sinks = NULL;
+static int g_num_sinks = 0;
+
+/* Resolve host:port once; returns 0 and fills addr on success */
+static int resolve_sink(const char *host, int port, int socktype,
+                        struct sockaddr_storage *addr, socklen_t *addr_len) {
+    struct addrinfo hints, *res = NULL;
+    char port_str[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    int rc = getaddrinfo(host, port_str, &hints, &res);
+    if (rc != 0 || !res) {
+        log_msg(LOG_ERROR, "Failed to resolve event sink %s:%d: %s",
+                host, port, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* Encode event in the sink's format; returns payload length or 0 */
+static size_t encode_event(const Sink *sk, const Event *ev, unsigned char *out, size_t size) {
+    if (sk->format == EVFMT_BINARY) {
+        return evcodec_encode_bin(ev, out, size);
+    }
+    return evcodec_encode_json(ev, (char *)out, size);
+}
+
+/* (Re)connect a datagram socket to the sink address */
+static int dgram_connect(Sink *sk) {
+    if (sk->fd >= 0) return 0;
+    sk->fd = socket(sk->addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sk->fd < 0) return -1;
+    if (connect(sk->fd, (struct sockaddr *)&sk->addr, sk->addr_len) != 0) {
+        close(sk->fd);
+        sk->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* UDP and Unix datagram sinks: one datagram per event, one sendmmsg per batch */
+static void deliver_dgram(Sink *sk, const Event *evs, int n) {
+    if (dgram_connect(sk) != 0) return;
+
+    struct mmsghdr *msgs = sk->msgs;
+    struct iovec *iov = sk->iov;
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        unsigned char *out = sk->buf + (size_t)i * EVJSON_MAX_SIZE;
+        size_t len = encode_event(sk, &evs[i], out, EVJSON_MAX_SIZE);
+        if (len == 0) continue;
+        iov[m].iov_base = out;
+        iov[m].iov_len = len;
+        memset(&msgs[m], 0, sizeof(msgs[m]));
+        msgs[m].msg_hdr.msg_iov = &iov[m];
+        msgs[m].msg_hdr.msg_iovlen = 1;
+        m++;
+    }
+
+    int off = 0;
+    while (off < m) {
+        int r = sendmmsg(sk->fd, msgs + off, (unsigned int)(m - off), 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            /* Unix consumers come and go: reconnect on the next batch */
+            if (sk->cfg.type == SINK_UNIX) {
+                close(sk->fd);
+                sk->fd = -1;
+            }
+            return;
+        }
+        off += r;
+    }
+}
+
+/* File sink: JSON lines or concatenated binary records, one write per batch */
+static void deliver_file(Sink *sk, const Event *evs, int n) {
+    if (sk->fd < 0) return;
+
+    size_t pos = 0;
+    for (int i = 0; i < n; ++i) {
+        size_t len = encode_event(sk, &evs[i], sk->buf + pos, EVJSON_MAX_SIZE);
+        if (len == 0) continue;
+        pos += len;
+        if (sk->format == EVFMT_JSON) sk->buf[pos++] = '\n';
+    }
+
+    size_t off = 0;
+    while (off < pos) {
+        ssize_t w = write(sk->fd, sk->buf + off, pos - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            log_msg(LOG_ERROR, "Event sink %s write failed: %s", sk->name, strerror(errno));
+            return;
+        }
+        off += (size_t)w;
+    }
+}
+
+/* HTTP sink: one POST per batch (single object, JSON array or binary records) */
+static void deliver_http(Sink *sk, const Event *evs, int n) {
+    size_t pos = 0;
+    int json_array = (sk->format == EVFMT_JSON && n > 1);
+
+    if (json_array) sk->buf[pos++] = '[';
+    for (int i = 0; i < n; ++i) {
+        size_t len = encode_event(sk, &evs[i], sk->buf + pos, EVJSON_MAX_SIZE - 2);
+        if (len == 0) continue;
+        pos += len;
+        if (json_array) sk->buf[pos++] = ',';
+    }
+    if (json_array) {
+        if (pos == 1) return;
+        sk->buf[pos - 1] = ']';
+    }
+    if (pos == 0) return;
+
+    char header[512];
+    int hlen = snprintf(header, sizeof(header),
+                        "POST %s HTTP/1.1\r\n"
+                        "Host: %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n"
+                        "\r\n",
+                        sk->cfg.path[0] ? sk->cfg.path : "/",
+                        sk->cfg.host,
+                        sk->format == EVFMT_BINARY
+                            ? "application/x-ctftp-event" : "application/json",
+                        pos);
+    if (hlen <= 0 || (size_t)hlen >= sizeof(header)) return;
+
+    int sock = socket(sk->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return;
+
+    struct timeval tv;
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(sock, (struct sockaddr *)&sk->addr, sk->addr_len) != 0) {
+        close(sock);
+        return;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)hlen;
+    iov[1].iov_base = sk->buf;
+    iov[1].iov_len = pos;
+    ssize_t sent = writev(sock, iov, 2);
+    if (sent <= 0) {
+        close(sock);
+        return;
+    }
+
+    char rbuf[256];
+    while (recv(sock, rbuf, sizeof(rbuf), 0) > 0) {
+        /* ignore response */
+    }
+    close(sock);
+}
+
+/* Pop up to max events; returns count, or -1 once stopped and drained */
+static int sink_pop_batch(Sink *sk, Event *out, int max, unsigned long *dropped) {
+    pthread_mutex_lock(&sk->mutex);
+    while (!sk->stop && sk->count == 0) {
+        pthread_cond_wait(&sk->cond, &sk->mutex);
+    }
+    if (sk->stop && (sk->count == 0 || mono_us() >= sk->stop_deadline_us)) {
+        if (sk->count > 0) {
+            log_msg(LOG_ERROR, "Event sink %s: %d queued events dropped at shutdown",
+                    sk->name, sk->count);
+        }
+        pthread_mutex_unlock(&sk->mutex);
+        return -1;
+    }
+    int n = 0;
+    while (n < max && sk->count > 0) {
+        out[n++] = sk->queue[sk->head];
+        sk->head = (sk->head + 1) % sk->cfg.queue_cap;
+        sk->count--;
+    }
+    sk->busy = 1;
+    *dropped = sk->dropped;
+    pthread_mutex_unlock(&sk->mutex);
+    return n;
+}
+
+static void *sink_thread_main(void *arg) {
+    Sink *sk = (Sink *)arg;
+    Event *batch = (Event *)calloc((size_t)sk->cfg.batch, sizeof(Event));
+    if (!batch) return NULL;
+
+    unsigned long reported = 0;
+    unsigned long dropped = 0;
+    int n;
+    while ((n = sink_pop_batch(sk, batch, sk->cfg.batch, &dropped)) >= 0) {
+        sk->deliver(sk, batch, n);
+        pthread_mutex_lock(&sk->mutex);
+        sk->busy = 0;
+        pthread_mutex_unlock(&sk->mutex);
+        if (dropped != reported) {
+            log_msg(LOG_ERROR, "Event sink %s queue full, %lu events dropped so far",
+                    sk->name, dropped);
+            reported = dropped;
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+static int sink_open(Sink *sk) {
+    const SinkConfig *c = &sk->cfg;
+    sk->fd = -1;
+
+    switch (c->type) {
+    case SINK_UDP:
+        snprintf(sk->name, sizeof(sk->name), "udp://%s:%d", c->host, c->port);
+        if (resolve_sink(c->host, c->port, SOCK_DGRAM, &sk->addr, &sk->addr_len) != 0)
+            return -1;
+        if (dgram_connect(sk) != 0) {
+            log_msg(LOG_ERROR, "Failed to create UDP event socket: %s", strerror(errno));
+            return -1;
+        }
+        sk->deliver = deliver_dgram;
+        break;
+    case SINK_HTTP:
+        snprintf(sk->name, sizeof(sk->name), "http://%s:%d%s", c->host, c->port, c->path);
+        if (resolve_sink(c->host, c->port, SOCK_STREAM, &sk->addr, &sk->addr_len) != 0)
+            return -1;
+        sk->deliver = deliver_http;
+        break;
+    case SINK_UNIX: {
+        snprintf(sk->name, sizeof(sk->name), "unix://%s", c->path);
+        struct sockaddr_un *un = (struct sockaddr_un *)&sk->addr;
+        if (strlen(c->path) >= sizeof(un->sun_path)) return -1;
+        memset(un, 0, sizeof(*un));
+        un->sun_family = AF_UNIX;
+        safe_strcpy(un->sun_path, sizeof(un->sun_path), c->path);
+        sk->addr_len = sizeof(*un);
+        /* Consumer may not be up yet; connect lazily */
+        dgram_connect(sk);
+        sk->deliver = deliver_dgram;
+        break;
+    }
+    case SINK_FILE:
+        snprintf(sk->name, sizeof(sk->name), "file://%s", c->path);
+        sk->fd = open(c->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (sk->fd < 0) {
+            log_msg(LOG_ERROR, "Failed to open event file %s: %s", c->path, strerror(errno));
+            return -1;
+        }
+        sk->deliver = deliver_file;
+        break;
+    case SINK_SHM:
+        snprintf(sk->name, sizeof(sk->name), "shm://%s", c->path);
+        if (evring_create(&sk->ring, c->path, (uint32_t)c->slots) != 0) {
+            log_msg(LOG_ERROR, "Failed to create event ring %s: %s", c->path, strerror(errno));
+            return -1;
+        }
+        sk->is_ring = 1;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+int sinks_init(const ServerConfig *cfg) {
+    if (cfg->num_sinks == 0) return 0;
+
+    g_sinks = (Sink *)calloc((size_t)cfg->num_sinks, sizeof(Sink));
+    if (!g_sinks) return -1;
+    size_t stack_size = (size_t)cfg->thread_stack_kb * 1024;
+
+    for (int i = 0; i < cfg->num_sinks; ++i) {
+        Sink *sk = &g_sinks[g_num_sinks];
+        memset(sk, 0, sizeof(*sk));
+        sk->cfg = cfg->sinks[i];
+        sk->format = (sk->cfg.format >= 0) ? sk->cfg.format : cfg->event_format;
+
+        if (sink_open(sk) != 0) {
+            log_msg(LOG_ERROR, "Event sink %s disabled", sk->name);
+            if (sk->fd >= 0) close(sk->fd);
+            continue;
+        }
+        if (sk->is_ring) {
+            log_msg(LOG_INFO, "Event sink %s (slots=%d)", sk->name, sk->cfg.slots);
+            g_num_sinks++;
+            continue;
+        }
+
+        sk->queue = (Event *)calloc((size_t)sk->cfg.queue_cap, sizeof(Event));
+        sk->buf = (unsigned char *)malloc((size_t)sk->cfg.batch * EVJSON_MAX_SIZE + 2);
+        int dgram = (sk->cfg.type == SINK_UDP || sk->cfg.type == SINK_UNIX);
+        if (dgram) {
+            sk->msgs = (struct mmsghdr *)calloc((size_t)sk->cfg.batch, sizeof(struct mmsghdr));
+            sk->iov = (struct iovec *)calloc((size_t)sk->cfg.batch, sizeof(struct iovec));
+        }
+        if (!sk->queue || !sk->buf || (dgram && (!sk->msgs || !sk->iov))) {
+            free(sk->queue);
+            free(sk->buf);
+            free(sk->msgs);
+            free(sk->iov);
+            if (sk->fd >= 0) close(sk->fd);
+            continue;
+        }
+        pthread_mutex_init(&sk->mutex, NULL);
+        pthread_cond_init(&sk->cond, NULL);
+
+        if (thread_spawn(&sk->thread, sink_thread_main, sk, stack_size, 0) != 0) {
+            log_msg(LOG_ERROR, "Failed to start event sink thread for %s", sk->name);
+            free(sk->queue);
+            free(sk->buf);
+            free(sk->msgs);
+            free(sk->iov);
+            if (sk->fd >= 0) close(sk->fd);
+            continue;
+        }
+        sk->thread_started = 1;
+        log_msg(LOG_INFO, "Event sink %s (queue=%d batch=%d drop=%s)",
+                sk->name, sk->cfg.queue_cap, sk->cfg.batch,
+                sk->cfg.drop_newest ? "newest" : "oldest");
+        g_num_sinks++;
+    }
+    return 0;
+}
+
+void sinks_shutdown(void) {
+    /* Workers deliver what is still queued, for a bounded time */
+    uint64_t deadline = mono_us() + SINK_DRAIN_MS * 1000ULL;
+    for (int i = 0; i < g_num_sinks; ++i) {
+        Sink *sk = &g_sinks[i];
+        if (sk->is_ring) continue;
+        pthread_mutex_lock(&sk->mutex);
+        sk->stop = 1;
+        sk->stop_deadline_us = deadline;
+        pthread_cond_broadcast(&sk->cond);
+        pthread_mutex_unlock(&sk->mutex);
+    }
+    for (int i = 0; i < g_num_sinks; ++i) {
+        Sink *sk = &g_sinks[i];
+        if (sk->is_ring) {
+            evring_close(&sk->ring);
+            continue;
+        }
+        if (sk->thread_started) pthread_join(sk->thread, NULL);
+        if (sk->fd >= 0) close(sk->fd);
+        free(sk->queue);
+        free(sk->buf);
+        free(sk->msgs);
+        free(sk->iov);
+        pthread_mutex_destroy(&sk->mutex);
+        pthread_cond_destroy(&sk->cond);
+    }
+    free(g_sinks);
+    g_sinks = NULL;
+    g_num_sinks = 0;
+}
+
+void sinks_flush(int timeout_ms) {
+    uint64_t deadline = mono_us() + (uint64_t)timeout_ms * 1000;
+    for (int i = 0; i < g_num_sinks; ++i) {
+        Sink *sk = &g_sinks[i];
+        if (sk->is_ring || !sk->thread_started) continue;
+        for (;;) {
+            pthread_mutex_lock(&sk->mutex);
+            int idle = (sk->count == 0 && !sk->busy);
+            pthread_mutex_unlock(&sk->mutex);
+            if (idle || mono_us() >= deadline) break;
+            usleep(10000);
+        }
+    }
+}
+
+void sinks_publish(const Event *ev) {
+    for (int i = 0; i < g_num_sinks; ++i) {
+        Sink *sk = &g_sinks[i];
+        if (sk->is_ring) {
+            evring_publish(&sk->ring, ev);
+            continue;
+        }
+        pthread_mutex_lock(&sk->mutex);
+        if (sk->count == sk->cfg.queue_cap) {
+            sk->dropped++;
+            if (sk->cfg.drop_newest) {
+                pthread_mutex_unlock(&sk->mutex);
+                continue;
+            }
+            /* drop oldest */
+            sk->head = (sk->head + 1) % sk->cfg.queue_cap;
+            sk->count--;
+        }
+        int tail = (sk->head + sk->count) % sk->cfg.queue_cap;
+        sk->queue[tail] = *ev;
+        sk->count++;
+        pthread_cond_signal(&sk->cond);
+        pthread_mutex_unlock(&sk->mutex);
+    }
+}
+
+void sinks_print_footprint(const ServerConfig *cfg, FILE *out) {
+    size_t stack = (size_t)cfg->thread_stack_kb * 1024;
+    for (int i = 0; i < cfg->num_sinks; ++i) {
+        const SinkConfig *c = &cfg->sinks[i];
+        if (c->type == SINK_SHM) {
+            size_t ring = sizeof(EvRingHeader) + (size_t)c->slots * sizeof(EvRingSlot);
+            fprintf(out, "  sink %d (shm):     %zu KiB shared mapping, no thread\n",
+                    i, ring / 1024);
+            continue;
+        }
+        size_t queue = (size_t)c->queue_cap * sizeof(Event);
+        size_t batch = (size_t)c->batch * (sizeof(Event) + EVJSON_MAX_SIZE);
+        fprintf(out, "  sink %d:           queue %zu KiB + batch %zu KiB + stack %zu KiB\n",
+                i, queue / 1024, batch / 1024, stack / 1024);
+    }
+}
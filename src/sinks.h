@@ -0,0 +1,25 @@
+#ifndef SINKS_H
+#define SINKS_H
+
+#include "config.h"
+#include "events.h"
+#include <stdio.h>
+
+/*
+ * Event sinks. Each configured sink owns a bounded queue and a worker
+ * thread, so a slow or dead collector only ever fills its own queue.
+ */
+
+int sinks_init(const ServerConfig *cfg);
+void sinks_shutdown(void);
+
+/* Wait up to timeout_ms for every queue to be delivered; tears nothing down */
+void sinks_flush(int timeout_ms);
+
+/* Non-blocking: enqueue on every sink, applying each sink's drop policy */
+void sinks_publish(const Event *ev);
+
+/* Memory budget of the configured sinks */
+void sinks_print_footprint(const ServerConfig *cfg, FILE *out);
+
+#endif
@@ -0,0 +1,536 @@
+#include "stats.h"
+#include "evcodec.h"
+#include "logger.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define STATS_SHARDS       16
+#define STATS_LAT_BUCKETS  18     /* <=1 ms, <=2 ms, ... <=65.5 s, more */
+#define STATS_DEFAULT_TOP  10
+#define STATS_MAX_REQUEST  2048
+
+typedef struct {
+    char     key[256];
+    uint64_t hash;
+    uint64_t requests;
+    uint64_t overcount;   /* requests inherited from the entry it replaced */
+    uint64_t bytes;
+    uint64_t errors;
+    uint32_t lat[STATS_LAT_BUCKETS];
+    int32_t  next;        /* hash chain, -1 = end */
+} StatsEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    StatsEntry *entries;
+    int32_t *heads;
+    int count;
+    int cap;
+    int nbuckets;
+} StatsShard;
+
+typedef struct {
+    StatsShard shards[STATS_SHARDS];
+} StatsTable;
+
+static const ServerConfig *g_cfg = NULL;
+static int g_enabled = 0;
+static StatsTable g_files;
+static StatsTable g_clients;
+static time_t g_started;
+
+/* Totals are exact even when entries are evicted */
+static uint64_t g_requests = 0;
+static uint64_t g_bytes = 0;
+static uint64_t g_errors = 0;
+
+static uint64_t stats_hash(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int shard_entries(const ServerConfig *cfg) {
+    int n = cfg->stats_entries / STATS_SHARDS;
+    return n < 4 ? 4 : n;
+}
+
+static int table_init(StatsTable *t, int per_shard) {
+    for (int i = 0; i < STATS_SHARDS; ++i) {
+        StatsShard *sh = &t->shards[i];
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->cap = per_shard;
+        sh->nbuckets = per_shard * 2;
+        sh->entries = (StatsEntry *)calloc((size_t)sh->cap, sizeof(StatsEntry));
+        sh->heads = (int32_t *)malloc((size_t)sh->nbuckets * sizeof(int32_t));
+        if (!sh->entries || !sh->heads) return -1;
+        for (int b = 0; b < sh->nbuckets; ++b) sh->heads[b] = -1;
+    }
+    return 0;
+}
+
+static void chain_unlink(StatsShard *sh, int32_t idx) {
+    int32_t *p = &sh->heads[(sh->entries[idx].hash >> 4) % (uint64_t)sh->nbuckets];
+    while (*p != idx) p = &sh->entries[*p].next;
+    *p = sh->entries[idx].next;
+}
+
+/* Find key in a locked shard, or take a slot for it */
+static StatsEntry *shard_slot(StatsShard *sh, const char *key, uint64_t h) {
+    int32_t *head = &sh->heads[(h >> 4) % (uint64_t)sh->nbuckets];
+    for (int32_t i = *head; i >= 0; i = sh->entries[i].next) {
+        StatsEntry *e = &sh->entries[i];
+        if (e->hash == h && strcmp(e->key, key) == 0) return e;
+    }
+
+    int32_t idx;
+    uint64_t inherited = 0;
+    if (sh->count < sh->cap) {
+        idx = sh->count++;
+    } else {
+        /* Space-saving: replace the least-requested entry and inherit its
+         * count, which bounds how much the newcomer may be overcounted */
+        idx = 0;
+        for (int32_t i = 1; i < sh->count; ++i) {
+            if (sh->entries[i].requests < sh->entries[idx].requests) idx = i;
+        }
+        inherited = sh->entries[idx].requests;
+        chain_unlink(sh, idx);
+        head = &sh->heads[(h >> 4) % (uint64_t)sh->nbuckets];
+    }
+
+    StatsEntry *e = &sh->entries[idx];
+    memset(e, 0, sizeof(*e));
+    safe_strcpy(e->key, sizeof(e->key), key);
+    e->hash = h;
+    e->requests = inherited;
+    e->overcount = inherited;
+    e->next = *head;
+    *head = idx;
+    return e;
+}
+
+static int latency_bucket(uint32_t total_us) {
+    uint32_t ms = (total_us + 999) / 1000;
+    int b = 0;
+    while (b < STATS_LAT_BUCKETS - 1 && ms > (1u << b)) b++;
+    return b;
+}
+
+static void table_record(StatsTable *t, const char *key, const Event *ev, int error, int bucket) {
+    uint64_t h = stats_hash(key);
+    StatsShard *sh = &t->shards[h & (STATS_SHARDS - 1)];
+
+    pthread_mutex_lock(&sh->lock);
+    StatsEntry *e = shard_slot(sh, key, h);
+    e->requests++;
+    e->bytes += ev->bytes;
+    if (error) e->errors++;
+    e->lat[bucket]++;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+void stats_record(const Event *ev) {
+    if (!g_enabled) return;
+    int error = strcmp(ev->status, "ok") != 0;
+    int bucket = latency_bucket(ev->timing.total_us);
+
+    __atomic_add_fetch(&g_requests, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_bytes, (uint64_t)ev->bytes, __ATOMIC_RELAXED);
+    if (error) __atomic_add_fetch(&g_errors, 1, __ATOMIC_RELAXED);
+
+    table_record(&g_files, ev->filename[0] ? ev->filename : "-", ev, error, bucket);
+    table_record(&g_clients, ev->client_ip, ev, error, bucket);
+}
+
+/* ---- Queries ---- */
+
+typedef enum { BY_REQUESTS, BY_BYTES, BY_ERRORS } SortKey;
+
+static SortKey g_sort_key;   /* only the stats thread sorts */
+
+static uint64_t sort_value(const StatsEntry *e) {
+    switch (g_sort_key) {
+    case BY_BYTES:  return e->bytes;
+    case BY_ERRORS: return e->errors;
+    default:        return e->requests;
+    }
+}
+
+static int by_value_desc(const void *a, const void *b) {
+    uint64_t va = sort_value((const StatsEntry *)a), vb = sort_value((const StatsEntry *)b);
+    if (va != vb) return (va < vb) ? 1 : -1;
+    return strcmp(((const StatsEntry *)a)->key, ((const StatsEntry *)b)->key);
+}
+
+/* Copy every entry of a table; the caller frees the result */
+static StatsEntry *table_snapshot(StatsTable *t, int *count) {
+    int total = 0;
+    for (int i = 0; i < STATS_SHARDS; ++i) total += t->shards[i].cap;
+    StatsEntry *all = (StatsEntry *)malloc((size_t)total * sizeof(StatsEntry));
+    *count = 0;
+    if (!all) return NULL;
+    for (int i = 0; i < STATS_SHARDS; ++i) {
+        StatsShard *sh = &t->shards[i];
+        pthread_mutex_lock(&sh->lock);
+        memcpy(all + *count, sh->entries, (size_t)sh->count * sizeof(StatsEntry));
+        *count += sh->count;
+        pthread_mutex_unlock(&sh->lock);
+    }
+    return all;
+}
+
+static int table_get(StatsTable *t, const char *key, StatsEntry *out) {
+    uint64_t h = stats_hash(key);
+    StatsShard *sh = &t->shards[h & (STATS_SHARDS - 1)];
+    int found = 0;
+    pthread_mutex_lock(&sh->lock);
+    for (int32_t i = sh->heads[(h >> 4) % (uint64_t)sh->nbuckets]; i >= 0; i = sh->entries[i].next) {
+        if (sh->entries[i].hash == h && strcmp(sh->entries[i].key, key) == 0) {
+            *out = sh->entries[i];
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return found;
+}
+
+/* Upper bound (ms) of the bucket holding the q-th quantile; -1 = above range */
+static long latency_quantile(const StatsEntry *e, double q) {
+    uint64_t n = 0;
+    for (int b = 0; b < STATS_LAT_BUCKETS; ++b) n += e->lat[b];
+    if (n == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)n + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_LAT_BUCKETS; ++b) {
+        seen += e->lat[b];
+        if (seen >= rank) return b == STATS_LAT_BUCKETS - 1 ? -1 : (1L << b);
+    }
+    return -1;
+}
+
+static void put_str(FILE *f, const char *s) {
+    char buf[256 * 6 + 3];
+    size_t n = json_put_str(buf, sizeof(buf), 0, s);
+    fwrite(buf, 1, n < sizeof(buf) ? n : sizeof(buf), f);
+}
+
+static void put_entry(FILE *f, const StatsEntry *e) {
+    fputs("{\"key\":", f);
+    put_str(f, e->key);
+    fprintf(f, ",\"requests\":%llu,\"overcount\":%llu,\"bytes\":%llu,\"errors\":%llu",
+            (unsigned long long)e->requests, (unsigned long long)e->overcount,
+            (unsigned long long)e->bytes, (unsigned long long)e->errors);
+    fprintf(f, ",\"latency_ms\":{\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"buckets\":[",
+            latency_quantile(e, 0.50), latency_quantile(e, 0.90), latency_quantile(e, 0.99));
+    for (int b = 0; b < STATS_LAT_BUCKETS; ++b) {
+        fprintf(f, "%s%u", b ? "," : "", e->lat[b]);
+    }
+    fputs("]}}", f);
+}
+
+static void put_top(FILE *f, StatsTable *t, int top, SortKey by) {
+    int n = 0;
+    StatsEntry *all = table_snapshot(t, &n);
+    g_sort_key = by;
+    if (all) qsort(all, (size_t)n, sizeof(StatsEntry), by_value_desc);
+    fputc('[', f);
+    for (int i = 0; i < n && i < top; ++i) {
+        if (i) fputc(',', f);
+        put_entry(f, &all[i]);
+    }
+    fputc(']', f);
+    free(all);
+}
+
+static void put_summary(FILE *f) {
+    fprintf(f, "{\"uptime_sec\":%lld,\"requests\":%llu,\"bytes\":%llu,\"errors\":%llu,"
+               "\"latency_buckets_ms\":[",
+            (long long)(time(NULL) - g_started),
+            (unsigned long long)__atomic_load_n(&g_requests, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&g_bytes, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&g_errors, __ATOMIC_RELAXED));
+    for (int b = 0; b < STATS_LAT_BUCKETS - 1; ++b) fprintf(f, "%s%ld", b ? "," : "", 1L << b);
+    fputs(",null],\"files\":", f);
+    put_top(f, &g_files, STATS_DEFAULT_TOP, BY_REQUESTS);
+    fputs(",\"clients\":", f);
+    put_top(f, &g_clients, STATS_DEFAULT_TOP, BY_REQUESTS);
+    fputc('}', f);
+}
+
+/* Decode %XX escapes in place */
+static void url_decode(char *s) {
+    char *o = s;
+    for (; *s; ++s) {
+        if (s[0] == '%' && s[1] && s[2]) {
+            char hex[3] = { s[1], s[2], 0 };
+            char *end;
+            long v = strtol(hex, &end, 16);
+            if (*end == '\0') {
+                *o++ = (char)v;
+                s += 2;
+                continue;
+            }
+        }
+        *o++ = *s;
+    }
+    *o = '\0';
+}
+
+/* Value of name= in a query string, or NULL */
+static const char *query_param(char *query, const char *name, char *out, size_t size) {
+    size_t nlen = strlen(name);
+    for (char *p = query; p && *p; ) {
+        char *amp = strchr(p, '&');
+        size_t len = amp ? (size_t)(amp - p) : strlen(p);
+        if (len > nlen && strncmp(p, name, nlen) == 0 && p[nlen] == '=') {
+            size_t vlen = len - nlen - 1;
+            if (vlen >= size) vlen = size - 1;
+            memcpy(out, p + nlen + 1, vlen);
+            out[vlen] = '\0';
+            return out;
+        }
+        p = amp ? amp + 1 : NULL;
+    }
+    return NULL;
+}
+
+/* Route one request; returns the HTTP status and fills body */
+static int stats_route(char *target, FILE *body) {
+    char *query = strchr(target, '?');
+    if (query) *query++ = '\0';
+
+    StatsTable *t = NULL;
+    const char *rest = NULL;
+    if (strcmp(target, "/stats") == 0 || strcmp(target, "/stats/") == 0) {
+        put_summary(body);
+        return 200;
+    } else if (starts_with(target, "/stats/files")) {
+        t = &g_files;
+        rest = target + 12;
+    } else if (starts_with(target, "/stats/clients")) {
+        t = &g_clients;
+        rest = target + 14;
+    } else {
+        fputs("{\"error\":\"not found\"}", body);
+        return 404;
+    }
+
+    if (*rest == '/' && rest[1] != '\0') {
+        /* One entry: /stats/files/<name>, /stats/clients/<ip> */
+        char key[256];
+        safe_strcpy(key, sizeof(key), rest + 1);
+        url_decode(key);
+        StatsEntry e;
+        if (!table_get(t, key, &e)) {
+            fputs("{\"error\":\"no such entry\"}", body);
+            return 404;
+        }
+        put_entry(body, &e);
+        return 200;
+    }
+    if (*rest != '\0' && strcmp(rest, "/") != 0) {
+        fputs("{\"error\":\"not found\"}", body);
+        return 404;
+    }
+
+    char val[32];
+    int top = STATS_DEFAULT_TOP;
+    SortKey by = BY_REQUESTS;
+    if (query_param(query, "top", val, sizeof(val)) && parse_int(val, &top) != 0) top = -1;
+    if (query_param(query, "by", val, sizeof(val))) {
+        if (strcmp(val, "bytes") == 0) by = BY_BYTES;
+        else if (strcmp(val, "errors") == 0) by = BY_ERRORS;
+        else if (strcmp(val, "requests") != 0) top = -1;
+    }
+    if (top < 0) {
+        fputs("{\"error\":\"bad query\"}", body);
+        return 400;
+    }
+    put_top(body, t, top, by);
+    return 200;
+}
+
+static void stats_serve_conn(int c) {
+    struct timeval tv = { 2, 0 };
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char req[STATS_MAX_REQUEST + 1];
+    size_t len = 0;
+    while (len < STATS_MAX_REQUEST) {
+        ssize_t r = recv(c, req + len, STATS_MAX_REQUEST - len, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        len += (size_t)r;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+    req[len] = '\0';
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *f = open_memstream(&body, &body_len);
+    if (!f) return;
+
+    int status;
+    char method[8], target[512];
+    if (sscanf(req, "%7s %511s", method, target) != 2) {
+        fputs("{\"error\":\"bad request\"}", f);
+        status = 400;
+    } else if (strcmp(method, "GET") != 0) {
+        fputs("{\"error\":\"method not allowed\"}", f);
+        status = 405;
+    } else {
+        status = stats_route(target, f);
+    }
+    fputc('\n', f);
+    fclose(f);
+
+    const char *reason = status == 200 ? "OK" : status == 404 ? "Not Found"
+                       : status == 405 ? "Method Not Allowed" : "Bad Request";
+    char hdr[160];
+    int hlen = snprintf(hdr, sizeof(hdr),
+                        "HTTP/1.0 %d %s\r\nContent-Type: application/json\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                        status, reason, body_len);
+    if (send(c, hdr, (size_t)hlen, MSG_NOSIGNAL) == hlen) {
+        size_t off = 0;
+        while (off < body_len) {
+            ssize_t w = send(c, body + off, body_len - off, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            off += (size_t)w;
+        }
+    }
+    free(body);
+}
+
+static void *stats_thread_main(void *arg) {
+    int ls = *(int *)arg;
+    free(arg);
+    for (;;) {
+        int c = accept(ls, NULL, NULL);
+        if (c < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            log_msg(LOG_ERROR, "stats: accept failed: %s", strerror(errno));
+            sleep(1);
+            continue;
+        }
+        stats_serve_conn(c);
+        close(c);
+    }
+    return NULL;
+}
+
+/* "ip:port" or "unix:/path" */
+static int stats_open_listener(const char *spec) {
+    int s;
+    if (starts_with(spec, "unix:")) {
+        const char *path = spec + 5;
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(un.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        safe_strcpy(un.sun_path, sizeof(un.sun_path), path);
+        s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s < 0) return -1;
+        unlink(path);
+        if (bind(s, (struct sockaddr *)&un, sizeof(un)) != 0) goto fail;
+    } else {
+        char host[64];
+        safe_strcpy(host, sizeof(host), spec);
+        char *colon = strrchr(host, ':');
+        int port;
+        struct sockaddr_in in;
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        if (!colon || parse_int(colon + 1, &port) != 0 || port <= 0 || port > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+        *colon = '\0';
+        if (inet_pton(AF_INET, host, &in.sin_addr) != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+        in.sin_port = htons((uint16_t)port);
+        s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (s < 0) return -1;
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        /* A process taking over via --upgrade binds while the old one drains */
+        setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (bind(s, (struct sockaddr *)&in, sizeof(in)) != 0) goto fail;
+    }
+    if (listen(s, 16) != 0) goto fail;
+    return s;
+
+fail:;
+    int e = errno;
+    close(s);
+    errno = e;
+    return -1;
+}
+
+int stats_init(const ServerConfig *cfg) {
+    g_cfg = cfg;
+    if (!cfg->stats_listen) return 0;
+
+    int per_shard = shard_entries(cfg);
+    if (table_init(&g_files, per_shard) != 0 || table_init(&g_clients, per_shard) != 0) {
+        log_msg(LOG_ERROR, "stats: out of memory");
+        return -1;
+    }
+    g_started = time(NULL);
+
+    int *ls = (int *)malloc(sizeof(int));
+    if (!ls) return -1;
+    *ls = stats_open_listener(cfg->stats_listen);
+    if (*ls < 0) {
+        log_msg(LOG_ERROR, "stats: cannot listen on %s: %s", cfg->stats_listen, strerror(errno));
+        free(ls);
+        return -1;
+    }
+
+    g_enabled = 1;
+    pthread_t th;
+    if (thread_spawn(&th, stats_thread_main, ls, (size_t)cfg->thread_stack_kb * 1024, 1) != 0) {
+        log_msg(LOG_ERROR, "stats: cannot start thread");
+        close(*ls);
+        free(ls);
+        g_enabled = 0;
+        return -1;
+    }
+    log_msg(LOG_INFO, "stats: serving on %s (%d entries per table)",
+            cfg->stats_listen, per_shard * STATS_SHARDS);
+    return 0;
+}
+
+void stats_print_footprint(const ServerConfig *cfg, FILE *out) {
+    if (!cfg->stats_listen) return;
+    size_t per_table = (size_t)shard_entries(cfg) * STATS_SHARDS *
+                       (sizeof(StatsEntry) + 2 * sizeof(int32_t));
+    fprintf(out, "  stats tables:     2 x %zu KiB (%d entries each)\n",
+            per_table / 1024, shard_entries(cfg) * STATS_SHARDS);
+}
@@ -0,0 +1,27 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "config.h"
+#include "events.h"
+#include <stdio.h>
+
+/*
+ * Aggregated transfer statistics per filename and per client address:
+ * requests, bytes, errors and a latency histogram. Each table is split
+ * into shards with their own lock and a bounded number of entries. When a
+ * shard is full, its least-requested entry is replaced (space-saving), so
+ * memory stays fixed while the heavy hitters are kept with exact counts
+ * plus a known overcount.
+ *
+ * stats_listen= serves the tables as JSON over a minimal HTTP/1.0
+ * endpoint on a TCP address or a Unix socket.
+ */
+
+int stats_init(const ServerConfig *cfg);
+
+/* Account a finished session (completion or error event) */
+void stats_record(const Event *ev);
+
+void stats_print_footprint(const ServerConfig *cfg, FILE *out);
+
+#endif
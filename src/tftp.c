@@ -1,7 +1,22 @@
+#define _GNU_SOURCE
 #include "tftp.h"
 #include "logger.h"
 #include "events.h"
 #include "util.h"
+#include "uring.h"
+#include "netascii.h"
+#include "fcache.h"
+#include "flight.h"
+#include "bundle.h"
+#include "origin.h"
+#include "warm.h"
+#include "xfer.h"
+#include "transport.h"
+#include "acl.h"
+#include "stats.h"
+#include "handoff.h"
+#include "xdp.h"
+#include "gunzip.h"
 
 #include <pthread.h>
 #include <stdlib.h>
@@ -11,34 +26,127 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <time.h>
 #include <limits.h>
+#include <strings.h>
 
-#define TFTP_OPCODE_RRQ  1
-#define TFTP_OPCODE_WRQ  2
-#define TFTP_OPCODE_DATA 3
-#define TFTP_OPCODE_ACK  4
-#define TFTP_OPCODE_ERR  5
-
-#define TFTP_DATA_SIZE   512
+#define TFTP_DATA_SIZE   512    /* default block size (RFC 1350) */
+#define TFTP_MIN_BLKSIZE 8      /* RFC 2348 limits */
+#define TFTP_MAX_BLKSIZE 65464
 
 typedef struct {
     char bind_addr[64];
     int  bind_port;
-} ListenerArg;
+    int  sock;
+    const AclScope *acl;   /* NULL = no acl= rule applies */
+} Listener;
+
+/* Options requested by the client (RFC 2347/2348/2349); 0 = not requested */
+typedef struct {
+    int  blksize;
+    int  timeout;
+    int  has_tsize;
+    long long tsize;   /* client-announced size (WRQ) */
+} TftpOptions;
 
 typedef struct {
     char bind_addr[64];
     int  bind_port;
     char client_ip[64];
     int  client_port;
+    int  opcode;       /* TFTP_OPCODE_RRQ or TFTP_OPCODE_WRQ */
     char filename[256];
+    char mode[32];
+    TftpOptions opts;
+    uint64_t rx_us;    /* monotonic receipt time of the request */
 } SessionArg;
 
-static ServerConfig g_cfg;
+/* Per-session transfer state shared by the read and write paths */
+typedef struct {
+    SessionArg *sa;
+    int  sock;
+    struct sockaddr_in cli;
+    int  blksize;
+    int  timeout_sec;
+    int  netascii;         /* mode "netascii" (RFC 1350) */
+    size_t total_bytes;
+    uint16_t last_block;   /* final block of a completed upload */
+    Event ev;
+
+    /* Stage clock for ev.timing and the flight recorder */
+    uint64_t clk_sent;     /* when the outstanding packet was first sent */
+    int      clk_fresh;    /* not retransmitted yet, so its RTT is a valid sample */
+    uint64_t rtt_sum;
+    uint32_t rtt_n;
+    uint32_t retx_us[FLIGHT_MAX_RETX];
+    uint16_t retx_block[FLIGHT_MAX_RETX];
+} Session;
+
+/* Shared, read-only after tftp_start() */
+static const ServerConfig *g_cfg;
+static int g_use_uring = 0;
+static int g_use_origin = 0;
+static Listener *g_listeners = NULL;
+static int g_num_listeners = 0;
+
+static int g_stop_fd = -1;         /* eventfd: stop the intake loop (handoff) */
+static int g_active_sessions = 0;  /* session threads still running */
+
+/* Microseconds since the request was received, saturated to 32 bits */
+static uint32_t clk_since(const Session *s) {
+    uint64_t d = mono_us() - s->sa->rx_us;
+    return d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+}
+
+/* Record a stage the first time it is reached */
+static void clk_mark(Session *s, uint32_t *stage) {
+    if (*stage == 0) {
+        uint32_t v = clk_since(s);
+        *stage = v ? v : 1;
+    }
+}
+
+/* A DATA (RRQ) or ACK (WRQ) went out. A retransmission is logged for the
+ * flight recorder and voids the pending RTT sample (Karn's rule). */
+static void clk_sent(Session *s, int retransmit, uint16_t block) {
+    EventTiming *t = &s->ev.timing;
+    if (retransmit) {
+        if (t->retransmits < FLIGHT_MAX_RETX) {
+            s->retx_us[t->retransmits] = clk_since(s);
+            s->retx_block[t->retransmits] = block;
+        }
+        t->retransmits++;
+        s->clk_fresh = 0;
+    } else {
+        s->clk_sent = mono_us();
+        s->clk_fresh = 1;
+    }
+}
+
+/* The peer answered the outstanding packet */
+static void clk_answered(Session *s) {
+    if (!s->clk_fresh) return;
+    s->clk_fresh = 0;
+
+    uint64_t d = mono_us() - s->clk_sent;
+    uint32_t rtt = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+    EventTiming *t = &s->ev.timing;
+    if (s->rtt_n == 0 || rtt < t->rtt_min_us) t->rtt_min_us = rtt;
+    if (rtt > t->rtt_max_us) t->rtt_max_us = rtt;
+    s->rtt_sum += rtt;
+    s->rtt_n++;
+}
+
+static void clk_finish(Session *s) {
+    s->ev.timing.total_us = clk_since(s);
+    if (s->rtt_n > 0) s->ev.timing.rtt_avg_us = (uint32_t)(s->rtt_sum / s->rtt_n);
+}
 
 /* Basic filename sanitization */
 static void sanitize_filename(char *dst, size_t dst_size, const char *src) {
@@ -63,12 +171,12 @@ static void sanitize_filename(char *dst, size_t dst_size, const char *src) {
 
 /* Build full path to requested file */
 static void build_file_path(char *out, size_t out_size, const char *filename) {
-    snprintf(out, out_size, "%s/%s", g_cfg.root_dir, filename);
+    snprintf(out, out_size, "%s/%s", g_cfg->root_dir, filename);
 }
 
 /* Build per-request log file path (same directory, .log suffix) */
 static void build_request_log_path(char *out, size_t out_size, const char *filename) {
-    snprintf(out, out_size, "%s/%s.log", g_cfg.root_dir, filename);
+    snprintf(out, out_size, "%s/%s.log", g_cfg->root_dir, filename);
 }
 
 /* Write one line into per-request log file */
@@ -87,7 +195,9 @@ static void write_request_log(const SessionArg *sa,
 
     FILE *f = fopen(path, "a");
     if (!f) {
-        log_msg(LOG_ERROR, "Failed to open per-request log file %s: %s", path, strerror(errno));
+        /* ENOENT: no such directory, e.g. a file served from root_bundle */
+        log_msg(errno == ENOENT ? LOG_DEBUG : LOG_ERROR,
+                "Failed to open per-request log file %s: %s", path, strerror(errno));
         return;
     }
 
@@ -105,75 +215,114 @@ static void send_error_packet(int sock,
                               uint16_t code,
                               const char *msg) {
     unsigned char buf[516];
-    uint16_t opcode = htons(TFTP_OPCODE_ERR);
-    uint16_t ecode = htons(code);
-    memcpy(buf, &opcode, 2);
-    memcpy(buf + 2, &ecode, 2);
-    size_t mlen = strlen(msg);
-    memcpy(buf + 4, msg, mlen);
-    buf[4 + mlen] = '\0';
-    sendto(sock, buf, 5 + mlen, 0,
-           (const struct sockaddr *)cliaddr, cliaddr_len);
+    size_t len = xfer_error_packet(buf, sizeof(buf), code, msg);
+    sendto(sock, buf, len, 0, (const struct sockaddr *)cliaddr, cliaddr_len);
 }
 
-/* TFTP session thread */
-static void *session_thread_main(void *arg) {
-    SessionArg *sa = (SessionArg *)arg;
-
-    char start_ts[32], end_ts[32];
-    now_iso8601(start_ts, sizeof(start_ts));
+/* Fill a 4-byte ACK packet */
+static void build_ack(unsigned char *buf, uint16_t block) {
+    buf[0] = 0;
+    buf[1] = TFTP_OPCODE_ACK;
+    buf[2] = (unsigned char)(block >> 8);
+    buf[3] = (unsigned char)(block & 0xff);
+}
 
-    Event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.type = EVT_REQ_START;
-    safe_strcpy(ev.client_ip, sizeof(ev.client_ip), sa->client_ip);
-    ev.client_port = sa->client_port;
-    safe_strcpy(ev.filename, sizeof(ev.filename), sa->filename);
-    ev.bytes = 0;
-    safe_strcpy(ev.status, sizeof(ev.status), "start");
-    safe_strcpy(ev.message, sizeof(ev.message), "RRQ received");
-    safe_strcpy(ev.start_ts, sizeof(ev.start_ts), start_ts);
-    ev.end_ts[0] = '\0';
-    event_emit(&ev);
+/* Append "name\0value\0" to an OACK being built */
+static size_t oack_put(unsigned char *buf, size_t size, size_t pos,
+                       const char *name, long long value) {
+    char val[32];
+    snprintf(val, sizeof(val), "%lld", value);
+    size_t nlen = strlen(name) + 1;
+    size_t vlen = strlen(val) + 1;
+    if (pos + nlen + vlen > size) return pos;
+    memcpy(buf + pos, name, nlen);
+    memcpy(buf + pos + nlen, val, vlen);
+    return pos + nlen + vlen;
+}
 
-    char fname_sanitized[256];
-    sanitize_filename(fname_sanitized, sizeof(fname_sanitized), sa->filename);
-    if (fname_sanitized[0] == '\0') {
-        log_msg(LOG_ERROR, "Rejected unsafe filename from %s: \"%s\"",
-                sa->client_ip, sa->filename);
-        /* We do not have cliaddr here, so use separate socket to send error if needed. */
-        goto done;
+/*
+ * Apply requested options and build the OACK. tsize is the value to
+ * acknowledge (file size for RRQ, announced size for WRQ). Returns the
+ * OACK length, or 0 if no option was accepted (plain RFC 1350 transfer).
+ */
+static size_t negotiate_options(Session *s, long long tsize,
+                                unsigned char *buf, size_t size) {
+    const TftpOptions *o = &s->sa->opts;
+    size_t pos = 2;
+    buf[0] = 0;
+    buf[1] = TFTP_OPCODE_OACK;
+
+    if (o->blksize > 0) {
+        s->blksize = o->blksize < g_cfg->max_blksize ? o->blksize : g_cfg->max_blksize;
+        pos = oack_put(buf, size, pos, "blksize", s->blksize);
+    }
+    if (o->timeout > 0) {
+        s->timeout_sec = o->timeout;
+        pos = oack_put(buf, size, pos, "timeout", s->timeout_sec);
+    }
+    if (o->has_tsize && tsize >= 0) {
+        pos = oack_put(buf, size, pos, "tsize", tsize);
     }
+    return pos > 2 ? pos : 0;
+}
 
-    char path[PATH_MAX];
-    build_file_path(path, sizeof(path), fname_sanitized);
+/*
+ * Wait for a packet from the session peer. Packets from any other
+ * address/port get an "Unknown transfer ID" error and are skipped.
+ * Returns packet length, 0 on timeout, -1 on error.
+ */
+static ssize_t wait_packet(Session *s, unsigned char *buf, size_t size) {
+    for (;;) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(s->sock, &rfds);
 
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        log_msg(LOG_ERROR, "Failed to open file %s: %s", path, strerror(errno));
-        /* We need to inform client with ERROR from a new socket */
-        int sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock >= 0) {
-            struct sockaddr_in cli;
-            memset(&cli, 0, sizeof(cli));
-            cli.sin_family = AF_INET;
-            cli.sin_port = htons(sa->client_port);
-            inet_pton(AF_INET, sa->client_ip, &cli.sin_addr);
-            send_error_packet(sock, &cli, sizeof(cli), 1, "File not found");
-            close(sock);
-        }
-        safe_strcpy(ev.status, sizeof(ev.status), "error");
-        safe_strcpy(ev.message, sizeof(ev.message), "file_not_found");
-        goto done;
+        struct timeval tv;
+        tv.tv_sec = s->timeout_sec;
+        tv.tv_usec = 0;
+
+        int sel = select(s->sock + 1, &rfds, NULL, NULL, &tv);
+        if (sel < 0) {
+            if (errno == EINTR) continue;
+            log_msg(LOG_ERROR, "select error: %s", strerror(errno));
+            return -1;
+        } else if (sel == 0) {
+            return 0;
+        }
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(s->sock, buf, size, 0,
+                             (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_msg(LOG_ERROR, "recvfrom failed: %s", strerror(errno));
+            return -1;
+        }
+        if (from.sin_addr.s_addr != s->cli.sin_addr.s_addr ||
+            from.sin_port != s->cli.sin_port) {
+            send_error_packet(s->sock, &from, from_len, TFTP_ERR_UNKNOWN_TID,
+                              "Unknown transfer ID");
+            continue;
+        }
+        return n;
     }
+}
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
+static void session_fail(Session *s, const char *message) {
+    safe_strcpy(s->ev.status, sizeof(s->ev.status), "error");
+    safe_strcpy(s->ev.message, sizeof(s->ev.message), message);
+}
+
+/* Create the session socket (listener IP, ephemeral port) and peer address */
+static int session_open_socket(Session *s) {
+    SessionArg *sa = s->sa;
+
+    s->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s->sock < 0) {
         log_msg(LOG_ERROR, "Failed to create session socket: %s", strerror(errno));
-        close(fd);
-        safe_strcpy(ev.status, sizeof(ev.status), "error");
-        safe_strcpy(ev.message, sizeof(ev.message), "socket_failed");
-        goto done;
+        session_fail(s, "socket_failed");
+        return -1;
     }
 
     /* Bind local address (IP same as listener, port ephemeral) */
@@ -182,142 +331,1068 @@ static void *session_thread_main(void *arg) {
     local.sin_family = AF_INET;
     local.sin_port = 0;
     if (inet_pton(AF_INET, sa->bind_addr, &local.sin_addr) != 1) {
-        close(fd);
-        close(sock);
-        safe_strcpy(ev.status, sizeof(ev.status), "error");
-        safe_strcpy(ev.message, sizeof(ev.message), "bind_ip_invalid");
-        goto done;
+        session_fail(s, "bind_ip_invalid");
+        goto fail;
     }
-    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) != 0) {
+    if (bind(s->sock, (struct sockaddr *)&local, sizeof(local)) != 0) {
         log_msg(LOG_ERROR, "Failed to bind session socket: %s", strerror(errno));
-        close(fd);
-        close(sock);
-        safe_strcpy(ev.status, sizeof(ev.status), "error");
-        safe_strcpy(ev.message, sizeof(ev.message), "bind_failed");
-        goto done;
+        session_fail(s, "bind_failed");
+        goto fail;
+    }
+
+    memset(&s->cli, 0, sizeof(s->cli));
+    s->cli.sin_family = AF_INET;
+    s->cli.sin_port = htons(sa->client_port);
+    if (inet_pton(AF_INET, sa->client_ip, &s->cli.sin_addr) != 1) {
+        session_fail(s, "client_ip_invalid");
+        goto fail;
     }
+    return 0;
+
+fail:
+    close(s->sock);
+    s->sock = -1;
+    return -1;
+}
 
+/* Report an error to the client before a session socket exists */
+static void send_early_error(const SessionArg *sa, uint16_t code, const char *msg) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return;
     struct sockaddr_in cli;
     memset(&cli, 0, sizeof(cli));
     cli.sin_family = AF_INET;
     cli.sin_port = htons(sa->client_port);
-    if (inet_pton(AF_INET, sa->client_ip, &cli.sin_addr) != 1) {
-        close(fd);
-        close(sock);
-        safe_strcpy(ev.status, sizeof(ev.status), "error");
-        safe_strcpy(ev.message, sizeof(ev.message), "client_ip_invalid");
-        goto done;
+    inet_pton(AF_INET, sa->client_ip, &cli.sin_addr);
+    send_error_packet(sock, &cli, sizeof(cli), code, msg);
+    close(sock);
+}
+
+/* Content of a read transfer: a file descriptor or a mapped bundle entry */
+typedef struct {
+    int fd;                       /* -1 when serving from mem */
+    const unsigned char *mem;
+    long long size;               /* -1 if unknown (fd only) */
+    OriginFetch *fetch;           /* fd is still being filled from origin_url */
+    GunzipFill *gz;               /* fd is still being inflated from a .gz */
+    NetasciiStream *na;           /* netascii rendered while reading (too large to keep) */
+} ReadSource;
+
+/* Next len bytes of a streamed netascii rendering; reads are sequential */
+static ssize_t netascii_stream_read(const ReadSource *src, unsigned char *buf, size_t len) {
+    NetasciiStream *st = src->na;
+    unsigned char in[4096];
+    size_t pos = netascii_stream_encode(st, NULL, 0, buf, len);
+    while (pos < len) {
+        size_t want = len - pos < sizeof(in) ? len - pos : sizeof(in);
+        const unsigned char *from = in;
+        ssize_t r;
+        if (src->mem) {
+            long long left = st->in_size - st->in_off;
+            r = (ssize_t)((long long)want < left ? (long long)want : left);
+            from = src->mem + st->in_off;
+        } else {
+            r = pread(src->fd, in, want, (off_t)st->in_off);
+            if (r < 0) return -1;
+        }
+        if (r == 0) break;
+        pos += netascii_stream_encode(st, from, (size_t)r, buf + pos, len - pos);
     }
+    return (ssize_t)pos;
+}
 
-    uint16_t block = 1;
-    ssize_t r;
-    unsigned char data_buf[4 + TFTP_DATA_SIZE];
-    size_t total_bytes = 0;
-    int done_ok = 0;
+static ssize_t source_read(const ReadSource *src, unsigned char *buf, size_t len, off_t off) {
+    if (src->na) return netascii_stream_read(src, buf, len);
+    if (src->fetch || src->gz) {
+        ssize_t avail = src->fetch ? origin_wait_bytes(src->fetch, off, len)
+                                   : gunzip_wait_bytes(src->gz, off, len);
+        if (avail < 0) {
+            errno = EIO;
+            return -1;
+        }
+        len = (size_t)avail;
+    }
+    if (!src->mem) return pread(src->fd, buf, len, off);
+    if (off >= src->size) return 0;
+    if ((long long)len > src->size - off) len = (size_t)(src->size - off);
+    memcpy(buf, src->mem + off, len);
+    return (ssize_t)len;
+}
 
-    while (1) {
-        r = read(fd, data_buf + 4, TFTP_DATA_SIZE);
-        if (r < 0) {
-            log_msg(LOG_ERROR, "Read error on %s: %s", path, strerror(errno));
-            send_error_packet(sock, &cli, sizeof(cli), 0, "Read error");
+/* The session peer over the session socket */
+typedef struct {
+    Transport base;
+    Session *s;
+} UdpTransport;
+
+static int udp_send(Transport *t, const unsigned char *buf, size_t len) {
+    Session *s = ((UdpTransport *)t)->s;
+    if (sendto(s->sock, buf, len, 0, (struct sockaddr *)&s->cli, sizeof(s->cli)) < 0) {
+        log_msg(LOG_ERROR, "sendto failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t udp_recv(Transport *t, unsigned char *buf, size_t size) {
+    return wait_packet(((UdpTransport *)t)->s, buf, size);
+}
+
+static void udp_transport_init(UdpTransport *ut, Session *s) {
+    ut->base.send = udp_send;
+    ut->base.recv = udp_recv;
+    ut->s = s;
+}
+
+typedef struct {
+    Session *s;
+    const ReadSource *src;
+    const char *path;
+} ReadCtx;
+
+/* pread: cached content fds are shared dup()s with one file offset */
+static ssize_t read_fill(void *ctx, unsigned char *buf, size_t len, long long off) {
+    ReadCtx *rc = (ReadCtx *)ctx;
+    for (;;) {
+        ssize_t r = source_read(rc->src, buf, len, (off_t)off);
+        if (r >= 0) return r;
+        if (errno == EINTR) continue;
+        log_msg(LOG_ERROR, "Read error on %s: %s", rc->path, strerror(errno));
+        return -1;
+    }
+}
+
+static void read_sent(void *ctx, uint16_t block, int retransmit) {
+    Session *s = ((ReadCtx *)ctx)->s;
+    clk_mark(s, &s->ev.timing.first_data_us);
+    clk_sent(s, retransmit, block);
+}
+
+static void read_answered(void *ctx) {
+    clk_answered(((ReadCtx *)ctx)->s);
+}
+
+static void read_finish(Session *s, const XferRead *x) {
+    s->total_bytes += (size_t)x->total;
+    if (x->fail) session_fail(s, x->fail);
+}
+
+/* Send OACK and wait for ACK of block 0, ahead of the io_uring loop */
+static int read_send_oack(Session *s, const unsigned char *oack, size_t oack_len) {
+    UdpTransport ut;
+    udp_transport_init(&ut, s);
+    XferHooks h;
+    memset(&h, 0, sizeof(h));
+
+    XferRead x;
+    XferAction a = xfer_read_start(&x, NULL, (size_t)s->blksize, g_cfg->max_retries,
+                                   oack, oack_len);
+    int ok = xfer_read_run(&x, a, &ut.base, &h);
+    read_finish(s, &x);
+    return ok ? 0 : -1;
+}
+
+/* Blocking transfer loop: the xfer state machine over the session socket,
+ * one pread(), sendto() and select()/recvfrom() per block. oack, if any, is
+ * sent first. Returns 1 on success, 0 on failure. */
+static int posix_send_file(Session *s, const ReadSource *src, const char *path,
+                           const unsigned char *oack, size_t oack_len) {
+    unsigned char *data_buf = (unsigned char *)malloc(4 + (size_t)s->blksize);
+    if (!data_buf) {
+        session_fail(s, "out_of_memory");
+        return 0;
+    }
+
+    UdpTransport ut;
+    udp_transport_init(&ut, s);
+    ReadCtx rc = { s, src, path };
+    XferHooks h = { read_fill, read_sent, read_answered, &rc };
+
+    XferRead x;
+    XferAction a = xfer_read_start(&x, data_buf, (size_t)s->blksize, g_cfg->max_retries,
+                                   oack, oack_len);
+    int done_ok = xfer_read_run(&x, a, &ut.base, &h);
+    read_finish(s, &x);
+
+    free(data_buf);
+    return done_ok;
+}
+
+/*
+ * io_uring engine: one thread and one ring drive the block loop of every
+ * io_uring download. A session thread sends its OACK, hands the transfer
+ * over and sleeps until it is finished. The engine steps each transfer's
+ * xfer state machine from its completions (file read, then DATA send
+ * linked to the ACK receive and its timeout), so one io_uring_enter()
+ * submits and reaps the next step of every session that is ready. Content
+ * that is already in memory (bundle entries, streamed netascii) is copied
+ * in directly instead of read through the ring.
+ */
+
+#define URING_MAX_JOBS 256   /* at most 3 SQEs each in flight */
+
+/* user_data tags, in the low bits of the job pointer */
+#define UD_READ    1
+#define UD_SEND    2
+#define UD_RECV    3
+#define UD_TIMEOUT 4
+#define UD_WAKE    5         /* the engine's own eventfd, no job */
+#define UD_MASK    7
+
+typedef struct UringJob {
+    Session *s;
+    const ReadSource *src;
+    const char *path;
+    XferRead x;
+    unsigned char *pkt;           /* 4 + blksize */
+    unsigned char ack[516];
+    struct __kernel_timespec ts;
+    int inflight;                 /* SQEs not completed yet */
+    int ended;                    /* no further steps; finish once inflight is 0 */
+    int done_ok;
+    int finished;                 /* g_uring.lock: handed back to the session */
+    struct UringJob *next;        /* g_uring.lock: intake list */
+} UringJob;
+
+static struct {
+    URing ring;
+    int wake_fd;                  /* eventfd: new jobs or stop */
+    uint64_t wake_buf;
+    pthread_t thread;
+    int started;
+    unsigned long sends;          /* DATA packets, for the enter/packet ratio */
+    pthread_mutex_t lock;         /* everything below */
+    pthread_cond_t cond;          /* a job finished */
+    UringJob *intake;
+    int jobs;                     /* accepted and not finished */
+    int stop;
+} g_uring = { .wake_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER,
+              .cond = PTHREAD_COND_INITIALIZER };
+
+static struct io_uring_sqe *uring_job_sqe(UringJob *j, int tag, int opcode, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&g_uring.ring);
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)j | (uint64_t)tag;
+    j->inflight++;
+    return sqe;
+}
+
+static void uring_arm_wake(void) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&g_uring.ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = g_uring.wake_fd;
+    sqe->addr = (unsigned long)&g_uring.wake_buf;
+    sqe->len = sizeof(g_uring.wake_buf);
+    sqe->user_data = UD_WAKE;
+}
+
+/* Wait for the ACK of the outstanding packet, with the session timeout */
+static void uring_job_recv(UringJob *j) {
+    struct io_uring_sqe *sqe = uring_job_sqe(j, UD_RECV, IORING_OP_RECV, j->s->sock);
+    sqe->addr = (unsigned long)j->ack;
+    sqe->len = sizeof(j->ack);
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = uring_job_sqe(j, UD_TIMEOUT, IORING_OP_LINK_TIMEOUT, -1);
+    sqe->addr = (unsigned long)&j->ts;
+    sqe->len = 1;
+}
+
+/* Run the state machine until it needs a completion */
+static void uring_job_step(UringJob *j, XferAction a) {
+    Session *s = j->s;
+    while (!j->ended) {
+        switch (a) {
+        case XFER_FILL: {
+            long long left = j->src->size - j->x.off;
+            size_t len = left < (long long)j->x.blksize ? (size_t)left : j->x.blksize;
+            if (j->src->mem || j->src->na) {
+                ssize_t r = source_read(j->src, j->x.pkt + 4, len, (off_t)j->x.off);
+                if (r != (ssize_t)len) {
+                    log_msg(LOG_ERROR, "Read error on %s", j->path);
+                    send_error_packet(s->sock, &s->cli, sizeof(s->cli), TFTP_ERR_UNDEF,
+                                      "Read error");
+                    j->x.fail = "read_error";
+                    j->ended = 1;
+                    break;
+                }
+                a = xfer_read_filled(&j->x, (size_t)r);
+                break;
+            }
+            struct io_uring_sqe *sqe = uring_job_sqe(j, UD_READ, IORING_OP_READ, j->src->fd);
+            sqe->addr = (unsigned long)(j->x.pkt + 4);
+            sqe->len = (unsigned)len;
+            sqe->off = (unsigned long long)j->x.off;
+            return;
+        }
+        case XFER_SEND: {
+            clk_sent(s, j->x.retries > 0, j->x.block);
+            clk_mark(s, &s->ev.timing.first_data_us);
+            g_uring.sends++;
+            struct io_uring_sqe *sqe = uring_job_sqe(j, UD_SEND, IORING_OP_SEND, s->sock);
+            sqe->addr = (unsigned long)j->x.out;
+            sqe->len = (unsigned)j->x.out_len;
+            sqe->flags = IOSQE_IO_LINK;
+            uring_job_recv(j);
+            return;
+        }
+        case XFER_WAIT:
+            uring_job_recv(j);
+            return;
+        case XFER_DONE:
+            j->done_ok = 1;
+            j->ended = 1;
+            break;
+        case XFER_FAIL:
+        default:
+            j->ended = 1;
             break;
         }
+    }
+}
 
-        uint16_t opcode = htons(TFTP_OPCODE_DATA);
-        uint16_t blk_be = htons(block);
-        memcpy(data_buf, &opcode, 2);
-        memcpy(data_buf + 2, &blk_be, 2);
-        size_t pkt_size = 4 + (size_t)r;
+static void uring_job_complete(UringJob *j, int tag, int res) {
+    Session *s = j->s;
+    j->inflight--;
+    if (j->ended) return;   /* completions of an abandoned step */
+
+    switch (tag) {
+    case UD_READ: {
+        long long left = j->src->size - j->x.off;
+        size_t len = left < (long long)j->x.blksize ? (size_t)left : j->x.blksize;
+        if (res != (int)len) {
+            log_msg(LOG_ERROR, "Read error on %s: %s", j->path,
+                    res < 0 ? strerror(-res) : "file changed during transfer");
+            send_error_packet(s->sock, &s->cli, sizeof(s->cli), TFTP_ERR_UNDEF, "Read error");
+            j->x.fail = "read_error";
+            j->ended = 1;
+            return;
+        }
+        uring_job_step(j, xfer_read_filled(&j->x, (size_t)res));
+        return;
+    }
+    case UD_SEND:
+        if (res < 0) {
+            /* The linked receive is cancelled and ignored */
+            log_msg(LOG_ERROR, "send failed: %s", strerror(-res));
+            j->ended = 1;
+        }
+        return;
+    case UD_RECV:
+        if (res == -ECANCELED || res == -ETIME || res == -EINTR) {
+            uring_job_step(j, xfer_read_expired(&j->x));
+        } else if (res < 0) {
+            log_msg(LOG_ERROR, "recv failed: %s", strerror(-res));
+            j->ended = 1;
+        } else {
+            XferAction a = xfer_read_recv(&j->x, j->ack, (size_t)res);
+            if (a != XFER_WAIT && a != XFER_FAIL) clk_answered(s);
+            uring_job_step(j, a);
+        }
+        return;
+    default:
+        return;
+    }
+}
 
-        int retries = 0;
+/* A job that ended with nothing in flight goes back to its session */
+static void uring_job_settle(UringJob *j, UringJob **done) {
+    if (j->ended && j->inflight == 0) {
+        j->next = *done;
+        *done = j;
+    }
+}
 
-    resend_block:
-        if (sendto(sock, data_buf, pkt_size, 0,
-                   (struct sockaddr *)&cli, sizeof(cli)) < 0) {
-            log_msg(LOG_ERROR, "sendto failed: %s", strerror(errno));
-            break;
+static void *uring_thread_main(void *arg) {
+    (void)arg;
+    struct io_uring_cqe cqes[64];
+    int live = 0;
+
+    uring_arm_wake();
+    for (;;) {
+        UringJob *done = NULL;
+
+        pthread_mutex_lock(&g_uring.lock);
+        UringJob *in = g_uring.intake;
+        g_uring.intake = NULL;
+        int stop = g_uring.stop;
+        pthread_mutex_unlock(&g_uring.lock);
+        while (in) {
+            UringJob *j = in;
+            in = j->next;
+            j->next = NULL;
+            live++;
+            uring_job_step(j, XFER_FILL);
+            uring_job_settle(j, &done);
         }
 
-        struct sockaddr_in recv_addr;
-        socklen_t recv_len = sizeof(recv_addr);
-        unsigned char ack_buf[516];
+        int n;
+        while ((n = uring_reap(&g_uring.ring, cqes, 64)) > 0) {
+            for (int i = 0; i < n; ++i) {
+                int tag = (int)(cqes[i].user_data & UD_MASK);
+                if (tag == UD_WAKE) {
+                    uring_arm_wake();
+                    continue;
+                }
+                UringJob *j = (UringJob *)(uintptr_t)(cqes[i].user_data & ~(uint64_t)UD_MASK);
+                uring_job_complete(j, tag, cqes[i].res);
+                uring_job_settle(j, &done);
+            }
+        }
 
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(sock, &rfds);
+        if (done) {
+            pthread_mutex_lock(&g_uring.lock);
+            while (done) {
+                UringJob *j = done;
+                done = j->next;
+                j->finished = 1;
+                g_uring.jobs--;
+                live--;
+            }
+            pthread_cond_broadcast(&g_uring.cond);
+            pthread_mutex_unlock(&g_uring.lock);
+        }
+        if (stop && live == 0) break;
+        if (uring_submit_and_wait(&g_uring.ring, 1) < 0) {
+            /* Nothing to do but retry: the jobs' buffers belong to the kernel */
+            log_msg(LOG_ERROR, "io_uring_enter failed: %s", strerror(errno));
+            usleep(10000);
+        }
+    }
+    return NULL;
+}
 
-        struct timeval tv;
-        tv.tv_sec = g_cfg.timeout_sec;
-        tv.tv_usec = 0;
+/* Returns 0 if the engine runs; io_uring downloads use the posix loop otherwise */
+static int uring_engine_start(const ServerConfig *cfg) {
+    g_uring.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (g_uring.wake_fd < 0) return -1;
+    if (uring_init(&g_uring.ring, 4 * URING_MAX_JOBS) != 0) {
+        close(g_uring.wake_fd);
+        g_uring.wake_fd = -1;
+        return -1;
+    }
+    if (thread_spawn(&g_uring.thread, uring_thread_main, NULL,
+                     (size_t)cfg->thread_stack_kb * 1024, 0) != 0) {
+        uring_exit(&g_uring.ring);
+        close(g_uring.wake_fd);
+        g_uring.wake_fd = -1;
+        return -1;
+    }
+    g_uring.started = 1;
+    return 0;
+}
 
-        int sel = select(sock + 1, &rfds, NULL, NULL, &tv);
-        if (sel < 0) {
-            log_msg(LOG_ERROR, "select error: %s", strerror(errno));
-            break;
-        } else if (sel == 0) {
-            /* timeout */
-            if (++retries <= g_cfg.max_retries) {
-                log_msg(LOG_DEBUG, "Timeout waiting ACK, retry block %u", block);
-                goto resend_block;
-            } else {
-                log_msg(LOG_ERROR, "Max retries exceeded for block %u", block);
-                break;
+/* Once no session can hand over a transfer any more */
+static void uring_engine_stop(void) {
+    if (!g_uring.started) return;
+    pthread_mutex_lock(&g_uring.lock);
+    g_uring.stop = 1;
+    pthread_mutex_unlock(&g_uring.lock);
+    uint64_t one = 1;
+    if (write(g_uring.wake_fd, &one, sizeof(one)) < 0) {
+        log_msg(LOG_ERROR, "Failed to stop the io_uring engine: %s", strerror(errno));
+    }
+    pthread_join(g_uring.thread, NULL);
+    log_msg(LOG_INFO, "io_uring engine: %lu DATA packets, %lu io_uring_enter calls",
+            g_uring.sends, g_uring.ring.enters);
+    uring_exit(&g_uring.ring);
+    close(g_uring.wake_fd);
+    g_uring.wake_fd = -1;
+    g_uring.started = 0;
+}
+
+/*
+ * Hand the block loop to the engine and wait for it. The OACK has been
+ * acknowledged already. Returns 1 on success, 0 on failure, -1 if the
+ * engine is busy (the caller then uses the posix loop).
+ */
+static int uring_send_file(Session *s, const ReadSource *src, const char *path) {
+    UringJob *j = (UringJob *)calloc(1, sizeof(UringJob));
+    unsigned char *pkt = (unsigned char *)malloc(4 + (size_t)s->blksize);
+    if (!j || !pkt || connect(s->sock, (struct sockaddr *)&s->cli, sizeof(s->cli)) != 0) {
+        free(j);
+        free(pkt);
+        return -1;
+    }
+    j->s = s;
+    j->src = src;
+    j->path = path;
+    j->pkt = pkt;
+    j->ts.tv_sec = s->timeout_sec;
+    xfer_read_start(&j->x, pkt, (size_t)s->blksize, g_cfg->max_retries, NULL, 0);
+
+    pthread_mutex_lock(&g_uring.lock);
+    int accepted = !g_uring.stop && g_uring.jobs < URING_MAX_JOBS;
+    if (accepted) {
+        g_uring.jobs++;
+        j->next = g_uring.intake;
+        g_uring.intake = j;
+    }
+    pthread_mutex_unlock(&g_uring.lock);
+    if (!accepted) {
+        free(j);
+        free(pkt);
+        return -1;
+    }
+    uint64_t one = 1;
+    if (write(g_uring.wake_fd, &one, sizeof(one)) < 0) {
+        log_msg(LOG_ERROR, "io_uring engine wakeup failed: %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&g_uring.lock);
+    while (!j->finished) pthread_cond_wait(&g_uring.cond, &g_uring.lock);
+    pthread_mutex_unlock(&g_uring.lock);
+
+    read_finish(s, &j->x);
+    int done_ok = j->done_ok;
+    free(pkt);
+    free(j);
+    return done_ok;
+}
+
+/*
+ * Replace *fd with its netascii rendering. The conversion runs once per
+ * file version; later transfers reuse the cached copy and go through the
+ * same block loops as octet mode. The rendering is at most twice the file,
+ * and that bound decides whether it is built in memory or spilled. One
+ * that fits neither budget is encoded block by block through *st instead.
+ */
+static int open_netascii_view(ReadSource *src, const FcacheKey *key, const char *fname,
+                              NetasciiStream *st) {
+    long long size;
+    int nfd = fcache_get(key, FCACHE_NETASCII, &size);
+    if (nfd < 0) {
+        nfd = fcache_create(FCACHE_NETASCII, fname, 2 * src->size);
+        if (nfd < 0 && errno == EFBIG) {
+            size = src->mem ? netascii_size_mem(src->mem, (size_t)src->size)
+                            : netascii_size_fd(src->fd);
+            if (size < 0) return -1;
+            st->in_size = src->size;
+            st->in_off = 0;
+            st->held = -1;
+            src->na = st;
+            src->size = size;
+            return 0;
+        }
+        if (nfd < 0) return -1;
+        int rc = src->mem ? netascii_convert_mem(src->mem, (size_t)src->size, nfd, &size)
+                          : netascii_convert_fd(src->fd, nfd, &size);
+        if (rc != 0) {
+            close(nfd);
+            return -1;
+        }
+        fcache_put(key, FCACHE_NETASCII, nfd, size);
+    }
+    if (src->fd >= 0) close(src->fd);
+    src->fd = nfd;
+    src->mem = NULL;
+    src->size = size;
+    return 0;
+}
+
+/* Look fname up in root_bundle; on a hit the bundle stays pinned in *pin */
+static int bundle_source(const char *fname, ReadSource *src, FcacheKey *key, Bundle **pin) {
+    Bundle *b = bundle_acquire();
+    BundleFile bf;
+    if (!b || bundle_lookup(b, fname, &bf) != 0) {
+        bundle_release(b);
+        return -1;
+    }
+    src->fd = -1;
+    src->mem = bf.data;
+    src->size = bf.size;
+    src->fetch = NULL;
+    src->gz = NULL;
+    src->na = NULL;
+    key->dev = (uint64_t)bf.dev;
+    key->ino = (uint64_t)bf.ino;
+    key->offset = bf.offset;
+    key->size = (uint64_t)bf.size;
+    key->mtime_sec = bf.mtime_sec;
+    key->mtime_nsec = bf.mtime_nsec;
+    *pin = b;
+    return 0;
+}
+
+/* RRQ: stream the file to the client */
+static int run_read_session(Session *s, const char *path, const char *fname) {
+    ReadSource src;
+    NetasciiStream na;
+    FcacheKey key;
+    Bundle *pin = NULL;
+    int rc = -1;
+
+    if (!g_cfg->root_bundle || bundle_source(fname, &src, &key, &pin) != 0) {
+        src.mem = NULL;
+        src.fetch = NULL;
+        src.gz = NULL;
+        src.na = NULL;
+        src.size = -1;
+        src.fd = open(path, O_RDONLY);
+        if (src.fd < 0 && errno == ENOENT && g_cfg->compressed_storage) {
+            GunzipFile gf;
+            if (gunzip_open(path, &gf) == 0) {
+                src.fd = gf.fd;
+                src.size = gf.size;
+                src.gz = gf.fill;
+            }
+        }
+        if (src.fd < 0 && errno == ENOENT && g_use_origin) {
+            OriginFile of;
+            if (origin_open(fname, &of) == 0) {
+                src.fd = of.fd;
+                src.size = of.size;
+                src.fetch = of.fetch;
             }
         }
+        if (src.fd < 0) {
+            log_msg(LOG_ERROR, "Failed to open file %s: %s", path, strerror(errno));
+            /* We need to inform client with ERROR from a new socket */
+            send_early_error(s->sa, TFTP_ERR_NOT_FOUND, "File not found");
+            session_fail(s, "file_not_found");
+            return -1;
+        }
+        struct stat st;
+        if (!src.fetch && !src.gz && fstat(src.fd, &st) == 0) {
+            src.size = (long long)st.st_size;
+            fcache_key_from_stat(&key, &st);
+        }
+    }
+    clk_mark(s, &s->ev.timing.open_us);
+
+    if (session_open_socket(s) != 0) goto out;
+
+    /* netascii needs the whole file: let a streaming origin fetch finish */
+    if (s->netascii && src.fetch) {
+        struct stat st;
+        if (origin_wait_done(src.fetch, &src.size) != 0 || fstat(src.fd, &st) != 0) {
+            src.size = -1;
+        } else {
+            fcache_key_from_stat(&key, &st);
+        }
+        origin_release(src.fetch);
+        src.fetch = NULL;
+    }
+
+    if (s->netascii && src.gz) {
+        struct stat st;
+        if (gunzip_wait_done(src.gz) != 0 || fstat(src.fd, &st) != 0) {
+            src.size = -1;
+        } else {
+            fcache_key_from_stat(&key, &st);
+        }
+        gunzip_release(src.gz);
+        src.gz = NULL;
+    }
+
+    if (s->netascii && (src.size < 0 || open_netascii_view(&src, &key, fname, &na) != 0)) {
+        log_msg(LOG_ERROR, "netascii conversion failed for %s: %s", path, strerror(errno));
+        send_error_packet(s->sock, &s->cli, sizeof(s->cli), TFTP_ERR_UNDEF, "Read error");
+        session_fail(s, "read_error");
+        goto out;
+    }
+
+    if (src.mem) warm_hint_mem(src.mem, (size_t)src.size);
+    else if (!src.fetch && !src.gz) warm_hint_fd(src.fd, src.size);
+
+    unsigned char oack[512];
+    size_t oack_len = negotiate_options(s, src.size, oack, sizeof(oack));
+
+    int done_ok = -1;
+    if (g_use_uring && src.size >= 0 && !src.fetch && !src.gz) {
+        if (oack_len > 0 && read_send_oack(s, oack, oack_len) != 0) goto out;
+        oack_len = 0;
+        done_ok = uring_send_file(s, &src, path);
+    }
+    if (done_ok < 0) {
+        done_ok = posix_send_file(s, &src, path, oack, oack_len);
+    }
+    rc = done_ok ? 0 : -1;
+
+out:
+    if (src.fd >= 0) close(src.fd);
+    origin_release(src.fetch);
+    gunzip_release(src.gz);
+    bundle_release(pin);
+    return rc;
+}
+
+/* Upload limit for a (sanitized) path: longest matching quota prefix wins */
+static long long upload_limit_for(const char *fname) {
+    long long limit = g_cfg->upload_max_bytes;
+    size_t best = 0;
+    int matched = 0;
+    for (int i = 0; i < g_cfg->num_upload_quotas; ++i) {
+        const UploadQuota *q = &g_cfg->upload_quotas[i];
+        size_t plen = strlen(q->prefix);
+        if (starts_with(fname, q->prefix) && (!matched || plen > best)) {
+            limit = q->max_bytes;
+            best = plen;
+            matched = 1;
+        }
+    }
+    return limit;
+}
+
+/* Write-behind buffer: DATA payloads are batched into large pwrite()s */
+typedef struct {
+    int fd;
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    off_t file_off;
+    int netascii;          /* decode CR LF / CR NUL while buffering */
+    NetasciiDecoder nd;
+} WriteBehind;
+
+static int wb_flush(WriteBehind *wb) {
+    size_t off = 0;
+    while (off < wb->len) {
+        ssize_t w = pwrite(wb->fd, wb->buf + off, wb->len - off, wb->file_off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += (size_t)w;
+        wb->file_off += w;
+    }
+    wb->len = 0;
+    return 0;
+}
+
+static int wb_append(WriteBehind *wb, const unsigned char *data, size_t len) {
+    /* a decoded block is at most one byte (a held-back CR) longer */
+    if (wb->len + len + 1 > wb->cap && wb_flush(wb) != 0) return -1;
+    if (wb->netascii) {
+        wb->len += netascii_decode(&wb->nd, data, len, wb->buf + wb->len);
+    } else {
+        memcpy(wb->buf + wb->len, data, len);
+        wb->len += len;
+    }
+    return 0;
+}
+
+/* Flush everything, including a CR left pending at the very end */
+static int wb_finish(WriteBehind *wb) {
+    if (wb->nd.pending_cr) {
+        wb->nd.pending_cr = 0;
+        wb->buf[wb->len++] = '\r';
+    }
+    return wb_flush(wb);
+}
+
+/* WRQ: receive into a temp file, then rename() it into place */
+static int run_write_session(Session *s, const char *path, const char *fname) {
+    long long limit = upload_limit_for(fname);
+    const TftpOptions *o = &s->sa->opts;
+
+    if (limit > 0 && o->has_tsize && o->tsize > limit) {
+        log_msg(LOG_ERROR, "Upload of %s rejected: tsize %lld exceeds quota %lld",
+                fname, o->tsize, limit);
+        send_early_error(s->sa, TFTP_ERR_DISK_FULL, "Upload quota exceeded");
+        session_fail(s, "quota_exceeded");
+        return -1;
+    }
+
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.ctftp-XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        log_msg(LOG_ERROR, "Failed to create temp file for %s: %s", path, strerror(errno));
+        send_early_error(s->sa, TFTP_ERR_ACCESS, "Cannot create file");
+        session_fail(s, "create_failed");
+        return -1;
+    }
+    clk_mark(s, &s->ev.timing.open_us);
+
+    if (session_open_socket(s) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    /* reply holds the last ACK/OACK sent, for retransmission */
+    unsigned char reply[512];
+    size_t reply_len = negotiate_options(s, o->has_tsize ? o->tsize : -1,
+                                         reply, sizeof(reply));
+    if (reply_len == 0) {
+        build_ack(reply, 0);
+        reply_len = 4;
+    }
+
+    WriteBehind wb;
+    memset(&wb, 0, sizeof(wb));
+    wb.fd = fd;
+    wb.cap = (size_t)g_cfg->upload_buffer;
+    if (wb.cap < (size_t)s->blksize + 1) wb.cap = (size_t)s->blksize + 1;
+    wb.netascii = s->netascii;
+    wb.buf = (unsigned char *)malloc(wb.cap);
+    unsigned char *pkt = (unsigned char *)malloc(4 + (size_t)s->blksize + 1);
+    if (!wb.buf || !pkt) {
+        free(wb.buf);
+        free(pkt);
+        close(fd);
+        unlink(tmp_path);
+        session_fail(s, "out_of_memory");
+        return -1;
+    }
+
+    uint16_t expected = 1;
+    int retries = 0;
+    int resend = 0;
+    int done_ok = 0;
 
-        ssize_t n = recvfrom(sock, ack_buf, sizeof(ack_buf), 0,
-                             (struct sockaddr *)&recv_addr, &recv_len);
-        if (n < 4) {
-            log_msg(LOG_DEBUG, "Short ACK packet ignored");
-            goto resend_block;
+    while (1) {
+        if (sendto(s->sock, reply, reply_len, 0,
+                   (struct sockaddr *)&s->cli, sizeof(s->cli)) < 0) {
+            log_msg(LOG_ERROR, "sendto failed: %s", strerror(errno));
+            break;
+        }
+        clk_sent(s, resend, (uint16_t)(expected - 1));
+        resend = 0;
+
+    wait_data:;
+        ssize_t n = wait_packet(s, pkt, 4 + (size_t)s->blksize + 1);
+        if (n < 0) break;
+        if (n == 0) {
+            if (++retries <= g_cfg->max_retries) {
+                log_msg(LOG_DEBUG, "Timeout waiting DATA, resending ACK %u",
+                        (uint16_t)(expected - 1));
+                resend = 1;
+                continue;
+            }
+            log_msg(LOG_ERROR, "Max retries exceeded waiting for block %u", expected);
+            break;
         }
+        if (n < 4) goto wait_data;
 
-        uint16_t op = (ack_buf[0] << 8) | ack_buf[1];
-        uint16_t ack_blk = (ack_buf[2] << 8) | ack_buf[3];
+        uint16_t op = (pkt[0] << 8) | pkt[1];
+        uint16_t blk = (pkt[2] << 8) | pkt[3];
 
-        if (op != TFTP_OPCODE_ACK || ack_blk != block) {
-            log_msg(LOG_DEBUG, "Unexpected packet: op=%u blk=%u", op, ack_blk);
-            goto resend_block;
+        if (op == TFTP_OPCODE_ERR) {
+            log_msg(LOG_ERROR, "Client aborted upload (code %u)", blk);
+            session_fail(s, "client_aborted");
+            break;
+        }
+        if (op != TFTP_OPCODE_DATA) goto wait_data;
+        if (blk != expected) {
+            /* Duplicate of the previous block: our ACK was lost, resend it */
+            if ((uint16_t)(blk + 1) == expected) {
+                retries = 0;
+                resend = 1;
+                continue;
+            }
+            goto wait_data;
         }
 
-        total_bytes += (size_t)r;
+        clk_answered(s);
+        clk_mark(s, &s->ev.timing.first_data_us);
 
-        if (r < TFTP_DATA_SIZE) {
+        size_t len = (size_t)n - 4;
+        if (len > (size_t)s->blksize) {
+            send_error_packet(s->sock, &s->cli, sizeof(s->cli),
+                              TFTP_ERR_ILLEGAL_OP, "Block too large");
+            session_fail(s, "illegal_block");
+            break;
+        }
+        if (limit > 0 && (long long)(s->total_bytes + len) > limit) {
+            log_msg(LOG_ERROR, "Upload of %s exceeded quota %lld", fname, limit);
+            send_error_packet(s->sock, &s->cli, sizeof(s->cli),
+                              TFTP_ERR_DISK_FULL, "Upload quota exceeded");
+            session_fail(s, "quota_exceeded");
+            break;
+        }
+        if (wb_append(&wb, pkt + 4, len) != 0) {
+            log_msg(LOG_ERROR, "Write error on %s: %s", tmp_path, strerror(errno));
+            send_error_packet(s->sock, &s->cli, sizeof(s->cli),
+                              TFTP_ERR_DISK_FULL, "Write error");
+            session_fail(s, "write_failed");
+            break;
+        }
+        s->total_bytes += len;
+        retries = 0;
+        build_ack(reply, blk);
+        reply_len = 4;
+
+        if (len < (size_t)s->blksize) {
+            /* Last block: publish atomically before acknowledging it */
+            if (wb_finish(&wb) != 0 || fchmod(fd, 0644) != 0 ||
+                fdatasync(fd) != 0 || rename(tmp_path, path) != 0) {
+                log_msg(LOG_ERROR, "Failed to publish upload %s: %s", path, strerror(errno));
+                send_error_packet(s->sock, &s->cli, sizeof(s->cli),
+                                  TFTP_ERR_DISK_FULL, "Write error");
+                session_fail(s, "write_failed");
+                break;
+            }
+            sendto(s->sock, reply, reply_len, 0,
+                   (struct sockaddr *)&s->cli, sizeof(s->cli));
+            s->last_block = blk;
             done_ok = 1;
             break;
         }
-        block++;
-        if (block == 0) block = 1; /* wrap safety */
+        expected++; /* wraps to 0, as most clients do */
     }
 
+    free(wb.buf);
+    free(pkt);
     close(fd);
-    close(sock);
+    if (!done_ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
 
-    now_iso8601(end_ts, sizeof(end_ts));
-    safe_strcpy(ev.end_ts, sizeof(ev.end_ts), end_ts);
-    ev.bytes = total_bytes;
+/* After an upload: re-ACK a retransmitted final block in case our ACK was lost */
+static void write_session_dally(Session *s) {
+    unsigned char *pkt = (unsigned char *)malloc(4 + (size_t)s->blksize + 1);
+    if (!pkt) return;
+    ssize_t n = wait_packet(s, pkt, 4 + (size_t)s->blksize + 1);
+    if (n >= 4 && ((pkt[0] << 8) | pkt[1]) == TFTP_OPCODE_DATA &&
+        ((pkt[2] << 8) | pkt[3]) == s->last_block) {
+        unsigned char ack[4];
+        build_ack(ack, s->last_block);
+        sendto(s->sock, ack, sizeof(ack), 0,
+               (struct sockaddr *)&s->cli, sizeof(s->cli));
+    }
+    free(pkt);
+}
 
-    if (done_ok) {
-        safe_strcpy(ev.status, sizeof(ev.status), "ok");
-        safe_strcpy(ev.message, sizeof(ev.message), "transfer_complete");
-    } else {
-        if (ev.status[0] == '\0') {
-            safe_strcpy(ev.status, sizeof(ev.status), "error");
-            safe_strcpy(ev.message, sizeof(ev.message), "transfer_failed");
-        }
+/* Hand the finished session to the flight recorder */
+static void record_trace(const Session *s) {
+    FlightTrace tr;
+    memcpy(&tr.ev, &s->ev, sizeof(tr.ev));
+    safe_strcpy(tr.op, sizeof(tr.op), s->sa->opcode == TFTP_OPCODE_WRQ ? "WRQ" : "RRQ");
+    memcpy(tr.retx_us, s->retx_us, sizeof(tr.retx_us));
+    memcpy(tr.retx_block, s->retx_block, sizeof(tr.retx_block));
+    flight_record(&tr);
+}
+
+/* Set up a session for sa; *start is its start event, not yet emitted */
+static void session_init(Session *s, SessionArg *sa, char *start_ts, size_t ts_size,
+                         Event *start) {
+    int is_write = (sa->opcode == TFTP_OPCODE_WRQ);
+    now_iso8601(start_ts, ts_size);
+
+    memset(s, 0, sizeof(*s));
+    s->sa = sa;
+    s->sock = -1;
+    s->blksize = TFTP_DATA_SIZE;
+    s->timeout_sec = g_cfg->timeout_sec;
+    s->netascii = (strcasecmp(sa->mode, "netascii") == 0);
+
+    Event *ev = &s->ev;
+    ev->type = EVT_REQ_START;
+    safe_strcpy(ev->client_ip, sizeof(ev->client_ip), sa->client_ip);
+    ev->client_port = sa->client_port;
+    safe_strcpy(ev->filename, sizeof(ev->filename), sa->filename);
+    ev->bytes = 0;
+    safe_strcpy(ev->start_ts, sizeof(ev->start_ts), start_ts);
+    ev->end_ts[0] = '\0';
+
+    *start = *ev;
+    safe_strcpy(start->status, sizeof(start->status), "start");
+    safe_strcpy(start->message, sizeof(start->message),
+                is_write ? "WRQ received" : "RRQ received");
+}
+
+/* Set up a session for sa and emit its start event */
+static void session_begin(Session *s, SessionArg *sa, char *start_ts, size_t ts_size) {
+    Event start;
+    session_init(s, sa, start_ts, ts_size, &start);
+    event_emit(&start);
+}
+
+/* Complete the session's event and hand it to the flight recorder */
+static void session_close(Session *s, int rc) {
+    int is_write = (s->sa->opcode == TFTP_OPCODE_WRQ);
+    Event *ev = &s->ev;
+    now_iso8601(ev->end_ts, sizeof(ev->end_ts));
+    ev->bytes = s->total_bytes;
+    ev->type = (rc == 0) ? EVT_REQ_DONE : EVT_REQ_ERROR;
+
+    if (rc == 0) {
+        safe_strcpy(ev->status, sizeof(ev->status), "ok");
+        safe_strcpy(ev->message, sizeof(ev->message),
+                    is_write ? "upload_complete" : "transfer_complete");
+    } else if (ev->status[0] == '\0') {
+        session_fail(s, "transfer_failed");
     }
-    event_emit(&ev);
-    write_request_log(sa, start_ts, end_ts, total_bytes, ev.status, ev.message);
+    clk_finish(s);
+    record_trace(s);
+}
+
+/* Emit a closed session's event and write it to the logs and statistics */
+static void session_report(const SessionArg *sa, const Event *ev,
+                           const char *start_ts, const char *fname) {
+    if (ev->type == EVT_REQ_DONE && sa->opcode != TFTP_OPCODE_WRQ) warm_note(fname);
+    event_emit(ev);
+    stats_record(ev);
+    write_request_log(sa, start_ts, ev->end_ts, ev->bytes, ev->status, ev->message);
+}
+
+/* Emit the completion event and hand the session to the recorders */
+static void session_end(Session *s, int rc, const char *start_ts, const char *fname) {
+    session_close(s, rc);
+    session_report(s->sa, &s->ev, start_ts, fname);
+}
+
+/* TFTP session thread */
+static void *session_thread_main(void *arg) {
+    SessionArg *sa = (SessionArg *)arg;
+    int is_write = (sa->opcode == TFTP_OPCODE_WRQ);
+
+    char start_ts[32];
+    Session s;
+    session_begin(&s, sa, start_ts, sizeof(start_ts));
+
+    char fname_sanitized[256];
+    sanitize_filename(fname_sanitized, sizeof(fname_sanitized), sa->filename);
+    if (fname_sanitized[0] == '\0') {
+        log_msg(LOG_ERROR, "Rejected unsafe filename from %s: \"%s\"",
+                sa->client_ip, sa->filename);
+        send_early_error(sa, TFTP_ERR_ACCESS, "Access violation");
+        goto done;
+    }
+
+    char path[PATH_MAX];
+    build_file_path(path, sizeof(path), fname_sanitized);
+
+    int rc = is_write ? run_write_session(&s, path, fname_sanitized)
+                      : run_read_session(&s, path, fname_sanitized);
+    session_end(&s, rc, start_ts, fname_sanitized);
+
+    if (is_write && rc == 0) write_session_dally(&s);
+    if (s.sock >= 0) close(s.sock);
 
 done:
     free(sa);
+    __atomic_sub_fetch(&g_active_sessions, 1, __ATOMIC_RELEASE);
     return NULL;
 }
 
-/* Parse RRQ packet and extract filename + mode */
-static int parse_rrq(const unsigned char *buf, ssize_t len,
-                     char *filename, size_t filename_size,
-                     char *mode, size_t mode_size) {
+/* Run a session on its own thread (kernel socket path) */
+static void session_spawn(const SessionArg *tmpl) {
+    SessionArg *sa = (SessionArg *)malloc(sizeof(SessionArg));
+    if (!sa) return;
+    *sa = *tmpl;
+
+    pthread_t th;
+    __atomic_add_fetch(&g_active_sessions, 1, __ATOMIC_RELAXED);
+    if (thread_spawn(&th, session_thread_main, sa,
+                     (size_t)g_cfg->thread_stack_kb * 1024, 1) != 0) {
+        log_msg(LOG_ERROR, "Failed to create session thread");
+        __atomic_sub_fetch(&g_active_sessions, 1, __ATOMIC_RELAXED);
+        free(sa);
+    }
+}
+
+/* Parse RRQ/WRQ packet: filename, mode and any options */
+static int parse_request(const unsigned char *buf, ssize_t len,
+                         char *filename, size_t filename_size,
+                         char *mode, size_t mode_size,
+                         TftpOptions *opts) {
     if (len < 4) return -1;
     /* skip opcode (2 bytes) */
     const char *p = (const char *)(buf + 2);
@@ -332,21 +1407,691 @@ static int parse_rrq(const unsigned char *buf, ssize_t len,
     if (p >= end) return -1;
     const char *md = p;
     while (p < end && *p != '\0') p++;
-    if (p > end) return -1;
+    if (p >= end) return -1;
     safe_strcpy(mode, mode_size, md);
+    p++;
+
+    /* Options: name\0value\0 pairs; unknown or malformed ones are ignored */
+    memset(opts, 0, sizeof(*opts));
+    while (p < end) {
+        const char *name = p;
+        while (p < end && *p != '\0') p++;
+        if (p >= end) break;
+        p++;
+        const char *val = p;
+        while (p < end && *p != '\0') p++;
+        if (p >= end) break;
+        p++;
+
+        char *vend = NULL;
+        long long v = strtoll(val, &vend, 10);
+        if (vend == val || *vend != '\0') continue;
+
+        if (strcasecmp(name, "blksize") == 0) {
+            if (v >= TFTP_MIN_BLKSIZE && v <= TFTP_MAX_BLKSIZE) opts->blksize = (int)v;
+        } else if (strcasecmp(name, "timeout") == 0) {
+            if (v >= 1 && v <= 255) opts->timeout = (int)v;
+        } else if (strcasecmp(name, "tsize") == 0) {
+            if (v >= 0) {
+                opts->has_tsize = 1;
+                opts->tsize = v;
+            }
+        }
+    }
     return 0;
 }
 
-/* Listener thread main loop */
-static void *listener_thread_main(void *arg) {
-    ListenerArg *la = (ListenerArg *)arg;
+/* Handle one datagram received on a listener socket */
+static void handle_request(const Listener *la, const unsigned char *buf, ssize_t n,
+                           const struct sockaddr_in *cli, socklen_t cli_len) {
+    uint64_t rx_us = mono_us();
+    if (n < 2) return;
+
+    uint16_t opcode = (buf[0] << 8) | buf[1];
+    if (opcode != TFTP_OPCODE_RRQ && opcode != TFTP_OPCODE_WRQ) {
+        log_msg(LOG_DEBUG, "Ignoring opcode=%u on listener", opcode);
+        return;
+    }
+    if (opcode == TFTP_OPCODE_WRQ && !g_cfg->allow_upload) {
+        log_msg(LOG_DEBUG, "Rejecting WRQ: uploads disabled");
+        send_error_packet(la->sock, cli, cli_len, TFTP_ERR_ACCESS, "Uploads disabled");
+        return;
+    }
+
+    char filename[256];
+    char mode[32];
+    TftpOptions opts;
+    if (parse_request(buf, n, filename, sizeof(filename), mode, sizeof(mode), &opts) != 0) {
+        log_msg(LOG_ERROR, "Failed to parse %s", opcode == TFTP_OPCODE_RRQ ? "RRQ" : "WRQ");
+        return;
+    }
+
+    int reply;
+    if (la->acl && !acl_allow_path(la->acl, &cli->sin_addr, filename, &reply)) {
+        if (reply) send_error_packet(la->sock, cli, cli_len, TFTP_ERR_ACCESS, "Access violation");
+        return;
+    }
+
+    char cli_ip[64];
+    inet_ntop(AF_INET, &cli->sin_addr, cli_ip, sizeof(cli_ip));
+    int cli_port = ntohs(cli->sin_port);
+
+    log_msg(LOG_INFO, "%s from %s:%d file=\"%s\" mode=\"%s\"",
+            opcode == TFTP_OPCODE_RRQ ? "RRQ" : "WRQ",
+            cli_ip, cli_port, filename, mode);
+
+    SessionArg sa;
+    memset(&sa, 0, sizeof(sa));
+    safe_strcpy(sa.bind_addr, sizeof(sa.bind_addr), la->bind_addr);
+    sa.bind_port = la->bind_port;
+    safe_strcpy(sa.client_ip, sizeof(sa.client_ip), cli_ip);
+    sa.client_port = cli_port;
+    sa.opcode = opcode;
+    safe_strcpy(sa.filename, sizeof(sa.filename), filename);
+    safe_strcpy(sa.mode, sizeof(sa.mode), mode);
+    sa.opts = opts;
+    sa.rx_us = rx_us;
+    session_spawn(&sa);
+}
+
+/*
+ * AF_XDP fast path (xdp=): one thread serves RRQs for one listener from
+ * an XDP socket. Each session owns a UMEM frame and a port from the
+ * configured range; DATA is read straight into the frame behind the
+ * Ethernet/IP/UDP headers built here, and the xfer state machine runs
+ * event-driven off the RX ring and a deadline per session. Requests the
+ * fast path does not cover (netascii, files not available locally, no
+ * free slot) go to a normal session thread on a kernel socket.
+ */
+#define XDP_BATCH 64
+
+typedef struct {
+    int active;
+    int live_idx;            /* position in XdpEngine.live */
+    Session s;
+    SessionArg sa;
+    char start_ts[32];
+    char fname[256];
+    XdpFlow flow;
+    uint64_t frame;          /* TX frame holding the outstanding packet */
+    int tx_busy;             /* the frame is queued or on the wire */
+    XferAction pending;      /* FILL/SEND deferred until the frame is back */
+    uint64_t deadline_us;
+    uint64_t fill_wait_us;   /* the pending FILL waits for readahead since */
+    ReadSource src;
+    Bundle *pin;
+    XferRead x;
+    size_t oack_len;
+    unsigned char oack[512];
+} XdpSession;
+
+typedef struct {
+    XdpPort *port;
+    const Listener *la;
+    uint16_t port_lo;
+    int max_blksize;
+    XdpSession *slots;       /* slot i serves session port port_lo + i */
+    int nslots;
+    int *live;               /* active slots */
+    int nlive;
+    int *free_fifo;          /* free slots, least recently used first */
+    int free_head;
+    int free_count;
+    int *owner;              /* frame index -> slot, -1 = no session */
+} XdpEngine;
+
+static XdpEngine *g_xdp = NULL;
+static pthread_t g_xdp_thread;
+static int g_xdp_stop = 0;         /* 1 = intake stopped, finish sessions; 2 = exit */
+
+/*
+ * Work the engine thread must not block on: session events with their
+ * request log lines and statistics, and readahead for blocks that are
+ * not in the page cache yet. One worker runs it in order.
+ */
+#define XDP_READAHEAD (1 << 20)
+#define XDP_FILL_POLL_US 1000
+
+enum { XDP_JOB_EVENT, XDP_JOB_END, XDP_JOB_READAHEAD };
+
+typedef struct XdpJob {
+    struct XdpJob *next;
+    int kind;
+    Event ev;                /* EVENT, END */
+    SessionArg sa;           /* END */
+    char start_ts[32];
+    char fname[256];
+    int fd;                  /* READAHEAD: a dup of the session's source */
+    long long off;
+} XdpJob;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    XdpJob *head;
+    XdpJob **tail;
+    int busy;
+    int stop;
+    int started;
+    pthread_t thread;
+} g_xdp_jobs = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                 NULL, &g_xdp_jobs.head, 0, 0, 0, 0 };
+
+static void xdp_job_run(XdpJob *j) {
+    switch (j->kind) {
+    case XDP_JOB_EVENT:
+        event_emit(&j->ev);
+        break;
+    case XDP_JOB_END:
+        session_report(&j->sa, &j->ev, j->start_ts, j->fname);
+        break;
+    case XDP_JOB_READAHEAD:
+        posix_fadvise(j->fd, (off_t)j->off, XDP_READAHEAD, POSIX_FADV_WILLNEED);
+        close(j->fd);
+        break;
+    }
+}
+
+/* Queue j for the worker; without one it runs here */
+static void xdp_job_push(XdpJob *j) {
+    if (!g_xdp_jobs.started) {
+        xdp_job_run(j);
+        free(j);
+        return;
+    }
+    j->next = NULL;
+    pthread_mutex_lock(&g_xdp_jobs.lock);
+    *g_xdp_jobs.tail = j;
+    g_xdp_jobs.tail = &j->next;
+    pthread_cond_signal(&g_xdp_jobs.cond);
+    pthread_mutex_unlock(&g_xdp_jobs.lock);
+}
+
+static void xdp_job_event(const Event *ev) {
+    XdpJob *j = (XdpJob *)malloc(sizeof(XdpJob));
+    if (!j) {
+        event_emit(ev);
+        return;
+    }
+    j->kind = XDP_JOB_EVENT;
+    j->ev = *ev;
+    xdp_job_push(j);
+}
+
+static void *xdp_worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_xdp_jobs.lock);
+    for (;;) {
+        g_xdp_jobs.busy = 0;
+        while (!g_xdp_jobs.head && !g_xdp_jobs.stop) {
+            pthread_cond_wait(&g_xdp_jobs.cond, &g_xdp_jobs.lock);
+        }
+        /* On stop, whatever is queued still runs */
+        XdpJob *j = g_xdp_jobs.head;
+        if (!j) break;
+        g_xdp_jobs.head = j->next;
+        if (!g_xdp_jobs.head) g_xdp_jobs.tail = &g_xdp_jobs.head;
+        g_xdp_jobs.busy = 1;
+        pthread_mutex_unlock(&g_xdp_jobs.lock);
+        xdp_job_run(j);
+        free(j);
+        pthread_mutex_lock(&g_xdp_jobs.lock);
+    }
+    pthread_mutex_unlock(&g_xdp_jobs.lock);
+    return NULL;
+}
+
+/* Wait up to timeout_ms for the worker to run what is queued */
+static void xdp_jobs_flush(int timeout_ms) {
+    if (!g_xdp_jobs.started) return;
+    uint64_t deadline = mono_us() + (uint64_t)timeout_ms * 1000;
+    pthread_mutex_lock(&g_xdp_jobs.lock);
+    while ((g_xdp_jobs.head || g_xdp_jobs.busy) && mono_us() < deadline) {
+        pthread_mutex_unlock(&g_xdp_jobs.lock);
+        usleep(10000);
+        pthread_mutex_lock(&g_xdp_jobs.lock);
+    }
+    pthread_mutex_unlock(&g_xdp_jobs.lock);
+}
+
+static void xdp_send_error(XdpEngine *e, const XdpFlow *flow, uint16_t code, const char *msg) {
+    uint64_t frame = xdp_frame_alloc(e->port);
+    if (frame == UINT64_MAX) return;
+    size_t len = xfer_error_packet(xdp_frame_payload(e->port, frame), 516, code, msg);
+    if (xdp_tx(e->port, frame, flow, len) != 0) xdp_frame_free(e->port, frame);
+}
+
+static void xdp_release_slot(XdpEngine *e, XdpSession *xs) {
+    int slot = (int)(xs - e->slots);
+    int last = e->live[--e->nlive];
+    e->live[xs->live_idx] = last;
+    e->slots[last].live_idx = xs->live_idx;
+    xs->active = 0;
+    e->free_fifo[(e->free_head + e->free_count++) % e->nslots] = slot;
+}
+
+static void xdp_finish(XdpEngine *e, XdpSession *xs, int ok) {
+    read_finish(&xs->s, &xs->x);
+    session_close(&xs->s, ok ? 0 : -1);
+    XdpJob *j = (XdpJob *)malloc(sizeof(XdpJob));
+    if (j) {
+        j->kind = XDP_JOB_END;
+        j->ev = xs->s.ev;
+        j->sa = xs->sa;
+        memcpy(j->start_ts, xs->start_ts, sizeof(j->start_ts));
+        memcpy(j->fname, xs->fname, sizeof(j->fname));
+        xdp_job_push(j);
+    } else {
+        session_report(&xs->sa, &xs->s.ev, xs->start_ts, xs->fname);
+    }
+
+    if (xs->src.fd >= 0) close(xs->src.fd);
+    bundle_release(xs->pin);
+    /* A frame still on the wire is freed by its completion */
+    e->owner[xs->frame / XDP_FRAME_SIZE] = -1;
+    if (!xs->tx_busy) xdp_frame_free(e->port, xs->frame);
+    xdp_release_slot(e, xs);
+    __atomic_sub_fetch(&g_active_sessions, 1, __ATOMIC_RELEASE);
+}
+
+/* Read the next block into the frame without waiting on the disk: -2
+ * while it is not in the page cache, with readahead queued to the worker.
+ * After timeout_sec of that the read blocks like a socket session's. */
+static ssize_t xdp_fill(XdpSession *xs) {
+    ReadCtx rc = { &xs->s, &xs->src, xs->fname };
+    unsigned char *buf = xs->x.pkt + 4;
+    size_t len = xs->x.blksize;
+    uint64_t now = mono_us();
+    if (xs->src.mem ||
+        (xs->fill_wait_us && now - xs->fill_wait_us > (uint64_t)xs->s.timeout_sec * 1000000ULL)) {
+        xs->fill_wait_us = 0;
+        return read_fill(&rc, buf, len, xs->x.off);
+    }
+
+    struct iovec iov = { buf, len };
+    ssize_t r = preadv2(xs->src.fd, &iov, 1, (off_t)xs->x.off, RWF_NOWAIT);
+    if (r < 0 && errno != EAGAIN) return read_fill(&rc, buf, len, xs->x.off);
+    if (r >= 0 && ((size_t)r == len || xs->x.off + r >= xs->src.size)) {
+        xs->fill_wait_us = 0;
+        return r;
+    }
+    if (!xs->fill_wait_us) {
+        xs->fill_wait_us = now;
+        XdpJob *j = (XdpJob *)malloc(sizeof(XdpJob));
+        if (j && (j->fd = dup(xs->src.fd)) >= 0) {
+            j->kind = XDP_JOB_READAHEAD;
+            j->off = xs->x.off;
+            xdp_job_push(j);
+        } else {
+            free(j);
+        }
+    }
+    return -2;
+}
+
+/* Drive one session until it has to wait for the peer, a timeout or its frame */
+static void xdp_step(XdpEngine *e, XdpSession *xs, XferAction a) {
+    for (;;) {
+        if ((a == XFER_FILL || a == XFER_SEND) && xs->tx_busy) {
+            xs->pending = a;
+            return;
+        }
+        xs->pending = XFER_WAIT;
+
+        switch (a) {
+        case XFER_FILL: {
+            ssize_t r = xdp_fill(xs);
+            if (r == -2) {
+                xs->pending = XFER_FILL;
+                return;
+            }
+            if (r < 0) {
+                xdp_send_error(e, &xs->flow, TFTP_ERR_UNDEF, "Read error");
+                xs->x.fail = "read_error";
+                xdp_finish(e, xs, 0);
+                return;
+            }
+            a = xfer_read_filled(&xs->x, (size_t)r);
+            break;
+        }
+        case XFER_SEND: {
+            /* DATA is already in the frame; the OACK is copied in */
+            unsigned char *payload = xdp_frame_payload(e->port, xs->frame);
+            if (xs->x.out != payload) memcpy(payload, xs->x.out, xs->x.out_len);
+            /* A full TX ring counts as a lost packet: the timeout resends */
+            if (xdp_tx(e->port, xs->frame, &xs->flow, xs->x.out_len) == 0) xs->tx_busy = 1;
+            if (xs->x.block > 0) {
+                clk_mark(&xs->s, &xs->s.ev.timing.first_data_us);
+                clk_sent(&xs->s, xs->x.retries > 0, xs->x.block);
+            }
+            xs->deadline_us = mono_us() + (uint64_t)xs->s.timeout_sec * 1000000ULL;
+            return;
+        }
+        case XFER_WAIT:
+            return;
+        case XFER_DONE:
+            xdp_finish(e, xs, 1);
+            return;
+        case XFER_FAIL:
+        default:
+            xdp_finish(e, xs, 0);
+            return;
+        }
+    }
+}
+
+/* Open the content for the fast path: bundle or a regular local file */
+static int xdp_open_source(XdpSession *xs, const char *path) {
+    FcacheKey key;
+    xs->pin = NULL;
+    if (g_cfg->root_bundle && bundle_source(xs->fname, &xs->src, &key, &xs->pin) == 0) {
+        warm_hint_mem(xs->src.mem, (size_t)xs->src.size);
+        return 0;
+    }
+    xs->src.mem = NULL;
+    xs->src.fetch = NULL;
+    xs->src.gz = NULL;
+    xs->src.na = NULL;
+    xs->src.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (xs->src.fd < 0 && errno == ENOENT && g_cfg->compressed_storage) {
+        /* Only a cached decompressed copy; inflating is left to the socket path */
+        char gz_path[PATH_MAX];
+        struct stat gz_st;
+        long long size;
+        if (snprintf(gz_path, sizeof(gz_path), "%s.gz", path) >= (int)sizeof(gz_path) ||
+            stat(gz_path, &gz_st) != 0 || !S_ISREG(gz_st.st_mode)) {
+            return -1;
+        }
+        fcache_key_from_stat(&key, &gz_st);
+        xs->src.fd = fcache_get(&key, FCACHE_GUNZIP, &size);
+    }
+    if (xs->src.fd < 0) return -1;
+    struct stat st;
+    if (fstat(xs->src.fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(xs->src.fd);
+        return -1;
+    }
+    xs->src.size = (long long)st.st_size;
+    warm_hint_fd(xs->src.fd, xs->src.size);
+    return 0;
+}
+
+/* Start an RRQ on the fast path; -1 leaves it to the socket path */
+static int xdp_start_session(XdpEngine *e, const XdpFlow *flow, const SessionArg *sa) {
+    if (strcasecmp(sa->mode, "octet") != 0 || e->free_count == 0) return -1;
+
+    int slot = e->free_fifo[e->free_head];
+    XdpSession *xs = &e->slots[slot];
+    sanitize_filename(xs->fname, sizeof(xs->fname), sa->filename);
+    if (xs->fname[0] == '\0') return -1;
+    char path[PATH_MAX];
+    build_file_path(path, sizeof(path), xs->fname);
+
+    xs->frame = xdp_frame_alloc(e->port);
+    if (xs->frame == UINT64_MAX) return -1;
+    if (xdp_open_source(xs, path) != 0) {
+        xdp_frame_free(e->port, xs->frame);
+        return -1;
+    }
+
+    e->free_head = (e->free_head + 1) % e->nslots;
+    e->free_count--;
+    xs->active = 1;
+    xs->live_idx = e->nlive;
+    e->live[e->nlive++] = slot;
+    e->owner[xs->frame / XDP_FRAME_SIZE] = slot;
+    xs->tx_busy = 0;
+    xs->flow = *flow;
+    xs->flow.local_port = htons((uint16_t)(e->port_lo + slot));
+    __atomic_add_fetch(&g_active_sessions, 1, __ATOMIC_RELAXED);
+
+    xs->sa = *sa;
+    if (xs->sa.opts.blksize > e->max_blksize) xs->sa.opts.blksize = e->max_blksize;
+    xs->fill_wait_us = 0;
+    Event start;
+    session_init(&xs->s, &xs->sa, xs->start_ts, sizeof(xs->start_ts), &start);
+    xdp_job_event(&start);
+    clk_mark(&xs->s, &xs->s.ev.timing.open_us);
+
+    xs->oack_len = negotiate_options(&xs->s, xs->src.size, xs->oack, sizeof(xs->oack));
+    XferAction a = xfer_read_start(&xs->x, xdp_frame_payload(e->port, xs->frame),
+                                   (size_t)xs->s.blksize, g_cfg->max_retries,
+                                   xs->oack, xs->oack_len);
+    xdp_step(e, xs, a);
+    return 0;
+}
+
+/* An RRQ redirected from the listener port */
+static void xdp_intake(XdpEngine *e, const XdpPacket *p) {
+    uint64_t rx_us = mono_us();
+    const Listener *la = e->la;
+    struct in_addr cli_addr;
+    cli_addr.s_addr = p->flow.peer_ip;
+    if (la->acl && !acl_allow_addr(la->acl, &cli_addr)) return;
+    /* Queued before intake stopped: the redirect is gone, so the client's
+     * retry reaches the new process through the shared listener socket */
+    if (__atomic_load_n(&g_xdp_stop, __ATOMIC_ACQUIRE)) return;
+
+    char filename[256];
+    char mode[32];
+    TftpOptions opts;
+    if (parse_request(p->payload, (ssize_t)p->len, filename, sizeof(filename),
+                      mode, sizeof(mode), &opts) != 0) {
+        log_msg(LOG_ERROR, "Failed to parse RRQ");
+        return;
+    }
+    int reply;
+    if (la->acl && !acl_allow_path(la->acl, &cli_addr, filename, &reply)) {
+        if (reply) xdp_send_error(e, &p->flow, TFTP_ERR_ACCESS, "Access violation");
+        return;
+    }
+
+    SessionArg sa;
+    memset(&sa, 0, sizeof(sa));
+    safe_strcpy(sa.bind_addr, sizeof(sa.bind_addr), la->bind_addr);
+    sa.bind_port = la->bind_port;
+    inet_ntop(AF_INET, &cli_addr, sa.client_ip, sizeof(sa.client_ip));
+    sa.client_port = ntohs(p->flow.peer_port);
+    sa.opcode = TFTP_OPCODE_RRQ;
+    safe_strcpy(sa.filename, sizeof(sa.filename), filename);
+    safe_strcpy(sa.mode, sizeof(sa.mode), mode);
+    sa.opts = opts;
+    sa.rx_us = rx_us;
+
+    log_msg(LOG_INFO, "RRQ from %s:%d file=\"%s\" mode=\"%s\"",
+            sa.client_ip, sa.client_port, filename, mode);
+    if (xdp_start_session(e, &p->flow, &sa) != 0) {
+        log_msg(LOG_DEBUG, "xdp: %s:%d handed to the socket path", sa.client_ip, sa.client_port);
+        session_spawn(&sa);
+    }
+}
+
+/* A packet for a session port */
+static void xdp_session_packet(XdpEngine *e, const XdpPacket *p) {
+    int slot = (int)ntohs(p->flow.local_port) - e->port_lo;
+    if (slot < 0 || slot >= e->nslots || !e->slots[slot].active) return;
+    XdpSession *xs = &e->slots[slot];
+    if (p->flow.peer_ip != xs->flow.peer_ip || p->flow.peer_port != xs->flow.peer_port) {
+        xdp_send_error(e, &p->flow, TFTP_ERR_UNKNOWN_TID, "Unknown transfer ID");
+        return;
+    }
+    XferAction a = xfer_read_recv(&xs->x, p->payload, p->len);
+    if (a != XFER_WAIT && a != XFER_FAIL) clk_answered(&xs->s);
+    xdp_step(e, xs, a);
+}
+
+/* Completed transmissions: session frames become writable, others are freed */
+static void xdp_reap(XdpEngine *e) {
+    uint64_t done[XDP_BATCH];
+    int n;
+    while ((n = xdp_tx_reap(e->port, done, XDP_BATCH)) > 0) {
+        for (int i = 0; i < n; ++i) {
+            int slot = e->owner[done[i] / XDP_FRAME_SIZE];
+            if (slot >= 0) e->slots[slot].tx_busy = 0;
+            else xdp_frame_free(e->port, done[i]);
+        }
+    }
+}
+
+/* Resume deferred steps and fire expired timers; returns ms to the next deadline */
+static int xdp_timers(XdpEngine *e) {
+    uint64_t now = mono_us();
+    uint64_t next = now + 100000;
+    for (int i = 0; i < e->nlive; ++i) {
+        XdpSession *xs = &e->slots[e->live[i]];
+        if (xs->pending != XFER_WAIT) {
+            if (!xs->tx_busy) xdp_step(e, xs, xs->pending);
+        } else if (now >= xs->deadline_us) {
+            xdp_step(e, xs, xfer_read_expired(&xs->x));
+        }
+        /* The step may have finished the session and moved another one here */
+        if (i < e->nlive) {
+            xs = &e->slots[e->live[i]];
+            if (xs->pending == XFER_WAIT && xs->deadline_us < next) next = xs->deadline_us;
+            if (xs->fill_wait_us && now + XDP_FILL_POLL_US < next) next = now + XDP_FILL_POLL_US;
+        }
+    }
+    return next > now ? (int)((next - now + 999) / 1000) : 0;
+}
+
+static void *xdp_thread_main(void *arg) {
+    XdpEngine *e = (XdpEngine *)arg;
+    XdpPacket pkts[XDP_BATCH];
+    uint16_t listen_port = htons((uint16_t)e->la->bind_port);
+    int wait_ms = 100;
+
+    for (;;) {
+        int stop = __atomic_load_n(&g_xdp_stop, __ATOMIC_ACQUIRE);
+        if (stop == 2 || (stop == 1 && e->nlive == 0)) break;
+        if (xdp_wait(e->port, wait_ms) < 0) {
+            log_msg(LOG_ERROR, "xdp: poll failed: %s", strerror(errno));
+            break;
+        }
+        xdp_reap(e);
+        int n = xdp_rx(e->port, pkts, XDP_BATCH);
+        for (int i = 0; i < n; ++i) {
+            if (pkts[i].flow.local_port == listen_port) xdp_intake(e, &pkts[i]);
+            else xdp_session_packet(e, &pkts[i]);
+            xdp_rx_done(e->port, pkts[i].frame);
+        }
+        wait_ms = xdp_timers(e);
+        xdp_tx_flush(e->port);
+    }
+    return NULL;
+}
+
+/* Run what is queued, then end the worker */
+static void xdp_worker_stop(void) {
+    if (!g_xdp_jobs.started) return;
+    pthread_mutex_lock(&g_xdp_jobs.lock);
+    g_xdp_jobs.stop = 1;
+    pthread_cond_signal(&g_xdp_jobs.cond);
+    pthread_mutex_unlock(&g_xdp_jobs.lock);
+    pthread_join(g_xdp_jobs.thread, NULL);
+    g_xdp_jobs.started = 0;
+}
+
+/* Attach the fast path to its listener; on any failure the listener keeps
+ * serving on its kernel socket alone */
+static void xdp_start(const ServerConfig *cfg, const Listener *listeners, int n) {
+    const XdpListenerConfig *xc = &cfg->xdp;
+    const Listener *la = NULL;
+    for (int i = 0; i < n; ++i) {
+        if (listeners[i].sock >= 0 && listeners[i].bind_port == xc->port &&
+            strcmp(listeners[i].bind_addr, xc->addr) == 0) {
+            la = &listeners[i];
+        }
+    }
+    if (!la) {
+        log_msg(LOG_ERROR, "xdp: %s:%d is not an active listener", xc->addr, xc->port);
+        return;
+    }
+
+    XdpConfig xcfg;
+    memset(&xcfg, 0, sizeof(xcfg));
+    safe_strcpy(xcfg.ifname, sizeof(xcfg.ifname), xc->ifname);
+    xcfg.queue = xc->queue;
+    xcfg.native = xc->native;
+    xcfg.zerocopy = xc->zerocopy;
+    xcfg.frames = (uint32_t)xc->frames;
+    inet_pton(AF_INET, xc->addr, &xcfg.addr);
+    xcfg.port = (uint16_t)xc->port;
+    xcfg.port_lo = (uint16_t)xc->port_lo;
+    xcfg.port_hi = (uint16_t)xc->port_hi;
+
+    XdpEngine *e = (XdpEngine *)calloc(1, sizeof(XdpEngine));
+    if (!e) return;
+    e->la = la;
+    e->port_lo = xcfg.port_lo;
+    e->nslots = xc->port_hi - xc->port_lo + 1;
+    /* Every session holds one TX frame; keep a quarter of them for errors */
+    int tx_frames = xc->frames / 2;
+    if (e->nslots > tx_frames - tx_frames / 4) e->nslots = tx_frames - tx_frames / 4;
+    e->slots = (XdpSession *)calloc((size_t)e->nslots, sizeof(XdpSession));
+    e->live = (int *)calloc((size_t)e->nslots, sizeof(int));
+    e->free_fifo = (int *)calloc((size_t)e->nslots, sizeof(int));
+    e->owner = (int *)malloc((size_t)xc->frames * sizeof(int));
+    if (!e->slots || !e->live || !e->free_fifo || !e->owner ||
+        !(e->port = xdp_open(&xcfg))) {
+        log_msg(LOG_ERROR, "xdp: fast path disabled, %s:%d stays on the socket path",
+                xc->addr, xc->port);
+        goto fail;
+    }
+    for (int i = 0; i < e->nslots; ++i) e->free_fifo[i] = i;
+    e->free_count = e->nslots;
+    for (int i = 0; i < xc->frames; ++i) e->owner[i] = -1;
+    size_t payload = xdp_max_payload(e->port) - 4;
+    e->max_blksize = (int)payload < cfg->max_blksize ? (int)payload : cfg->max_blksize;
+
+    if (thread_spawn(&g_xdp_jobs.thread, xdp_worker_main, NULL,
+                     (size_t)cfg->thread_stack_kb * 1024, 0) != 0) {
+        log_msg(LOG_ERROR, "xdp: cannot start worker thread");
+        goto fail;
+    }
+    g_xdp_jobs.started = 1;
+    if (thread_spawn(&g_xdp_thread, xdp_thread_main, e,
+                     (size_t)cfg->thread_stack_kb * 1024, 0) != 0) {
+        log_msg(LOG_ERROR, "xdp: cannot start thread");
+        xdp_worker_stop();
+        goto fail;
+    }
+    log_msg(LOG_INFO, "xdp: serving RRQs for %s:%d, %d session ports from %d, blksize <= %d",
+            xc->addr, xc->port, e->nslots, xc->port_lo, e->max_blksize);
+    g_xdp = e;
+    return;
+
+fail:
+    xdp_close(e->port);
+    free(e->slots);
+    free(e->live);
+    free(e->free_fifo);
+    free(e->owner);
+    free(e);
+}
+
+/* Stop the fast path once drain_sessions() is done */
+static void xdp_stop(void) {
+    if (!g_xdp) return;
+    __atomic_store_n(&g_xdp_stop, 2, __ATOMIC_RELEASE);
+    pthread_join(g_xdp_thread, NULL);
+    xdp_worker_stop();
+    xdp_close(g_xdp->port);
+    free(g_xdp->slots);
+    free(g_xdp->live);
+    free(g_xdp->free_fifo);
+    free(g_xdp->owner);
+    free(g_xdp);
+    g_xdp = NULL;
+}
+
+/* Create and bind one listener socket (non-blocking) */
+static int listener_open(Listener *la) {
     log_msg(LOG_INFO, "Starting listener on %s:%d", la->bind_addr, la->bind_port);
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sock < 0) {
         log_msg(LOG_ERROR, "Failed to create listener socket: %s", strerror(errno));
-        free(la);
-        return NULL;
+        return -1;
     }
 
     int reuse = 1;
@@ -359,96 +2104,299 @@ static void *listener_thread_main(void *arg) {
     if (inet_pton(AF_INET, la->bind_addr, &addr.sin_addr) != 1) {
         log_msg(LOG_ERROR, "Invalid bind address: %s", la->bind_addr);
         close(sock);
-        free(la);
-        return NULL;
+        return -1;
     }
 
     if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
         log_msg(LOG_ERROR, "Failed to bind %s:%d: %s",
                 la->bind_addr, la->bind_port, strerror(errno));
         close(sock);
-        free(la);
-        return NULL;
+        return -1;
     }
+    la->sock = sock;
+    return 0;
+}
 
+/*
+ * Intake loop: one thread serves every listener socket through epoll, so
+ * hundreds of listeners cost one fd each rather than one thread each.
+ */
+static void *listener_thread_main(void *arg) {
+    int epfd = *(int *)arg;
     unsigned char buf[1500];
+    struct epoll_event events[64];
 
     while (1) {
-        struct sockaddr_in cli;
-        socklen_t cli_len = sizeof(cli);
-        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0,
-                             (struct sockaddr *)&cli, &cli_len);
-        if (n < 0) {
+        int nev = epoll_wait(epfd, events, 64, -1);
+        if (nev < 0) {
             if (errno == EINTR) continue;
-            log_msg(LOG_ERROR, "recvfrom error on %s:%d: %s",
-                    la->bind_addr, la->bind_port, strerror(errno));
-            continue;
+            log_msg(LOG_ERROR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < nev; ++i) {
+            const Listener *la = (const Listener *)events[i].data.ptr;
+            if (!la) return NULL; /* g_stop_fd: listeners were handed over */
+
+            /* Drain the socket; it is non-blocking */
+            while (1) {
+                struct sockaddr_in cli;
+                socklen_t cli_len = sizeof(cli);
+                ssize_t n = recvfrom(la->sock, buf, sizeof(buf), 0,
+                                     (struct sockaddr *)&cli, &cli_len);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        log_msg(LOG_ERROR, "recvfrom error on %s:%d: %s",
+                                la->bind_addr, la->bind_port, strerror(errno));
+                    }
+                    break;
+                }
+                /* Denied clients are dropped before any parsing or logging */
+                if (la->acl && !acl_allow_addr(la->acl, &cli.sin_addr)) continue;
+                handle_request(la, buf, n, &cli, cli_len);
+            }
         }
-        if (n < 2) continue;
+    }
+    return NULL;
+}
 
-        uint16_t opcode = (buf[0] << 8) | buf[1];
-        if (opcode != TFTP_OPCODE_RRQ) {
-            log_msg(LOG_DEBUG, "Ignoring non-RRQ opcode=%u", opcode);
-            continue;
+/* Old side of an upgrade: hand the listener sockets to a new process,
+ * then stop the intake loop. A failed attempt leaves this process serving. */
+static void *handoff_thread_main(void *arg) {
+    int hs = *(int *)arg;
+    free(arg);
+
+    for (;;) {
+        int conn = accept(hs, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            log_msg(LOG_ERROR, "upgrade_socket: accept failed: %s", strerror(errno));
+            break;
         }
 
-        char filename[256];
-        char mode[32];
-        if (parse_rrq(buf, n, filename, sizeof(filename), mode, sizeof(mode)) != 0) {
-            log_msg(LOG_ERROR, "Failed to parse RRQ");
-            continue;
+        HandoffListener *ls = (HandoffListener *)calloc((size_t)g_num_listeners + 1,
+                                                        sizeof(HandoffListener));
+        int rc = -1;
+        if (ls) {
+            for (int i = 0; i < g_num_listeners; ++i) {
+                safe_strcpy(ls[i].addr, sizeof(ls[i].addr), g_listeners[i].bind_addr);
+                ls[i].port = g_listeners[i].bind_port;
+                ls[i].fd = g_listeners[i].sock;
+            }
+            rc = handoff_give(conn, ls, g_num_listeners);
+            free(ls);
         }
+        close(conn);
 
-        char cli_ip[64];
-        inet_ntop(AF_INET, &cli.sin_addr, cli_ip, sizeof(cli_ip));
-        int cli_port = ntohs(cli.sin_port);
+        if (rc == 0) {
+            log_msg(LOG_INFO, "Listeners handed over to a new process, stopping intake");
+            uint64_t one = 1;
+            if (write(g_stop_fd, &one, sizeof(one)) < 0) {
+                log_msg(LOG_ERROR, "Failed to stop intake: %s", strerror(errno));
+            }
+            break;
+        }
+        log_msg(LOG_ERROR, "Listener handoff aborted: %s", strerror(errno));
+    }
+    close(hs);
+    return NULL;
+}
 
-        log_msg(LOG_INFO, "RRQ from %s:%d file=\"%s\" mode=\"%s\"",
-                cli_ip, cli_port, filename, mode);
+static void handoff_start(const ServerConfig *cfg) {
+    int *hs = (int *)malloc(sizeof(int));
+    if (!hs) return;
+    *hs = handoff_listen(cfg->upgrade_socket);
+    if (*hs < 0) {
+        log_msg(LOG_ERROR, "upgrade_socket %s: %s", cfg->upgrade_socket, strerror(errno));
+        free(hs);
+        return;
+    }
+    pthread_t th;
+    if (thread_spawn(&th, handoff_thread_main, hs, (size_t)cfg->thread_stack_kb * 1024, 1) != 0) {
+        log_msg(LOG_ERROR, "upgrade_socket: cannot start thread");
+        close(*hs);
+        free(hs);
+    }
+}
 
-        SessionArg *sa = (SessionArg *)calloc(1, sizeof(SessionArg));
-        safe_strcpy(sa->bind_addr, sizeof(sa->bind_addr), la->bind_addr);
-        sa->bind_port = la->bind_port;
-        safe_strcpy(sa->client_ip, sizeof(sa->client_ip), cli_ip);
-        sa->client_port = cli_port;
-        safe_strcpy(sa->filename, sizeof(sa->filename), filename);
+/* After a handoff: let running sessions finish before the process exits.
+ * Returns the number still running at the deadline. */
+static int drain_sessions(const ServerConfig *cfg) {
+    int left = __atomic_load_n(&g_active_sessions, __ATOMIC_ACQUIRE);
+    log_msg(LOG_INFO, "Draining %d active sessions (up to %d s)", left, cfg->upgrade_drain_sec);
 
-        pthread_t th;
-        if (pthread_create(&th, NULL, session_thread_main, sa) != 0) {
-            log_msg(LOG_ERROR, "Failed to create session thread");
-            free(sa);
-            continue;
-        }
-        pthread_detach(th);
+    uint64_t deadline = mono_us() + (uint64_t)cfg->upgrade_drain_sec * 1000000ULL;
+    while (left > 0 && mono_us() < deadline) {
+        usleep(100000);
+        left = __atomic_load_n(&g_active_sessions, __ATOMIC_ACQUIRE);
     }
-
-    close(sock);
-    free(la);
-    return NULL;
+    if (left > 0) log_msg(LOG_ERROR, "Exiting with %d sessions still active", left);
+    else log_msg(LOG_INFO, "All sessions finished");
+    return left;
 }
 
-int tftp_start(const ServerConfig *cfg) {
-    g_cfg = *cfg;
+int tftp_start(const ServerConfig *cfg, int takeover) {
+    g_cfg = cfg;
+    fcache_init((long long)cfg->content_cache_mb * 1024 * 1024, cfg->content_spill_dir,
+                (long long)cfg->content_spill_mb * 1024 * 1024);
+    if (cfg->root_bundle) {
+        bundle_serve(cfg->root_bundle, (size_t)cfg->thread_stack_kb * 1024);
+    }
+    if (cfg->origin_enabled) {
+        g_use_origin = (origin_init(cfg) == 0);
+        if (!g_use_origin) log_msg(LOG_ERROR, "origin_url disabled");
+    }
+    warm_init(cfg);
+    if (acl_init(cfg) != 0) {
+        log_msg(LOG_ERROR, "Failed to compile acl rules");
+        return -1;
+    }
+    if (stats_init(cfg) != 0) log_msg(LOG_ERROR, "stats_listen disabled");
 
-    pthread_t threads[MAX_LISTENERS];
+    if (cfg->io_backend == 1) {
+        g_use_uring = uring_probe() && uring_engine_start(cfg) == 0;
+        log_msg(LOG_INFO, "I/O backend: %s", g_use_uring ? "io_uring"
+                : "posix (io_uring unavailable, falling back)");
+    }
 
+    /* Upgrade: take the bound sockets of the running server first */
+    HandoffListener *inherited = NULL;
+    int num_inherited = 0;
+    int hconn = -1;
+    if (takeover) {
+        if (!cfg->upgrade_socket) {
+            log_msg(LOG_ERROR, "--upgrade needs upgrade_socket= in the config");
+        } else if ((hconn = handoff_connect(cfg->upgrade_socket)) < 0) {
+            log_msg(LOG_ERROR, "No server to take over at %s (%s), starting fresh",
+                    cfg->upgrade_socket, strerror(errno));
+        } else if (handoff_take(hconn, &inherited, &num_inherited) != 0) {
+            log_msg(LOG_ERROR, "Listener handoff failed: %s, starting fresh", strerror(errno));
+            close(hconn);
+            hconn = -1;
+        } else {
+            log_msg(LOG_INFO, "Took over %d listener sockets", num_inherited);
+        }
+    }
+
+    Listener *listeners = (Listener *)calloc((size_t)cfg->num_listeners, sizeof(Listener));
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    g_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!listeners || epfd < 0 || g_stop_fd < 0) {
+        log_msg(LOG_ERROR, "Failed to set up listeners: %s", strerror(errno));
+        free(listeners);
+        if (epfd >= 0) close(epfd);
+        return -1;
+    }
+    g_listeners = listeners;
+    g_num_listeners = cfg->num_listeners;
+
+    struct epoll_event sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.events = EPOLLIN;
+    sev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, g_stop_fd, &sev);
+
+    int active = 0;
     for (int i = 0; i < cfg->num_listeners; ++i) {
-        ListenerArg *la = (ListenerArg *)calloc(1, sizeof(ListenerArg));
+        Listener *la = &listeners[i];
         safe_strcpy(la->bind_addr, sizeof(la->bind_addr), cfg->listeners[i].addr);
         la->bind_port = cfg->listeners[i].port;
-
-        if (pthread_create(&threads[i], NULL, listener_thread_main, la) != 0) {
-            log_msg(LOG_ERROR, "Failed to create listener thread for %s:%d",
-                    la->bind_addr, la->bind_port);
-            free(la);
-            return -1;
+        la->sock = -1;
+        la->acl = acl_scope_for(la->bind_addr, la->bind_port);
+
+        for (int k = 0; k < num_inherited; ++k) {
+            if (inherited[k].fd >= 0 && inherited[k].port == la->bind_port &&
+                strcmp(inherited[k].addr, la->bind_addr) == 0) {
+                la->sock = inherited[k].fd;
+                inherited[k].fd = -1;
+                break;
+            }
+        }
+        if (la->sock < 0 && listener_open(la) != 0) continue;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = la;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, la->sock, &ev) != 0) {
+            log_msg(LOG_ERROR, "epoll_ctl failed for %s:%d: %s",
+                    la->bind_addr, la->bind_port, strerror(errno));
+            close(la->sock);
+            la->sock = -1;
+            continue;
         }
+        active++;
     }
+    /* Listeners no longer in the config */
+    for (int k = 0; k < num_inherited; ++k) {
+        if (inherited[k].fd >= 0) close(inherited[k].fd);
+    }
+    free(inherited);
+
+    if (active > 0 && cfg->xdp.enabled) xdp_start(cfg, listeners, cfg->num_listeners);
+
+    int rc = -1;
+    pthread_t th;
+    if (active == 0) {
+        log_msg(LOG_ERROR, "No listener could be started");
+    } else if (thread_spawn(&th, listener_thread_main, &epfd,
+                            (size_t)cfg->thread_stack_kb * 1024, 0) != 0) {
+        log_msg(LOG_ERROR, "Failed to create listener thread");
+    } else {
+        log_msg(LOG_INFO, "%d of %d listeners active", active, cfg->num_listeners);
+        /* Both processes read the shared sockets until the old one sees READY */
+        if (hconn >= 0) handoff_ready(hconn);
+        if (cfg->upgrade_socket) handoff_start(cfg);
+
+        /* Wait on the intake loop: forever, or until a handoff stops it */
+        pthread_join(th, NULL);
+        __atomic_store_n(&g_xdp_stop, 1, __ATOMIC_RELEASE);
+        if (g_xdp) xdp_stop_intake(g_xdp->port);
+        rc = 0;
+    }
+    if (hconn >= 0) close(hconn);
 
-    /* Wait forever on listeners (until killed by signal) */
     for (int i = 0; i < cfg->num_listeners; ++i) {
-        pthread_join(threads[i], NULL);
+        if (listeners[i].sock >= 0) close(listeners[i].sock);
+    }
+    if (rc == 0 && drain_sessions(cfg) > 0) {
+        /* Detached sessions still use the listeners, caches and sinks, so
+         * nothing may be torn down: deliver what is queued and leave */
+        xdp_jobs_flush(1000);
+        events_flush(2000);
+        _exit(0);
     }
+    xdp_stop();
+    uring_engine_stop();
+
+    free(listeners);
+    g_listeners = NULL;
+    close(epfd);
+    close(g_stop_fd);
+    acl_shutdown();
+    fcache_shutdown();
+    return rc;
+}
 
-    return 0;
+void tftp_print_footprint(const ServerConfig *cfg, FILE *out) {
+    size_t stack = (size_t)cfg->thread_stack_kb * 1024;
+    fprintf(out, "  listeners:        %d sockets, 1 intake thread (stack %zu KiB)\n",
+            cfg->num_listeners, stack / 1024);
+    fprintf(out, "  per session:      stack %zu KiB + state %zu B + DATA buffer up to %d B\n",
+            stack / 1024, sizeof(SessionArg) + sizeof(Session), 4 + cfg->max_blksize);
+    if (cfg->allow_upload) {
+        fprintf(out, "  per upload:       + write-behind buffer %d KiB\n",
+                cfg->upload_buffer / 1024);
+    }
+    fprintf(out, "  content cache:    up to %d MiB (netascii renderings, decompressed files)\n",
+            cfg->content_cache_mb);
+    if (cfg->content_spill_mb > 0) {
+        fprintf(out, "  content spill:    up to %d MiB on disk in %s (larger renderings)\n",
+                cfg->content_spill_mb, cfg->content_spill_dir);
+    }
+    if (cfg->xdp.enabled) {
+        fprintf(out, "  xdp:              UMEM %d KiB + up to %d sessions x %zu B\n",
+                cfg->xdp.frames * XDP_FRAME_SIZE / 1024,
+                cfg->xdp.port_hi - cfg->xdp.port_lo + 1, sizeof(XdpSession));
+    }
 }
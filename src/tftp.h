@@ -2,7 +2,12 @@
 #define TFTP_H
 
 #include "config.h"
+#include <stdio.h>
 
-int tftp_start(const ServerConfig *cfg);
+/* Serve until killed, or until the listeners are handed to a new process
+ * and the running sessions have drained. takeover: start by taking the
+ * listeners of the server running at upgrade_socket (--upgrade). */
+int tftp_start(const ServerConfig *cfg, int takeover);
+void tftp_print_footprint(const ServerConfig *cfg, FILE *out);
 
 #endif
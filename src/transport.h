@@ -0,0 +1,56 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Datagram transport for one session's peer. The UDP implementation lives
+ * in tftp.c; the in-memory one below stands in for a TFTP client, so the
+ * transfer state machine (xfer.h) can be benchmarked and replayed without
+ * the network stack.
+ */
+
+typedef struct Transport Transport;
+
+struct Transport {
+    /* Send one packet to the peer; -1 on error */
+    int (*send)(Transport *t, const unsigned char *buf, size_t len);
+    /* Next packet from the peer: its length, 0 on timeout, -1 on error */
+    ssize_t (*recv)(Transport *t, unsigned char *buf, size_t size);
+};
+
+/*
+ * Simulated downloading client: ACKs every DATA (and an OACK with ACK 0).
+ * Losses are replayed from a list of block numbers, one entry per lost
+ * transmission of that block (0 = the OACK). A lost DATA and a lost ACK
+ * look the same to the sender, so the next recv() simply times out. This
+ * is the format of the retransmit list in a flight recorder dump.
+ */
+typedef struct {
+    Transport base;
+
+    const uint16_t *drops;   /* blocks whose next transmission is lost */
+    size_t ndrops;
+    size_t drop_pos;         /* drops[] consumed in order */
+
+    int      pending;        /* an ACK is waiting for recv() */
+    uint16_t ack_block;
+    uint16_t expect;         /* next in-order DATA block */
+
+    /* Received content, for checking the transfer */
+    int      verify;         /* compute checksum (costs a pass over every byte) */
+    uint64_t bytes;
+    uint64_t checksum;       /* FNV-1a over the in-order payload */
+
+    /* Counters */
+    uint64_t sent;           /* packets offered by the sender */
+    uint64_t lost;
+    uint64_t timeouts;
+} MemTransport;
+
+/* drops may be NULL; the array must outlive the transport */
+void mem_transport_init(MemTransport *m, const uint16_t *drops, size_t ndrops);
+
+#endif
@@ -0,0 +1,139 @@
+#include "uring.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, const void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+int uring_init(URing *r, unsigned entries) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_setup(entries, &p);
+    if (fd < 0) return -1;
+
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail;
+    r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) goto fail;
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    char *sq = (char *)r->sq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    char *cq = (char *)r->cq_ptr;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_size);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED) munmap(r->cq_ptr, r->cq_size);
+    close(fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    return -1;
+}
+
+void uring_exit(URing *r) {
+    if (r->fd < 0) return;
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+    munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+    r->fd = -1;
+}
+
+int uring_probe(void) {
+    URing r;
+    if (uring_init(&r, 4) != 0) return 0;
+
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, len);
+    int ok = 0;
+    if (probe && sys_register(r.fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        static const int needed[] = {
+            IORING_OP_READ, IORING_OP_SEND, IORING_OP_RECV, IORING_OP_LINK_TIMEOUT
+        };
+        ok = 1;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i) {
+            int op = needed[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) ok = 0;
+        }
+    }
+    free(probe);
+    uring_exit(&r);
+    return ok;
+}
+
+struct io_uring_sqe *uring_get_sqe(URing *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail + r->sq_pending;
+    if (tail - head >= r->entries) return NULL;
+
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_pending++;
+    return sqe;
+}
+
+int uring_submit_and_wait(URing *r, unsigned wait_nr) {
+    unsigned to_submit = r->sq_pending;
+    if (to_submit > 0) {
+        __atomic_store_n(r->sq_tail, *r->sq_tail + to_submit, __ATOMIC_RELEASE);
+        r->sq_pending = 0;
+    }
+    for (;;) {
+        r->enters++;
+        int rc = sys_enter(r->fd, to_submit, wait_nr,
+                           wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (rc >= 0) return rc;
+        /* -EINTR means nothing was consumed, so resubmit the same count */
+        if (errno != EINTR) return -1;
+    }
+}
+
+int uring_reap(URing *r, struct io_uring_cqe *out, int max) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    while (head != tail && n < max) {
+        out[n++] = r->cqes[head & *r->cq_mask];
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
@@ -0,0 +1,54 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+/*
+ * Minimal io_uring wrapper over the raw syscalls (no liburing needed).
+ * One ring is owned by a single thread; nothing here is thread-safe.
+ */
+
+typedef struct {
+    int fd;
+    unsigned entries;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending;      /* SQEs queued since last submit */
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void  *sq_ptr;
+    size_t sq_size;
+    void  *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+
+    unsigned long enters;     /* io_uring_enter() calls, for diagnostics */
+} URing;
+
+/* Returns 1 if the kernel supports every opcode the session engine uses */
+int uring_probe(void);
+
+int uring_init(URing *r, unsigned entries);
+void uring_exit(URing *r);
+
+/* Next free SQE (zeroed), or NULL if the queue is full */
+struct io_uring_sqe *uring_get_sqe(URing *r);
+
+/* Submit queued SQEs and wait until at least wait_nr completions exist */
+int uring_submit_and_wait(URing *r, unsigned wait_nr);
+
+/* Pop up to max completions without blocking; returns count */
+int uring_reap(URing *r, struct io_uring_cqe *out, int max);
+
+#endif
@@ -1,7 +1,9 @@
 #include "util.h"
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <limits.h>
 
 void safe_strcpy(char *dst, size_t dst_size, const char *src) {
     if (!dst || dst_size == 0) return;
@@ -61,3 +63,44 @@ int starts_with(const char *s, const char *prefix) {
     }
     return 1;
 }
+
+/* Create a thread with an explicit stack size (0 = system default) */
+int thread_spawn(pthread_t *th, void *(*fn)(void *), void *arg,
+                 size_t stack_size, int detached) {
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0) return -1;
+    if (stack_size > 0) {
+        if (stack_size < PTHREAD_STACK_MIN) stack_size = PTHREAD_STACK_MIN;
+        pthread_attr_setstacksize(&attr, stack_size);
+    }
+    if (detached) {
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    }
+    int rc = pthread_create(th, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+/* Read a "<field>: N kB" line from /proc/self/status; -1 if unavailable */
+long proc_status_kb(const char *field) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    char line[256];
+    size_t flen = strlen(field);
+    long v = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, flen) == 0 && line[flen] == ':') {
+            v = strtol(line + flen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+/* Monotonic clock in microseconds, for durations only */
+uint64_t mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
@@ -2,7 +2,9 @@
 #define UTIL_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 
 void safe_strcpy(char *dst, size_t dst_size, const char *src);
 void trim(char *s);
@@ -11,5 +13,9 @@ void time_to_iso8601(time_t t, char *out, size_t size);
 void now_iso8601(char *out, size_t size);
 int split_kv(char *line, char **key, char **val);
 int starts_with(const char *s, const char *prefix);
+long proc_status_kb(const char *field);
+uint64_t mono_us(void);
+int thread_spawn(pthread_t *th, void *(*fn)(void *), void *arg,
+                 size_t stack_size, int detached);
 
 #endif
@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+#include "warm.h"
+#include "bundle.h"
+#include "logger.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Transfers at least this large get sequential readahead hints */
+#define WARM_SEQ_MIN     (256 * 1024)
+#define WARM_SAVE_SEC    60
+
+typedef struct {
+    char name[256];
+    unsigned long count;
+} WarmCount;
+
+static const ServerConfig *g_cfg = NULL;
+static char g_list_path[PATH_MAX];
+
+/* Most-requested names: a bounded table that replaces its least counted
+ * entry when full, so one-off names cannot crowd out the popular ones */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static WarmCount *g_counts = NULL;
+static int g_count_cap = 0;
+static int g_count_len = 0;
+
+void warm_hint_fd(int fd, long long size) {
+    if (size < WARM_SEQ_MIN) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void warm_hint_mem(const void *data, size_t size) {
+    if (size < WARM_SEQ_MIN) return;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(uintptr_t)(page - 1);
+    madvise((void *)start, size + ((uintptr_t)data - start), MADV_SEQUENTIAL);
+}
+
+void warm_note(const char *name) {
+    if (g_count_cap == 0 || name[0] == '\0') return;
+
+    pthread_mutex_lock(&g_lock);
+    int min = -1;
+    for (int i = 0; i < g_count_len; ++i) {
+        if (strcmp(g_counts[i].name, name) == 0) {
+            g_counts[i].count++;
+            pthread_mutex_unlock(&g_lock);
+            return;
+        }
+        if (min < 0 || g_counts[i].count < g_counts[min].count) min = i;
+    }
+    WarmCount *slot;
+    if (g_count_len < g_count_cap) {
+        slot = &g_counts[g_count_len++];
+        slot->count = 1;
+    } else {
+        /* Inherit the evicted count, so a newcomer must earn its place */
+        slot = &g_counts[min];
+        slot->count++;
+    }
+    safe_strcpy(slot->name, sizeof(slot->name), name);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static int by_count_desc(const void *a, const void *b) {
+    unsigned long ca = ((const WarmCount *)a)->count, cb = ((const WarmCount *)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+/* Persist the top warm_auto names, most requested first */
+static void save_list(void) {
+    pthread_mutex_lock(&g_lock);
+    int n = g_count_len;
+    WarmCount *snap = n ? (WarmCount *)malloc((size_t)n * sizeof(WarmCount)) : NULL;
+    if (snap) memcpy(snap, g_counts, (size_t)n * sizeof(WarmCount));
+    pthread_mutex_unlock(&g_lock);
+    if (!snap) return;
+
+    qsort(snap, (size_t)n, sizeof(WarmCount), by_count_desc);
+    if (n > g_cfg->warm_auto) n = g_cfg->warm_auto;
+
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_list_path);
+    FILE *f = fopen(tmp, "w");
+    if (f) {
+        fprintf(f, "# ctftp most-requested files (name, then request count)\n");
+        for (int i = 0; i < n; ++i) fprintf(f, "%s\t%lu\n", snap[i].name, snap[i].count);
+        if (fclose(f) != 0 || rename(tmp, g_list_path) != 0) unlink(tmp);
+    }
+    free(snap);
+}
+
+/* Seed the counters from the previous run so the list survives restarts.
+ * Listeners are already serving, so a name may have been noted meanwhile. */
+static void seed_counts(const char *name, unsigned long count) {
+    pthread_mutex_lock(&g_lock);
+    int i = 0;
+    while (i < g_count_len && strcmp(g_counts[i].name, name) != 0) i++;
+    if (i < g_count_len) {
+        g_counts[i].count += count;
+    } else if (g_count_len < g_count_cap) {
+        WarmCount *c = &g_counts[g_count_len++];
+        safe_strcpy(c->name, sizeof(c->name), name);
+        c->count = count;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+typedef struct {
+    int files;
+    long long bytes;
+    long long locked;
+} WarmStats;
+
+static int warm_lock_region(const void *addr, size_t len, WarmStats *st) {
+    long long budget = (long long)g_cfg->warm_mlock_mb * 1024 * 1024;
+    if (budget == 0 || st->locked + (long long)len > budget) return -1;
+    if (mlock(addr, len) != 0) {
+        if (st->locked == 0) {
+            log_msg(LOG_ERROR, "warm: mlock failed (%s); check RLIMIT_MEMLOCK", strerror(errno));
+        }
+        return -1;
+    }
+    st->locked += (long long)len;
+    return 0;
+}
+
+static void warm_one(const char *name, WarmStats *st) {
+    if (name[0] == '\0' || strstr(name, "..")) return;
+
+    if (g_cfg->root_bundle) {
+        Bundle *b = bundle_acquire();
+        BundleFile bf;
+        if (b && bundle_lookup(b, name, &bf) == 0) {
+            long page = sysconf(_SC_PAGESIZE);
+            uintptr_t start = (uintptr_t)bf.data & ~(uintptr_t)(page - 1);
+            size_t len = (size_t)bf.size + ((uintptr_t)bf.data - start);
+            madvise((void *)start, len, MADV_WILLNEED);
+            /* mlock pins the pages even after this reference is dropped */
+            if (len > 0) warm_lock_region((void *)start, len, st);
+            st->files++;
+            st->bytes += bf.size;
+            bundle_release(b);
+            return;
+        }
+        bundle_release(b);
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", g_cfg->root_dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && g_cfg->origin_enabled) {
+        snprintf(path, sizeof(path), "%s/%s", g_cfg->origin_cache_dir, name);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        posix_fadvise(fd, 0, sb.st_size, POSIX_FADV_WILLNEED);
+        readahead(fd, 0, (size_t)sb.st_size);
+        st->files++;
+        st->bytes += sb.st_size;
+
+        if (g_cfg->warm_mlock_mb > 0) {
+            /* The mapping is kept for the life of the process */
+            void *m = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (m != MAP_FAILED && warm_lock_region(m, (size_t)sb.st_size, st) != 0) {
+                munmap(m, (size_t)sb.st_size);
+            }
+        }
+    }
+    close(fd);
+}
+
+/* Warm every name in a list file: one name per line, optional "\tcount" */
+static void warm_list(const char *path, int seed, WarmStats *st) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (!seed) log_msg(LOG_ERROR, "warm: cannot open manifest %s: %s", path, strerror(errno));
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        unsigned long count = 1;
+        if (tab) {
+            *tab = '\0';
+            count = strtoul(tab + 1, NULL, 10);
+        }
+        trim(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        const char *name = line;
+        while (*name == '/') name++;
+        warm_one(name, st);
+        if (seed) seed_counts(name, count);
+    }
+    fclose(f);
+}
+
+static void *warm_thread_main(void *arg) {
+    (void)arg;
+    uint64_t t0 = mono_us();
+    WarmStats st;
+    memset(&st, 0, sizeof(st));
+
+    if (g_cfg->warm_manifest) warm_list(g_cfg->warm_manifest, 0, &st);
+    if (g_count_cap > 0) warm_list(g_list_path, 1, &st);
+
+    if (g_cfg->warm_manifest || g_count_cap > 0) {
+        log_msg(LOG_INFO, "warm: %d files (%lld KiB) prefetched in %llu ms, %lld KiB locked",
+                st.files, st.bytes / 1024, (unsigned long long)((mono_us() - t0) / 1000),
+                st.locked / 1024);
+    }
+
+    while (g_count_cap > 0) {
+        sleep(WARM_SAVE_SEC);
+        save_list();
+    }
+    return NULL;
+}
+
+int warm_init(const ServerConfig *cfg) {
+    g_cfg = cfg;
+    snprintf(g_list_path, sizeof(g_list_path), "%s/ctftp-warm.list", cfg->log_dir);
+
+    if (cfg->warm_auto > 0) {
+        /* Track more names than are persisted, so the top of the list is stable */
+        g_count_cap = cfg->warm_auto * 4;
+        g_counts = (WarmCount *)calloc((size_t)g_count_cap, sizeof(WarmCount));
+        if (!g_counts) g_count_cap = 0;
+    }
+    if (!cfg->warm_manifest && g_count_cap == 0) return 0;
+
+    pthread_t th;
+    if (thread_spawn(&th, warm_thread_main, NULL,
+                     (size_t)cfg->thread_stack_kb * 1024, 1) != 0) {
+        log_msg(LOG_ERROR, "warm: cannot start thread");
+        return -1;
+    }
+    return 0;
+}
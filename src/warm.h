@@ -0,0 +1,28 @@
+#ifndef WARM_H
+#define WARM_H
+
+#include "config.h"
+#include <stddef.h>
+
+/*
+ * Page-cache warming.
+ *
+ * At startup, files named in warm_manifest= and in the automatically kept
+ * most-requested list (<log_dir>/ctftp-warm.list, rewritten every minute)
+ * are prefetched in the background with posix_fadvise(WILLNEED) and
+ * readahead(), or madvise() for bundle entries. With warm_mlock_mb, they
+ * are also mapped and mlock()ed, up to that budget, so they cannot be
+ * evicted. The first wave of requests after a restart then finds them in
+ * memory.
+ */
+
+int warm_init(const ServerConfig *cfg);
+
+/* Count a completed download towards the most-requested list */
+void warm_note(const char *name);
+
+/* Hint sequential access for a large transfer */
+void warm_hint_fd(int fd, long long size);
+void warm_hint_mem(const void *data, size_t size);
+
+#endif
@@ -0,0 +1,538 @@
+#include "xdp.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+typedef struct {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void     *descs;
+    uint32_t  mask;
+    void     *map;
+    size_t    map_len;
+} XdpRing;
+
+struct XdpPort {
+    XdpConfig cfg;
+    int fd;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    int ifindex;
+    int mtu;
+
+    unsigned char *umem;
+    size_t umem_len;
+    uint32_t ring_size;
+
+    XdpRing fill, comp, rx, tx;
+
+    uint64_t *free_frames;       /* TX frame stack */
+    uint32_t nfree;
+    uint32_t tx_queued;          /* descriptors not yet published */
+    uint16_t ip_id;
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+    return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/* ---- the XDP program --------------------------------------------------- */
+
+/* XSKMAP slot for RRQs to the listener port, after the queue slots */
+#define XSKMAP_LISTEN_KEY(c) ((c)->queue + 1)
+
+enum { L_PASS, L_LISTEN, L_REDIRECT, L_MAP, L_COUNT };
+
+typedef struct {
+    struct bpf_insn insn[64];
+    int n;
+    int label[L_COUNT];
+    int fix_insn[16];
+    int fix_label[16];
+    int nfix;
+} Asm;
+
+static void emit(Asm *a, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+    struct bpf_insn *i = &a->insn[a->n++];
+    memset(i, 0, sizeof(*i));
+    i->code = code;
+    i->dst_reg = dst;
+    i->src_reg = src;
+    i->off = off;
+    i->imm = imm;
+}
+
+static void emit_jmp(Asm *a, uint8_t code, uint8_t dst, uint8_t src, int32_t imm, int label) {
+    a->fix_insn[a->nfix] = a->n;
+    a->fix_label[a->nfix++] = label;
+    emit(a, code, dst, src, 0, imm);
+}
+
+static void resolve(Asm *a) {
+    for (int i = 0; i < a->nfix; ++i) {
+        int at = a->fix_insn[i];
+        a->insn[at].off = (int16_t)(a->label[a->fix_label[i]] - at - 1);
+    }
+}
+
+/*
+ * r2 = data, r3 = data_end, r5 = scratch. Everything that is not an IPv4
+ * UDP datagram for our address and ports, without options or fragments,
+ * is XDP_PASS. Redirect falls back to XDP_PASS when the XSKMAP key has no
+ * socket. Session ports use the RX queue as key; RRQs use XSKMAP_LISTEN_KEY
+ * (on our queue only), which xdp_stop_intake() deletes.
+ */
+static int build_prog(Asm *a, const XdpConfig *c, int map_fd) {
+    memset(a, 0, sizeof(*a));
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0);
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, 2, 6, 0, 0);
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, 3, 6, 4, 0);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_HDR_LEN);
+    emit_jmp(a, BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, L_PASS);
+
+    emit(a, BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0);
+    emit_jmp(a, BPF_JMP | BPF_JNE | BPF_K, 5, 0, htons(0x0800), L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0);
+    emit_jmp(a, BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0x45, L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0);
+    emit_jmp(a, BPF_JMP | BPF_JSET | BPF_K, 5, 0, htons(0x3fff), L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0);
+    emit_jmp(a, BPF_JMP | BPF_JNE | BPF_K, 5, 0, IPPROTO_UDP, L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, 5, 2, 30, 0);
+    emit_jmp(a, BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, (int32_t)c->addr.s_addr, L_PASS);
+
+    emit(a, BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0);
+    emit(a, BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16);
+    emit_jmp(a, BPF_JMP | BPF_JEQ | BPF_K, 5, 0, c->port, L_LISTEN);
+    emit_jmp(a, BPF_JMP | BPF_JLT | BPF_K, 5, 0, c->port_lo, L_PASS);
+    emit_jmp(a, BPF_JMP | BPF_JGT | BPF_K, 5, 0, c->port_hi, L_PASS);
+    emit_jmp(a, BPF_JMP | BPF_JA, 0, 0, 0, L_REDIRECT);
+
+    /* Only RRQs take the fast path; WRQs stay on the kernel socket */
+    a->label[L_LISTEN] = a->n;
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XDP_HDR_LEN + 2);
+    emit_jmp(a, BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_H, 5, 2, XDP_HDR_LEN, 0);
+    emit_jmp(a, BPF_JMP | BPF_JNE | BPF_K, 5, 0, htons(1), L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0);
+    emit_jmp(a, BPF_JMP | BPF_JNE | BPF_K, 2, 0, c->queue, L_PASS);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 2, 0, 0, XSKMAP_LISTEN_KEY(c));
+    emit_jmp(a, BPF_JMP | BPF_JA, 0, 0, 0, L_MAP);
+
+    a->label[L_REDIRECT] = a->n;
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0);
+    a->label[L_MAP] = a->n;
+    emit(a, BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+    emit(a, 0, 0, 0, 0, 0);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS);
+    emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+    emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+    a->label[L_PASS] = a->n;
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+    emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    resolve(a);
+    return a->n;
+}
+
+static int load_prog(XdpPort *p) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = (uint32_t)XSKMAP_LISTEN_KEY(&p->cfg) + 1;
+    p->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (p->map_fd < 0) {
+        log_msg(LOG_ERROR, "xdp: cannot create XSKMAP: %s", strerror(errno));
+        return -1;
+    }
+
+    Asm a;
+    int n = build_prog(&a, &p->cfg, p->map_fd);
+    static char log_buf[4096];
+    log_buf[0] = '\0';
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.expected_attach_type = BPF_XDP;
+    attr.insn_cnt = (uint32_t)n;
+    attr.insns = (uint64_t)(uintptr_t)a.insn;
+    attr.license = (uint64_t)(uintptr_t)"Dual MIT/GPL";
+    attr.log_level = 1;
+    attr.log_size = sizeof(log_buf);
+    attr.log_buf = (uint64_t)(uintptr_t)log_buf;
+    p->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (p->prog_fd < 0) {
+        log_msg(LOG_ERROR, "xdp: program rejected: %s: %s", strerror(errno), log_buf);
+        return -1;
+    }
+    return 0;
+}
+
+static int attach_prog(XdpPort *p) {
+    const uint32_t keys[2] = { (uint32_t)p->cfg.queue, (uint32_t)XSKMAP_LISTEN_KEY(&p->cfg) };
+    uint32_t val = (uint32_t)p->fd;
+    union bpf_attr attr;
+    for (int i = 0; i < 2; ++i) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)p->map_fd;
+        attr.key = (uint64_t)(uintptr_t)&keys[i];
+        attr.value = (uint64_t)(uintptr_t)&val;
+        if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+            log_msg(LOG_ERROR, "xdp: cannot add socket to XSKMAP: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = (uint32_t)p->prog_fd;
+    attr.link_create.target_ifindex = (uint32_t)p->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = p->cfg.native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    p->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (p->link_fd < 0) {
+        log_msg(LOG_ERROR, "xdp: cannot attach to %s: %s", p->cfg.ifname, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- socket, UMEM and rings ------------------------------------------- */
+
+static int map_ring(XdpPort *p, XdpRing *r, const struct xdp_ring_offset *off,
+                    size_t desc_size, off_t pgoff) {
+    r->map_len = off->desc + p->ring_size * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  p->fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+    unsigned char *base = (unsigned char *)r->map;
+    r->producer = (uint32_t *)(base + off->producer);
+    r->consumer = (uint32_t *)(base + off->consumer);
+    r->flags = (uint32_t *)(base + off->flags);
+    r->descs = base + off->desc;
+    r->mask = p->ring_size - 1;
+    return 0;
+}
+
+static int setup_socket(XdpPort *p) {
+    p->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (p->fd < 0) {
+        log_msg(LOG_ERROR, "xdp: cannot create AF_XDP socket: %s", strerror(errno));
+        return -1;
+    }
+
+    p->umem_len = (size_t)p->cfg.frames * XDP_FRAME_SIZE;
+    p->umem = (unsigned char *)mmap(NULL, p->umem_len, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (p->umem == MAP_FAILED) {
+        p->umem = NULL;
+        return -1;
+    }
+
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)p->umem;
+    reg.len = p->umem_len;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    int size = (int)p->ring_size;
+    if (setsockopt(p->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+        setsockopt(p->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) != 0 ||
+        setsockopt(p->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) != 0 ||
+        setsockopt(p->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) != 0 ||
+        setsockopt(p->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) != 0) {
+        log_msg(LOG_ERROR, "xdp: cannot set up UMEM: %s", strerror(errno));
+        return -1;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(p->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0 ||
+        map_ring(p, &p->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != 0 ||
+        map_ring(p, &p->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != 0 ||
+        map_ring(p, &p->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != 0 ||
+        map_ring(p, &p->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) != 0) {
+        log_msg(LOG_ERROR, "xdp: cannot map rings: %s", strerror(errno));
+        return -1;
+    }
+
+    /* First half of the frames feeds RX, the rest is the TX pool */
+    uint64_t *fill = (uint64_t *)p->fill.descs;
+    for (uint32_t i = 0; i < p->ring_size; ++i) fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+    __atomic_store_n(p->fill.producer, p->ring_size, __ATOMIC_RELEASE);
+
+    p->free_frames = (uint64_t *)malloc((p->cfg.frames - p->ring_size) * sizeof(uint64_t));
+    if (!p->free_frames) return -1;
+    for (uint32_t i = p->cfg.frames; i > p->ring_size; --i) {
+        p->free_frames[p->nfree++] = (uint64_t)(i - 1) * XDP_FRAME_SIZE;
+    }
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = (uint32_t)p->ifindex;
+    sxdp.sxdp_queue_id = (uint32_t)p->cfg.queue;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (p->cfg.zerocopy ? XDP_ZEROCOPY : XDP_COPY);
+    if (bind(p->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0) {
+        log_msg(LOG_ERROR, "xdp: cannot bind to %s queue %d: %s",
+                p->cfg.ifname, p->cfg.queue, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int interface_mtu(const char *ifname) {
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    int rc = ioctl(s, SIOCGIFMTU, &ifr);
+    close(s);
+    return rc == 0 ? ifr.ifr_mtu : -1;
+}
+
+XdpPort *xdp_open(const XdpConfig *cfg) {
+    if (cfg->frames < 64 || (cfg->frames & (cfg->frames - 1)) != 0) {
+        log_msg(LOG_ERROR, "xdp: frame count must be a power of two >= 64");
+        return NULL;
+    }
+    XdpPort *p = (XdpPort *)calloc(1, sizeof(XdpPort));
+    if (!p) return NULL;
+    p->cfg = *cfg;
+    p->fd = p->map_fd = p->prog_fd = p->link_fd = -1;
+    p->ring_size = cfg->frames / 2;
+
+    p->ifindex = (int)if_nametoindex(cfg->ifname);
+    p->mtu = interface_mtu(cfg->ifname);
+    if (p->ifindex == 0 || p->mtu < 576) {
+        log_msg(LOG_ERROR, "xdp: no usable interface %s", cfg->ifname);
+        xdp_close(p);
+        return NULL;
+    }
+
+    if (setup_socket(p) != 0 || load_prog(p) != 0 || attach_prog(p) != 0) {
+        xdp_close(p);
+        return NULL;
+    }
+    log_msg(LOG_INFO, "xdp: %s queue %d attached (%s mode, %s), %u frames, mtu %d",
+            cfg->ifname, cfg->queue, cfg->native ? "driver" : "generic",
+            cfg->zerocopy ? "zero-copy" : "copy", cfg->frames, p->mtu);
+    return p;
+}
+
+void xdp_close(XdpPort *p) {
+    if (!p) return;
+    if (p->link_fd >= 0) close(p->link_fd);
+    if (p->prog_fd >= 0) close(p->prog_fd);
+    if (p->map_fd >= 0) close(p->map_fd);
+    XdpRing *rings[] = { &p->fill, &p->comp, &p->rx, &p->tx };
+    for (size_t i = 0; i < 4; ++i) {
+        if (rings[i]->map) munmap(rings[i]->map, rings[i]->map_len);
+    }
+    if (p->fd >= 0) close(p->fd);
+    if (p->umem) munmap(p->umem, p->umem_len);
+    free(p->free_frames);
+    free(p);
+}
+
+void xdp_stop_intake(XdpPort *p) {
+    uint32_t key = (uint32_t)XSKMAP_LISTEN_KEY(&p->cfg);
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)p->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) != 0 && errno != ENOENT) {
+        log_msg(LOG_ERROR, "xdp: cannot stop RRQ redirect: %s", strerror(errno));
+    }
+}
+
+size_t xdp_max_payload(const XdpPort *p) {
+    size_t by_mtu = (size_t)p->mtu - 28;
+    size_t by_frame = XDP_FRAME_SIZE - XDP_HDR_LEN;
+    return by_mtu < by_frame ? by_mtu : by_frame;
+}
+
+/* ---- RX ----------------------------------------------------------------- */
+
+int xdp_wait(XdpPort *p, int timeout_ms) {
+    uint32_t prod = __atomic_load_n(p->rx.producer, __ATOMIC_ACQUIRE);
+    if (prod != *p->rx.consumer) return 1;
+    struct pollfd pfd = { .fd = p->fd, .events = POLLIN, .revents = 0 };
+    int rc = poll(&pfd, 1, timeout_ms);
+    return rc < 0 && errno != EINTR ? -1 : rc > 0;
+}
+
+void xdp_rx_done(XdpPort *p, uint64_t frame) {
+    uint32_t prod = *p->fill.producer;
+    ((uint64_t *)p->fill.descs)[prod & p->fill.mask] = frame & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+    __atomic_store_n(p->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+static int parse_frame(const unsigned char *f, size_t len, XdpPacket *pkt) {
+    if (len < XDP_HDR_LEN) return -1;
+    if (f[12] != 0x08 || f[13] != 0x00 || f[14] != 0x45 || f[23] != IPPROTO_UDP) return -1;
+    const unsigned char *ip = f + 14;
+    const unsigned char *udp = ip + 20;
+    size_t ip_len = ((size_t)ip[2] << 8) | ip[3];
+    size_t udp_len = ((size_t)udp[4] << 8) | udp[5];
+    if (ip_len < 28 || ip_len > len - 14 || udp_len < 8 || udp_len > ip_len - 20) return -1;
+
+    XdpFlow *fl = &pkt->flow;
+    memcpy(fl->local_mac, f, 6);
+    memcpy(fl->peer_mac, f + 6, 6);
+    memcpy(&fl->peer_ip, ip + 12, 4);
+    memcpy(&fl->local_ip, ip + 16, 4);
+    memcpy(&fl->peer_port, udp, 2);
+    memcpy(&fl->local_port, udp + 2, 2);
+    pkt->payload = udp + 8;
+    pkt->len = udp_len - 8;
+    return 0;
+}
+
+int xdp_rx(XdpPort *p, XdpPacket *out, int max) {
+    uint32_t cons = *p->rx.consumer;
+    uint32_t prod = __atomic_load_n(p->rx.producer, __ATOMIC_ACQUIRE);
+    const struct xdp_desc *descs = (const struct xdp_desc *)p->rx.descs;
+    int n = 0;
+    while (cons != prod && n < max) {
+        const struct xdp_desc *d = &descs[cons & p->rx.mask];
+        cons++;
+        if (parse_frame(p->umem + d->addr, d->len, &out[n]) != 0) {
+            xdp_rx_done(p, d->addr);
+            continue;
+        }
+        out[n++].frame = d->addr;
+    }
+    __atomic_store_n(p->rx.consumer, cons, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* ---- TX ----------------------------------------------------------------- */
+
+uint64_t xdp_frame_alloc(XdpPort *p) {
+    return p->nfree > 0 ? p->free_frames[--p->nfree] : UINT64_MAX;
+}
+
+void xdp_frame_free(XdpPort *p, uint64_t frame) {
+    p->free_frames[p->nfree++] = frame;
+}
+
+unsigned char *xdp_frame_payload(XdpPort *p, uint64_t frame) {
+    return p->umem + frame + XDP_HDR_LEN;
+}
+
+static uint32_t csum_add(uint32_t sum, const unsigned char *b, size_t len) {
+    while (len > 1) {
+        sum += ((uint32_t)b[0] << 8) | b[1];
+        b += 2;
+        len -= 2;
+    }
+    if (len) sum += (uint32_t)b[0] << 8;
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static void put16(unsigned char *b, uint16_t v) {
+    b[0] = (unsigned char)(v >> 8);
+    b[1] = (unsigned char)v;
+}
+
+int xdp_tx(XdpPort *p, uint64_t frame, const XdpFlow *fl, size_t payload_len) {
+    uint32_t prod = *p->tx.producer + p->tx_queued;
+    uint32_t cons = __atomic_load_n(p->tx.consumer, __ATOMIC_ACQUIRE);
+    if (prod - cons >= p->ring_size) return -1;
+
+    unsigned char *f = p->umem + frame;
+    memcpy(f, fl->peer_mac, 6);
+    memcpy(f + 6, fl->local_mac, 6);
+    f[12] = 0x08;
+    f[13] = 0x00;
+
+    unsigned char *ip = f + 14;
+    ip[0] = 0x45;
+    ip[1] = 0;
+    put16(ip + 2, (uint16_t)(28 + payload_len));
+    put16(ip + 4, p->ip_id++);
+    put16(ip + 6, 0x4000);       /* DF */
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    ip[10] = ip[11] = 0;
+    memcpy(ip + 12, &fl->local_ip, 4);
+    memcpy(ip + 16, &fl->peer_ip, 4);
+    put16(ip + 10, csum_fold(csum_add(0, ip, 20)));
+
+    unsigned char *udp = ip + 20;
+    memcpy(udp, &fl->local_port, 2);
+    memcpy(udp + 2, &fl->peer_port, 2);
+    put16(udp + 4, (uint16_t)(8 + payload_len));
+    udp[6] = udp[7] = 0;
+    uint32_t sum = csum_add(0, ip + 12, 8);
+    sum += IPPROTO_UDP + 8 + (uint32_t)payload_len;
+    uint16_t c = csum_fold(csum_add(sum, udp, 8 + payload_len));
+    put16(udp + 6, c ? c : 0xffff);
+
+    struct xdp_desc *d = &((struct xdp_desc *)p->tx.descs)[prod & p->tx.mask];
+    d->addr = frame;
+    d->len = (uint32_t)(XDP_HDR_LEN + payload_len);
+    d->options = 0;
+    p->tx_queued++;
+    return 0;
+}
+
+/* Publish queued descriptors and kick the kernel. Copy mode sends a
+ * limited batch per kick (EAGAIN), so kick until the ring is drained;
+ * EBUSY/ENOBUFS leave the rest for the next flush. */
+void xdp_tx_flush(XdpPort *p) {
+    uint32_t prod = *p->tx.producer + p->tx_queued;
+    if (p->tx_queued > 0) {
+        __atomic_store_n(p->tx.producer, prod, __ATOMIC_RELEASE);
+        p->tx_queued = 0;
+    }
+    for (uint32_t i = 0; i <= p->ring_size / 16; ++i) {
+        if (__atomic_load_n(p->tx.consumer, __ATOMIC_ACQUIRE) == prod) break;
+        if (!(__atomic_load_n(p->tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) break;
+        if (sendto(p->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 && errno != EAGAIN) break;
+    }
+}
+
+int xdp_tx_reap(XdpPort *p, uint64_t *frames, int max) {
+    uint32_t cons = *p->comp.consumer;
+    uint32_t prod = __atomic_load_n(p->comp.producer, __ATOMIC_ACQUIRE);
+    const uint64_t *ring = (const uint64_t *)p->comp.descs;
+    int n = 0;
+    while (cons != prod && n < max) frames[n++] = ring[cons++ & p->comp.mask];
+    __atomic_store_n(p->comp.consumer, cons, __ATOMIC_RELEASE);
+    return n;
+}
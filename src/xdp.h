@@ -0,0 +1,86 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+ * AF_XDP port: one XDP socket on one interface queue, with its UMEM frame
+ * pool, over raw bpf()/setsockopt() calls (no libbpf needed).
+ *
+ * A small XDP program is attached to the interface (generic/SKB mode by
+ * default). It redirects to the socket only IPv4 UDP datagrams for the
+ * configured address that are either an RRQ to the listener port, or any
+ * packet to the session port range. Everything else, including ARP,
+ * fragments, IP options, WRQs and other queues, goes to the kernel stack
+ * as usual. The program is attached through a BPF link, so it disappears
+ * with the process.
+ *
+ * Frames are XDP_FRAME_SIZE bytes. The first half of the pool feeds the
+ * RX fill ring; the rest is handed out for transmission. Not thread-safe:
+ * one port is owned by one thread.
+ */
+
+#define XDP_FRAME_SIZE 2048
+#define XDP_HDR_LEN    42        /* Ethernet + IPv4 (no options) + UDP */
+
+typedef struct {
+    char     ifname[16];         /* IFNAMSIZ */
+    int      queue;
+    int      native;             /* driver mode instead of generic (SKB) mode */
+    int      zerocopy;
+    uint32_t frames;             /* UMEM frames (power of two) */
+    struct in_addr addr;         /* local address (the listener's) */
+    uint16_t port;               /* listener port, host order */
+    uint16_t port_lo, port_hi;   /* session ports, host order */
+} XdpConfig;
+
+/* Addressing of one UDP flow, as seen from this host */
+typedef struct {
+    unsigned char local_mac[6];
+    unsigned char peer_mac[6];
+    uint32_t local_ip;           /* network order */
+    uint32_t peer_ip;
+    uint16_t local_port;         /* network order */
+    uint16_t peer_port;
+} XdpFlow;
+
+/* A received datagram (payload points into the UMEM) */
+typedef struct {
+    uint64_t frame;
+    XdpFlow  flow;
+    const unsigned char *payload;
+    size_t   len;
+} XdpPacket;
+
+typedef struct XdpPort XdpPort;
+
+XdpPort *xdp_open(const XdpConfig *cfg);
+void xdp_close(XdpPort *p);
+
+/* Send RRQs to the listener port back to the kernel stack; session ports
+ * stay redirected. Safe to call from any thread. */
+void xdp_stop_intake(XdpPort *p);
+
+/* Largest UDP payload a frame can carry on this interface */
+size_t xdp_max_payload(const XdpPort *p);
+
+/* Wait up to timeout_ms for received packets */
+int xdp_wait(XdpPort *p, int timeout_ms);
+
+/* Take up to max received UDP datagrams; every one must be given back
+ * with xdp_rx_done(). Non-UDP frames are recycled internally. */
+int xdp_rx(XdpPort *p, XdpPacket *out, int max);
+void xdp_rx_done(XdpPort *p, uint64_t frame);
+
+/* TX frames: allocate, fill the payload area, queue, then flush once per
+ * batch. Frames come back through xdp_tx_reap() once sent. */
+uint64_t xdp_frame_alloc(XdpPort *p);          /* UINT64_MAX if none left */
+void xdp_frame_free(XdpPort *p, uint64_t frame);
+unsigned char *xdp_frame_payload(XdpPort *p, uint64_t frame);
+int xdp_tx(XdpPort *p, uint64_t frame, const XdpFlow *flow, size_t payload_len);
+void xdp_tx_flush(XdpPort *p);
+int xdp_tx_reap(XdpPort *p, uint64_t *frames, int max);
+
+#endif
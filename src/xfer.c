@@ -0,0 +1,175 @@
+#include "xfer.h"
+#include "logger.h"
+
+#include <string.h>
+
+#define XFER_PHASE_OACK 0        /* OACK sent, waiting for ACK 0 */
+#define XFER_PHASE_DATA 1        /* DATA block outstanding */
+#define XFER_PHASE_FILL 2        /* waiting for the caller to read a block */
+#define XFER_PHASE_END  3
+
+static XferAction next_block(XferRead *x) {
+    x->phase = XFER_PHASE_FILL;
+    x->retries = 0;
+    return XFER_FILL;
+}
+
+static XferAction send_current(XferRead *x) {
+    x->out = x->pkt;
+    x->out_len = 4 + x->len;
+    return XFER_SEND;
+}
+
+static XferAction give_up(XferRead *x, const char *why) {
+    x->phase = XFER_PHASE_END;
+    x->fail = why;
+    return XFER_FAIL;
+}
+
+XferAction xfer_read_start(XferRead *x, unsigned char *pkt, size_t blksize, int max_retries,
+                           const unsigned char *oack, size_t oack_len) {
+    memset(x, 0, sizeof(*x));
+    x->pkt = pkt;
+    x->blksize = blksize;
+    x->max_retries = max_retries;
+    x->block = 1;
+
+    if (oack && oack_len > 0) {
+        x->phase = XFER_PHASE_OACK;
+        x->block = 0;
+        x->out = oack;
+        x->out_len = oack_len;
+        return XFER_SEND;
+    }
+    return next_block(x);
+}
+
+XferAction xfer_read_filled(XferRead *x, size_t n) {
+    if (x->phase != XFER_PHASE_FILL) return XFER_WAIT;
+    x->phase = XFER_PHASE_DATA;
+    x->len = n;
+    x->pkt[0] = 0;
+    x->pkt[1] = TFTP_OPCODE_DATA;
+    x->pkt[2] = (unsigned char)(x->block >> 8);
+    x->pkt[3] = (unsigned char)(x->block & 0xff);
+    return send_current(x);
+}
+
+XferAction xfer_read_packet(XferRead *x, const unsigned char *buf, size_t len) {
+    if (x->phase != XFER_PHASE_OACK && x->phase != XFER_PHASE_DATA) return XFER_WAIT;
+    if (len < 4) return XFER_WAIT;
+
+    uint16_t op = (uint16_t)((buf[0] << 8) | buf[1]);
+    uint16_t blk = (uint16_t)((buf[2] << 8) | buf[3]);
+
+    if (op == TFTP_OPCODE_ERR) {
+        x->peer_error = blk;
+        /* An ERROR in reply to the OACK means the client rejected the options */
+        return give_up(x, x->phase == XFER_PHASE_OACK ? "options_rejected" : "client_aborted");
+    }
+    /* Anything but the ACK we wait for (typically a duplicate ACK of the
+     * previous block) is ignored, not answered with a resend: that would
+     * start Sorcerer's Apprentice syndrome */
+    if (op != TFTP_OPCODE_ACK || blk != x->block) return XFER_WAIT;
+
+    if (x->phase == XFER_PHASE_OACK) {
+        x->block = 1;
+        return next_block(x);
+    }
+
+    x->total += x->len;
+    if (x->len < x->blksize) {
+        x->phase = XFER_PHASE_END;
+        return XFER_DONE;
+    }
+    x->off += (long long)x->len;
+    x->block++;
+    if (x->block == 0) x->block = 1; /* wrap safety */
+    return next_block(x);
+}
+
+XferAction xfer_read_timeout(XferRead *x) {
+    if (x->phase != XFER_PHASE_OACK && x->phase != XFER_PHASE_DATA) return XFER_WAIT;
+    if (++x->retries > x->max_retries) return give_up(x, NULL);
+    /* out/out_len still hold the outstanding packet */
+    return XFER_SEND;
+}
+
+size_t xfer_error_packet(unsigned char *buf, size_t size, uint16_t code, const char *msg) {
+    size_t mlen = strlen(msg);
+    if (mlen > size - 5) mlen = size - 5;
+    buf[0] = 0;
+    buf[1] = TFTP_OPCODE_ERR;
+    buf[2] = (unsigned char)(code >> 8);
+    buf[3] = (unsigned char)(code & 0xff);
+    memcpy(buf + 4, msg, mlen);
+    buf[4 + mlen] = '\0';
+    return 5 + mlen;
+}
+
+XferAction xfer_read_recv(XferRead *x, const unsigned char *buf, size_t len) {
+    uint16_t pending = x->block;
+    XferAction a = xfer_read_packet(x, buf, len);
+    if (a == XFER_WAIT) {
+        log_msg(LOG_DEBUG, "Unexpected packet ignored (waiting for ACK %u)", pending);
+    } else if (a == XFER_FAIL && pending == 0) {
+        log_msg(LOG_DEBUG, "Client rejected options (code %u)", x->peer_error);
+    } else if (a == XFER_FAIL) {
+        log_msg(LOG_ERROR, "Client aborted transfer (code %u)", x->peer_error);
+    }
+    return a;
+}
+
+XferAction xfer_read_expired(XferRead *x) {
+    XferAction a = xfer_read_timeout(x);
+    if (a == XFER_SEND) {
+        log_msg(LOG_DEBUG, "Timeout waiting ACK, retry block %u", x->block);
+    } else if (a == XFER_FAIL && x->block == 0) {
+        log_msg(LOG_ERROR, "Max retries exceeded waiting for OACK ack");
+    } else if (a == XFER_FAIL) {
+        log_msg(LOG_ERROR, "Max retries exceeded for block %u", x->block);
+    }
+    return a;
+}
+
+int xfer_read_run(XferRead *x, XferAction a, Transport *t, const XferHooks *h) {
+    unsigned char in[516];
+
+    for (;;) {
+        switch (a) {
+        case XFER_FILL: {
+            if (!h->fill) return 1;
+            ssize_t r = h->fill(h->ctx, x->pkt + 4, x->blksize, x->off);
+            if (r < 0) {
+                unsigned char err[64];
+                t->send(t, err, xfer_error_packet(err, sizeof(err), TFTP_ERR_UNDEF, "Read error"));
+                give_up(x, "read_error");
+                return 0;
+            }
+            a = xfer_read_filled(x, (size_t)r);
+            break;
+        }
+        case XFER_SEND:
+            if (t->send(t, x->out, x->out_len) != 0) return 0;
+            if (h->sent && x->block > 0) h->sent(h->ctx, x->block, x->retries > 0);
+            a = XFER_WAIT;
+            break;
+        case XFER_WAIT: {
+            ssize_t n = t->recv(t, in, sizeof(in));
+            if (n < 0) return 0;
+            if (n == 0) {
+                a = xfer_read_expired(x);
+                break;
+            }
+            a = xfer_read_recv(x, in, (size_t)n);
+            if (a != XFER_WAIT && a != XFER_FAIL && h->answered) h->answered(h->ctx);
+            break;
+        }
+        case XFER_DONE:
+            return 1;
+        case XFER_FAIL:
+        default:
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef XFER_H
+#define XFER_H
+
+#include "transport.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TFTP_OPCODE_RRQ  1
+#define TFTP_OPCODE_WRQ  2
+#define TFTP_OPCODE_DATA 3
+#define TFTP_OPCODE_ACK  4
+#define TFTP_OPCODE_ERR  5
+#define TFTP_OPCODE_OACK 6
+
+#define TFTP_ERR_UNDEF       0
+#define TFTP_ERR_NOT_FOUND   1
+#define TFTP_ERR_ACCESS      2
+#define TFTP_ERR_DISK_FULL   3
+#define TFTP_ERR_ILLEGAL_OP  4
+#define TFTP_ERR_UNKNOWN_TID 5
+#define TFTP_ERR_OPTION      8
+
+/*
+ * Sender side of a read transfer (RRQ) as a pure state machine: no I/O, no
+ * clock and no logging. Each step takes an input (a packet from the peer,
+ * a timeout or block content) and says what to do next. The caller owns
+ * the packet buffer and the transport; xfer_read_run() is the standard
+ * driver.
+ */
+
+typedef enum {
+    XFER_WAIT,    /* wait for the next packet (or timeout) */
+    XFER_SEND,    /* send out/out_len, then wait */
+    XFER_FILL,    /* put up to blksize bytes at off into pkt + 4, call xfer_read_filled() */
+    XFER_DONE,    /* the final block was acknowledged */
+    XFER_FAIL     /* give up; fail says why */
+} XferAction;
+
+typedef struct {
+    /* Fixed for the transfer */
+    unsigned char *pkt;          /* 4 + blksize bytes, owned by the caller */
+    size_t blksize;
+    int max_retries;
+
+    /* State */
+    int phase;                   /* XFER_PHASE_* in xfer.c */
+    uint16_t block;              /* outstanding block (0 = OACK) */
+    long long off;               /* file offset of the outstanding block */
+    size_t len;                  /* its payload length */
+    int retries;                 /* retransmissions of the outstanding packet */
+    unsigned long long total;    /* bytes acknowledged */
+
+    /* Result of the last step */
+    const unsigned char *out;
+    size_t out_len;
+    const char *fail;            /* event message, or NULL for a generic failure */
+    uint16_t peer_error;         /* code of a client ERROR */
+} XferRead;
+
+/* oack may be NULL (plain RFC 1350 transfer) and must outlive the transfer */
+XferAction xfer_read_start(XferRead *x, unsigned char *pkt, size_t blksize, int max_retries,
+                           const unsigned char *oack, size_t oack_len);
+XferAction xfer_read_filled(XferRead *x, size_t n);
+XferAction xfer_read_packet(XferRead *x, const unsigned char *buf, size_t len);
+XferAction xfer_read_timeout(XferRead *x);
+
+/* Driver hooks; all may be NULL */
+typedef struct {
+    /* Read up to len bytes at off; -1 on error. Without it the driver stops
+     * once block 1 is due, i.e. it only runs the OACK exchange. */
+    ssize_t (*fill)(void *ctx, unsigned char *buf, size_t len, long long off);
+    /* A DATA packet went out (retransmit = not its first copy) */
+    void (*sent)(void *ctx, uint16_t block, int retransmit);
+    /* The outstanding packet was acknowledged */
+    void (*answered)(void *ctx);
+    void *ctx;
+} XferHooks;
+
+/* xfer_read_packet() and xfer_read_timeout() with the driver's log lines,
+ * for event-driven drivers. After xfer_read_recv(), the outstanding packet
+ * was answered unless the result is XFER_WAIT or XFER_FAIL. */
+XferAction xfer_read_recv(XferRead *x, const unsigned char *buf, size_t len);
+XferAction xfer_read_expired(XferRead *x);
+
+/* Run a read transfer to completion over t. Returns 1 on success, 0 on failure. */
+int xfer_read_run(XferRead *x, XferAction a, Transport *t, const XferHooks *h);
+
+/* Build an ERROR packet; returns its length */
+size_t xfer_error_packet(unsigned char *buf, size_t size, uint16_t code, const char *msg);
+
+#endif
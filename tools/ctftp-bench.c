@@ -0,0 +1,184 @@
+/*
+ * ctftp-bench: measure the protocol cost of a read transfer in isolation.
+ *
+ * Usage:
+ *   ctftp-bench [-s size] [-b blksize] [-n runs] [-r max_retries] [-o] [-l drops]
+ *
+ * Runs the RRQ state machine (src/xfer.h) against the in-memory client
+ * (src/transport.h): no sockets, no file I/O, no clock waits. Block
+ * content is copied from a buffer. -o negotiates options first (OACK).
+ * -l replays a loss scenario: a comma-separated list of block numbers,
+ * one entry per lost transmission (0 = the OACK), e.g. the retransmit
+ * list of a flight recorder dump.
+ *
+ * A first, untimed run checks that the client received the content in
+ * order; the timed runs then report ns per block.
+ */
+#define _GNU_SOURCE
+#include "xfer.h"
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const unsigned char *data;
+    long long size;
+} BenchFile;
+
+static ssize_t bench_fill(void *ctx, unsigned char *buf, size_t len, long long off) {
+    const BenchFile *f = (const BenchFile *)ctx;
+    if (off >= f->size) return 0;
+    if ((long long)len > f->size - off) len = (size_t)(f->size - off);
+    memcpy(buf, f->data + off, len);
+    return (ssize_t)len;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t fnv1a(const unsigned char *p, long long len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (long long i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* "17,17,230" -> {17,17,230}; returns the count, or -1 if malformed */
+static long parse_drops(const char *spec, uint16_t **out) {
+    size_t cap = 16, n = 0;
+    uint16_t *v = (uint16_t *)malloc(cap * sizeof(uint16_t));
+    if (!v) return -1;
+    const char *p = spec;
+    while (*p) {
+        char *end;
+        long b = strtol(p, &end, 10);
+        if (end == p || b < 0 || b > 65535) {
+            free(v);
+            return -1;
+        }
+        if (n == cap) {
+            cap *= 2;
+            uint16_t *nv = (uint16_t *)realloc(v, cap * sizeof(uint16_t));
+            if (!nv) {
+                free(v);
+                return -1;
+            }
+            v = nv;
+        }
+        v[n++] = (uint16_t)b;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',') {
+            free(v);
+            return -1;
+        }
+    }
+    *out = v;
+    return (long)n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s size] [-b blksize] [-n runs] [-r max_retries] [-o] [-l drops]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    long long size = 32LL * 1024 * 1024;
+    long blksize = 512;
+    long runs = 20;
+    int max_retries = 5;
+    int with_oack = 0;
+    uint16_t *drops = NULL;
+    long ndrops = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(a, "-o") == 0) {
+            with_oack = 1;
+            continue;
+        }
+        if (!v) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(a, "-s") == 0) size = atoll(v);
+        else if (strcmp(a, "-b") == 0) blksize = atol(v);
+        else if (strcmp(a, "-n") == 0) runs = atol(v);
+        else if (strcmp(a, "-r") == 0) max_retries = atoi(v);
+        else if (strcmp(a, "-l") == 0) {
+            ndrops = parse_drops(v, &drops);
+            if (ndrops < 0) {
+                fprintf(stderr, "ctftp-bench: bad drop list: %s\n", v);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (size < 0 || blksize < 8 || blksize > 65464 || runs < 1 || max_retries < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    unsigned char *data = (unsigned char *)malloc(size > 0 ? (size_t)size : 1);
+    unsigned char *pkt = (unsigned char *)malloc(4 + (size_t)blksize);
+    if (!data || !pkt) {
+        fprintf(stderr, "ctftp-bench: out of memory\n");
+        return 1;
+    }
+    for (long long i = 0; i < size; ++i) data[i] = (unsigned char)(i * 131 + (i >> 9));
+    uint64_t want = fnv1a(data, size);
+
+    /* Same option the server would acknowledge */
+    static const unsigned char oack[] = { 0, TFTP_OPCODE_OACK, 'b', 'l', 'k', 's', 'i', 'z', 'e', 0, '0', 0 };
+
+    BenchFile f = { data, size };
+    XferHooks h = { bench_fill, NULL, NULL, &f };
+    uint64_t best = UINT64_MAX, total = 0;
+    unsigned long long blocks = 0;
+    MemTransport m;
+
+    for (long r = 0; r <= runs; ++r) {
+        mem_transport_init(&m, drops, (size_t)ndrops);
+        m.verify = (r == 0);
+        XferRead x;
+        uint64_t t0 = now_ns();
+        XferAction a = xfer_read_start(&x, pkt, (size_t)blksize, max_retries,
+                                       with_oack ? oack : NULL, with_oack ? sizeof(oack) : 0);
+        int ok = xfer_read_run(&x, a, &m.base, &h);
+        uint64_t dt = now_ns() - t0;
+
+        if (!ok || m.bytes != (uint64_t)size || (r == 0 && m.checksum != want)) {
+            fprintf(stderr, "ctftp-bench: transfer failed (%s, %llu of %lld bytes%s)\n",
+                    ok ? "completed" : (x.fail ? x.fail : "retries exhausted"),
+                    (unsigned long long)m.bytes, size,
+                    m.checksum == want ? "" : ", content mismatch");
+            return 1;
+        }
+        if (r == 0) continue;
+        if (dt < best) best = dt;
+        total += dt;
+        blocks = (unsigned long long)(size / blksize) + 1;
+    }
+
+    printf("size %lld, blksize %ld: %llu blocks, %llu packets sent, %llu lost, %llu timeouts\n",
+           size, blksize, blocks, (unsigned long long)m.sent,
+           (unsigned long long)m.lost, (unsigned long long)m.timeouts);
+    printf("%ld runs: %.1f ns/block best, %.1f ns/block mean\n", runs,
+           (double)best / (double)blocks, (double)total / (double)runs / (double)blocks);
+
+    free(drops);
+    free(pkt);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * ctftp-evdecode: receive ctftp events and print them as JSON lines.
+ *
+ * Usage:
+ *   ctftp-evdecode [bind_ip:]port    listen for UDP events (binary or JSON)
+ *   ctftp-evdecode -                 decode concatenated binary events from stdin
+ *   ctftp-evdecode shm:///path       follow a shared-memory event ring
+ *
+ * UDP datagrams are drained in batches with recvmmsg(), and output goes
+ * through a large stdio buffer, so one core keeps up with well over
+ * 100k events per second.
+ */
+#define _GNU_SOURCE
+#include "evcodec.h"
+#include "evring.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define BATCH    64
+#define DGRAM_MAX 4096
+
+static void print_event(const Event *ev) {
+    char json[EVJSON_MAX_SIZE];
+    size_t len = evcodec_encode_json(ev, json, sizeof(json));
+    if (len == 0) return;
+    json[len] = '\n';
+    fwrite(json, 1, len + 1, stdout);
+}
+
+static void handle_payload(const unsigned char *buf, size_t len) {
+    if (len > 0 && buf[0] == '{') {
+        /* Already JSON: pass through unchanged */
+        fwrite(buf, 1, len, stdout);
+        fputc('\n', stdout);
+        return;
+    }
+    Event ev;
+    if (evcodec_decode_bin(buf, len, &ev) < 0) {
+        fprintf(stderr, "ctftp-evdecode: malformed event (%zu bytes)\n", len);
+        return;
+    }
+    print_event(&ev);
+}
+
+static int run_stdin(void) {
+    static unsigned char buf[1 << 16];
+    size_t have = 0;
+
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, buf + have, sizeof(buf) - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            return 1;
+        }
+        if (n == 0) break;
+        have += (size_t)n;
+
+        size_t off = 0;
+        while (off < have) {
+            Event ev;
+            int used = evcodec_decode_bin(buf + off, have - off, &ev);
+            if (used < 0) break;
+            print_event(&ev);
+            off += (size_t)used;
+        }
+        memmove(buf, buf + off, have - off);
+        have -= off;
+        if (have == sizeof(buf)) {
+            fprintf(stderr, "ctftp-evdecode: garbage on input, giving up\n");
+            return 1;
+        }
+    }
+    fflush(stdout);
+    return have == 0 ? 0 : 1;
+}
+
+static int run_ring(const char *path) {
+    EvRing ring;
+    if (evring_open_reader(&ring, path, 0) != 0) {
+        fprintf(stderr, "ctftp-evdecode: cannot open event ring %s\n", path);
+        return 1;
+    }
+
+    uint64_t lost = 0, reported = 0;
+    for (;;) {
+        Event ev;
+        int got = 0;
+        while (evring_read(&ring, &ev, &lost) == 1) {
+            print_event(&ev);
+            got = 1;
+        }
+        if (lost != reported) {
+            fprintf(stderr, "ctftp-evdecode: %llu events overwritten before read\n",
+                    (unsigned long long)(lost - reported));
+            reported = lost;
+        }
+        if (got) {
+            fflush(stdout);
+            continue;
+        }
+        /* Nothing new: poll again shortly */
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+    evring_close(&ring);
+    return 0;
+}
+
+static int run_udp(const char *spec) {
+    char host[64] = "0.0.0.0";
+    int port = 0;
+    const char *colon = strrchr(spec, ':');
+    if (colon) {
+        size_t hlen = (size_t)(colon - spec);
+        if (hlen >= sizeof(host)) hlen = sizeof(host) - 1;
+        memcpy(host, spec, hlen);
+        host[hlen] = '\0';
+        spec = colon + 1;
+    }
+    if (parse_int(spec, &port) != 0 || port <= 0 || port > 65535) {
+        fprintf(stderr, "ctftp-evdecode: invalid port\n");
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "ctftp-evdecode: invalid address %s\n", host);
+        close(sock);
+        return 1;
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        close(sock);
+        return 1;
+    }
+
+    static unsigned char bufs[BATCH][DGRAM_MAX];
+    struct iovec iov[BATCH];
+    struct mmsghdr msgs[BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < BATCH; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = DGRAM_MAX;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (;;) {
+        int n = recvmmsg(sock, msgs, BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("recvmmsg");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            handle_payload(bufs[i], msgs[i].msg_len);
+        }
+        fflush(stdout);
+    }
+    close(sock);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s [bind_ip:]port | - | shm:///path\n", argv[0]);
+        return 2;
+    }
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    if (strcmp(argv[1], "-") == 0) {
+        return run_stdin();
+    }
+    if (starts_with(argv[1], "shm://")) {
+        return run_ring(argv[1] + strlen("shm://"));
+    }
+    return run_udp(argv[1]);
+}
@@ -0,0 +1,204 @@
+/*
+ * ctftp-load: download one file over and over from many concurrent
+ * clients and report server throughput.
+ *
+ * Usage:
+ *   ctftp-load [-c clients] [-t seconds] [-b blksize] host port file
+ *
+ * Every client runs one RRQ at a time on its own UDP socket (octet mode,
+ * blksize option if -b is given), ACKs each DATA block and starts the next
+ * download as soon as one completes. A client that hears nothing for a
+ * second resends its last packet. At the end the tool prints completed
+ * transfers per second, payload throughput and the transfer latency
+ * percentiles, e.g. to compare the socket and xdp= paths of a listener.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+typedef struct {
+    int fd;
+    struct sockaddr_in server;     /* listener, then the session port */
+    unsigned char last[600];       /* last packet sent, for resends */
+    size_t last_len;
+    size_t blksize;
+    uint16_t expect;
+    uint64_t bytes;
+    uint64_t start_ns;
+    uint64_t heard_ns;
+} Client;
+
+static struct sockaddr_in g_listener;
+static const char *g_file;
+static int g_blksize = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void client_send(Client *c, const unsigned char *buf, size_t len) {
+    memcpy(c->last, buf, len);
+    c->last_len = len;
+    sendto(c->fd, buf, len, 0, (struct sockaddr *)&c->server, sizeof(c->server));
+}
+
+static void client_start(Client *c, uint64_t now) {
+    unsigned char req[600];
+    size_t pos = 2;
+    req[0] = 0;
+    req[1] = 1;
+    pos += (size_t)snprintf((char *)req + pos, sizeof(req) - pos, "%s", g_file) + 1;
+    pos += (size_t)snprintf((char *)req + pos, sizeof(req) - pos, "octet") + 1;
+    if (g_blksize > 0) {
+        pos += (size_t)snprintf((char *)req + pos, sizeof(req) - pos, "blksize") + 1;
+        pos += (size_t)snprintf((char *)req + pos, sizeof(req) - pos, "%d", g_blksize) + 1;
+    }
+    c->server = g_listener;
+    c->blksize = 512;
+    c->expect = 1;
+    c->bytes = 0;
+    c->start_ns = c->heard_ns = now;
+    client_send(c, req, pos);
+}
+
+static void client_ack(Client *c, uint16_t block) {
+    unsigned char ack[4] = { 0, 4, (unsigned char)(block >> 8), (unsigned char)block };
+    client_send(c, ack, sizeof(ack));
+}
+
+/* Returns 1 when the transfer completed, -1 on a server error */
+static int client_input(Client *c, const unsigned char *p, size_t n,
+                        const struct sockaddr_in *from) {
+    if (n < 4) return 0;
+    c->server.sin_port = from->sin_port;
+    if (p[1] == 5) return -1;
+    if (p[1] == 6) {
+        const char *o = (const char *)p + 2;
+        const char *end = (const char *)p + n;
+        while (o < end) {
+            const char *v = o + strlen(o) + 1;
+            if (v >= end) break;
+            if (strcasecmp(o, "blksize") == 0) c->blksize = (size_t)atoi(v);
+            o = v + strlen(v) + 1;
+        }
+        client_ack(c, 0);
+        return 0;
+    }
+    if (p[1] != 3) return 0;
+    uint16_t block = (uint16_t)((p[2] << 8) | p[3]);
+    client_ack(c, block);
+    if (block != c->expect) return 0;
+    c->expect++;
+    c->bytes += n - 4;
+    return n - 4 < c->blksize;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    int nclients = 32;
+    int seconds = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:b:")) != -1) {
+        switch (opt) {
+        case 'c': nclients = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'b': g_blksize = atoi(optarg); break;
+        default: goto usage;
+        }
+    }
+    if (argc - optind != 3 || nclients <= 0 || seconds <= 0) goto usage;
+
+    memset(&g_listener, 0, sizeof(g_listener));
+    g_listener.sin_family = AF_INET;
+    g_listener.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &g_listener.sin_addr) != 1) goto usage;
+    g_file = argv[optind + 2];
+
+    Client *clients = (Client *)calloc((size_t)nclients, sizeof(Client));
+    struct pollfd *pfds = (struct pollfd *)calloc((size_t)nclients, sizeof(struct pollfd));
+    size_t lat_cap = 1 << 20;
+    uint64_t *lat = (uint64_t *)malloc(lat_cap * sizeof(uint64_t));
+    if (!clients || !pfds || !lat) {
+        fprintf(stderr, "ctftp-load: out of memory\n");
+        return 1;
+    }
+
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < nclients; ++i) {
+        clients[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (clients[i].fd < 0) {
+            fprintf(stderr, "ctftp-load: socket: %s\n", strerror(errno));
+            return 1;
+        }
+        pfds[i].fd = clients[i].fd;
+        pfds[i].events = POLLIN;
+        client_start(&clients[i], t0);
+    }
+
+    uint64_t end = t0 + (uint64_t)seconds * 1000000000ULL;
+    uint64_t done = 0, errors = 0, resends = 0, bytes = 0;
+    size_t nlat = 0;
+    unsigned char buf[65536];
+    uint64_t now = t0;
+    while (now < end) {
+        if (poll(pfds, (nfds_t)nclients, 100) < 0 && errno != EINTR) break;
+        now = now_ns();
+        for (int i = 0; i < nclients; ++i) {
+            Client *c = &clients[i];
+            if (pfds[i].revents & POLLIN) {
+                for (;;) {
+                    struct sockaddr_in from;
+                    socklen_t flen = sizeof(from);
+                    ssize_t n = recvfrom(c->fd, buf, sizeof(buf), 0,
+                                         (struct sockaddr *)&from, &flen);
+                    if (n < 0) break;
+                    c->heard_ns = now;
+                    int r = client_input(c, buf, (size_t)n, &from);
+                    if (r == 0) continue;
+                    if (r > 0) {
+                        done++;
+                        bytes += c->bytes;
+                        if (nlat < lat_cap) lat[nlat++] = now - c->start_ns;
+                    } else {
+                        errors++;
+                    }
+                    client_start(c, now);
+                }
+            } else if (now - c->heard_ns > 1000000000ULL) {
+                resends++;
+                c->heard_ns = now;
+                sendto(c->fd, c->last, c->last_len, 0,
+                       (struct sockaddr *)&c->server, sizeof(c->server));
+            }
+        }
+    }
+
+    double secs = (double)(now - t0) / 1e9;
+    qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+    printf("%d clients, %.1f s: %llu transfers (%.0f/s), %.1f MB/s, %llu errors, %llu resends\n",
+           nclients, secs, (unsigned long long)done, (double)done / secs,
+           (double)bytes / secs / 1e6, (unsigned long long)errors, (unsigned long long)resends);
+    if (nlat > 0) {
+        printf("latency: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               (double)lat[nlat / 2] / 1e6, (double)lat[nlat * 99 / 100] / 1e6,
+               (double)lat[nlat - 1] / 1e6);
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-c clients] [-t seconds] [-b blksize] host port file\n", argv[0]);
+    return 2;
+}
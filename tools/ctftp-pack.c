@@ -0,0 +1,235 @@
+/*
+ * ctftp-pack: pack a TFTP root directory into one indexed bundle file.
+ *
+ * Usage:
+ *   ctftp-pack [-a] root_dir bundle
+ *
+ * Every regular file below root_dir is stored under its path relative to
+ * root_dir (e.g. "phones/SEP001.cnf.xml"). Per-request .log files and
+ * unfinished upload temp files are skipped unless -a is given. The bundle
+ * is written to a temp file and renamed over the target, so a server with
+ * root_bundle= pointing at it switches over atomically.
+ *
+ * See src/bundle.h for the format.
+ */
+#define _GNU_SOURCE
+#include "bundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char *name;
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t offset;
+} PackFile;
+
+static PackFile *g_files = NULL;
+static size_t g_count = 0;
+static size_t g_cap = 0;
+static size_t g_root_len = 0;
+static int g_all = 0;
+
+static int ends_with(const char *s, const char *suffix) {
+    size_t ls = strlen(s), lf = strlen(suffix);
+    return ls >= lf && strcmp(s + ls - lf, suffix) == 0;
+}
+
+static int collect(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) return 0;
+
+    const char *rel = path + g_root_len;
+    while (*rel == '/') rel++;
+    if (!g_all && (ends_with(rel, ".log") || strstr(rel, ".ctftp-"))) return 0;
+
+    if (g_count == g_cap) {
+        size_t cap = g_cap ? g_cap * 2 : 1024;
+        PackFile *n = (PackFile *)realloc(g_files, cap * sizeof(PackFile));
+        if (!n) return -1;
+        g_files = n;
+        g_cap = cap;
+    }
+    PackFile *f = &g_files[g_count];
+    f->name = strdup(rel);
+    f->path = strdup(path);
+    if (!f->name || !f->path) return -1;
+    f->size = (uint64_t)st->st_size;
+    f->mtime = (int64_t)st->st_mtime;
+    f->offset = 0;
+    g_count++;
+    return 0;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(((const PackFile *)a)->name, ((const PackFile *)b)->name);
+}
+
+static uint64_t align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) & ~(a - 1);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int write_zeros(int fd, size_t len) {
+    static const unsigned char zeros[BUNDLE_ALIGN];
+    return write_all(fd, zeros, len);
+}
+
+/* Append one source file; fails if it changed size since the scan */
+static int copy_file(int out, const PackFile *f) {
+    int in = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+
+    static unsigned char buf[1 << 16];
+    uint64_t left = f->size;
+    while (left > 0) {
+        ssize_t r = read(in, buf, left < sizeof(buf) ? (size_t)left : sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0 || write_all(out, buf, (size_t)r) != 0) {
+            if (r == 0) errno = EAGAIN;
+            close(in);
+            return -1;
+        }
+        left -= (uint64_t)r;
+    }
+    close(in);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int argi = 1;
+    if (argi < argc && strcmp(argv[argi], "-a") == 0) {
+        g_all = 1;
+        argi++;
+    }
+    if (argc - argi != 2) {
+        fprintf(stderr, "usage: %s [-a] root_dir bundle\n", argv[0]);
+        return 2;
+    }
+    const char *root = argv[argi];
+    const char *out_path = argv[argi + 1];
+
+    g_root_len = strlen(root);
+    if (nftw(root, collect, 64, FTW_PHYS) != 0) {
+        fprintf(stderr, "ctftp-pack: cannot scan %s: %s\n", root, strerror(errno));
+        return 1;
+    }
+    if (g_count > UINT32_MAX / 4) {
+        fprintf(stderr, "ctftp-pack: too many files\n");
+        return 1;
+    }
+    qsort(g_files, g_count, sizeof(PackFile), by_name);
+
+    /* Layout: header, buckets, entries, names, then aligned contents */
+    uint32_t buckets = 16;
+    while (buckets < 2 * g_count) buckets <<= 1;
+
+    BundleHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BUNDLE_MAGIC;
+    hdr.version = BUNDLE_VERSION;
+    hdr.entry_count = (uint32_t)g_count;
+    hdr.bucket_count = buckets;
+    hdr.buckets_offset = sizeof(BundleHeader);
+    hdr.entries_offset = align_up(hdr.buckets_offset + (uint64_t)buckets * sizeof(uint32_t), 8);
+    hdr.names_offset = hdr.entries_offset + (uint64_t)g_count * sizeof(BundleEntry);
+
+    uint32_t *table = (uint32_t *)calloc(buckets, sizeof(uint32_t));
+    BundleEntry *entries = (BundleEntry *)calloc(g_count ? g_count : 1, sizeof(BundleEntry));
+    if (!table || !entries) {
+        fprintf(stderr, "ctftp-pack: out of memory\n");
+        return 1;
+    }
+
+    uint64_t names_len = 0;
+    for (size_t i = 0; i < g_count; ++i) {
+        size_t len = strlen(g_files[i].name);
+        if (names_len + len > UINT32_MAX) {
+            fprintf(stderr, "ctftp-pack: names table too large\n");
+            return 1;
+        }
+        entries[i].hash = bundle_hash(g_files[i].name, len);
+        entries[i].name_offset = (uint32_t)names_len;
+        entries[i].name_len = (uint32_t)len;
+        entries[i].size = g_files[i].size;
+        entries[i].mtime = g_files[i].mtime;
+        names_len += len;
+
+        uint32_t slot = (uint32_t)entries[i].hash & (buckets - 1);
+        while (table[slot] != 0) slot = (slot + 1) & (buckets - 1);
+        table[slot] = (uint32_t)i + 1;
+    }
+
+    hdr.data_offset = align_up(hdr.names_offset + names_len, BUNDLE_ALIGN);
+    uint64_t pos = hdr.data_offset;
+    for (size_t i = 0; i < g_count; ++i) {
+        entries[i].offset = pos;
+        g_files[i].offset = pos;
+        pos = align_up(pos + g_files[i].size, BUNDLE_ALIGN);
+    }
+    hdr.total_size = pos;
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp-XXXXXX", out_path);
+    int out = mkstemp(tmp_path);
+    if (out < 0) {
+        fprintf(stderr, "ctftp-pack: cannot create %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+
+    int ok = write_all(out, &hdr, sizeof(hdr)) == 0 &&
+             write_all(out, table, (size_t)buckets * sizeof(uint32_t)) == 0 &&
+             write_zeros(out, (size_t)(hdr.entries_offset - hdr.buckets_offset -
+                                       (uint64_t)buckets * sizeof(uint32_t))) == 0 &&
+             write_all(out, entries, g_count * sizeof(BundleEntry)) == 0;
+    for (size_t i = 0; ok && i < g_count; ++i) {
+        ok = write_all(out, g_files[i].name, entries[i].name_len) == 0;
+    }
+    if (ok) ok = write_zeros(out, (size_t)(hdr.data_offset - hdr.names_offset - names_len)) == 0;
+
+    int reported = 0;
+    for (size_t i = 0; ok && i < g_count; ++i) {
+        if (copy_file(out, &g_files[i]) != 0) {
+            fprintf(stderr, "ctftp-pack: %s: %s\n", g_files[i].path,
+                    errno == EAGAIN ? "changed while packing" : strerror(errno));
+            ok = 0;
+            reported = 1;
+            break;
+        }
+        uint64_t end = g_files[i].offset + g_files[i].size;
+        ok = write_zeros(out, (size_t)(align_up(end, BUNDLE_ALIGN) - end)) == 0;
+    }
+
+    if (!ok || fchmod(out, 0644) != 0 || fsync(out) != 0 || close(out) != 0 ||
+        rename(tmp_path, out_path) != 0) {
+        if (!reported) fprintf(stderr, "ctftp-pack: cannot write %s: %s\n", out_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    printf("packed %zu files (%llu bytes) into %s\n",
+           g_count, (unsigned long long)hdr.total_size, out_path);
+    return 0;
+}